@@ -0,0 +1,436 @@
+/**
+ * \file buffer_suite.cpp
+ * \author ichramm
+ *
+ * The numbers behind moving the transport from std::vector<char> to
+ * transport::buffer, section by section:
+ *
+ *  - append:    stream through a queue of bytes, appending at the back and
+ *               consuming from the front, buffer against vector
+ *  - loopback:  TCP over loopback writing a header and a payload, copied
+ *               into one vector first, or gathered from two arrays or
+ *               from the buckets of a buffer
+ *  - fanout:    one payload queued for many subscribers, copied for each
+ *               one or shared as slices
+ *  - allocator: buckets allocated and freed by several threads at once,
+ *               slab_allocator against operator new
+ *  - scan:      byte searches over contiguous and chained data, byte_scan
+ *               against byte at a time loops
+ *
+ * Every measurement is calibrated to last about 100 ms, run once to warm
+ * up, then repeated; the median is reported with the spread of the
+ * repetitions. The main thread is pinned to \p cpu and helper threads to
+ * the ones after it. Runs are comparable when the spread is small.
+ *
+ * Build: g++ -std=c++11 -O2 -I.. buffer_suite.cpp -o buffer_suite -lboost_system -lpthread
+ * Usage: buffer_suite [section|all] [repetitions] [cpu]
+ */
+#include "transport/__buffer.hpp"
+#include "transport/busy_poll.hpp"
+#include "transport/byte_scan.hpp"
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace et::transport;
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+typedef buffer<char>              buffer_type;
+
+size_t   repetitions = 7;
+int      first_cpu   = 0;
+unsigned cpus        = std::max(1u, std::thread::hardware_concurrency());
+
+double elapsed(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+/**
+ * Pins the calling thread to the \p n th cpu after the first one
+ */
+void pin(unsigned n)
+{
+    if (first_cpu >= 0) {
+        busy_poll::pin((unsigned(first_cpu) + n) % cpus);
+    }
+}
+
+/**
+ * \brief Runs \p round, which processes \p units of something, enough
+ * times to last about 100 ms, warming up in the process, then that many
+ * times per repetition; prints the median rate and the spread
+ */
+void measure(const char *title, double units, const char *unit, const std::function<size_t()>& round)
+{
+    volatile size_t sink = 0;
+
+    // calibration doubles as warm up
+    size_t rounds = 1;
+    for (;;) {
+        clock_type::time_point start = clock_type::now();
+        for (size_t i = 0; i < rounds; ++i) {
+            sink = sink + round();
+        }
+        if (elapsed(start) > 0.1 || rounds >= (size_t(1) << 30)) {
+            break;
+        }
+        rounds *= 2;
+    }
+
+    std::vector<double> rates;
+    for (size_t r = 0; r < repetitions; ++r) {
+        clock_type::time_point start = clock_type::now();
+        for (size_t i = 0; i < rounds; ++i) {
+            sink = sink + round();
+        }
+        rates.push_back(units * double(rounds) / elapsed(start));
+    }
+    std::sort(rates.begin(), rates.end());
+    double median = rates[rates.size() / 2];
+    printf("  %-40s %10.2f %-6s  [%.2f - %.2f] %4.1f%%\n", title, median, unit,
+           rates.front(), rates.back(), 100 * (rates.back() - rates.front()) / median);
+}
+
+const double GB = 1e9;
+const double MOPS = 1e6;
+
+/*
+ * append: a queue of bytes kept at about 64 KB, appended to in messages of
+ * a given size and consumed as much from the front
+ */
+void append_section()
+{
+    const size_t QUEUED = 65536;
+    const size_t ROUND  = 1 << 20;
+    const size_t sizes[] = { 64, 1500, 16384 };
+
+    for (size_t size : sizes) {
+        std::vector<char> message(size, 'x');
+        size_t count = ROUND / size;
+        char title[64];
+
+        std::vector<char> vector_queue;
+        vector_queue.reserve(QUEUED + size);
+        snprintf(title, sizeof(title), "vector, %zu byte messages", size);
+        measure(title, double(count * size) / GB, "GB/s", [&] {
+            for (size_t i = 0; i < count; ++i) {
+                vector_queue.insert(vector_queue.end(), message.begin(), message.end());
+                if (vector_queue.size() > QUEUED) {
+                    vector_queue.erase(vector_queue.begin(), vector_queue.begin() + size);
+                }
+            }
+            return vector_queue.size();
+        });
+
+        buffer_type buffer_queue;
+        snprintf(title, sizeof(title), "buffer, %zu byte messages", size);
+        measure(title, double(count * size) / GB, "GB/s", [&] {
+            for (size_t i = 0; i < count; ++i) {
+                buffer_queue.append(message.data(), size);
+                if (buffer_queue.size() > QUEUED) {
+                    buffer_queue.consume(size);
+                }
+            }
+            return buffer_queue.size();
+        });
+
+        // reading into it, as a connection does
+        buffer_type read_queue;
+        snprintf(title, sizeof(title), "buffer prepare/commit, %zu bytes", size);
+        measure(title, double(count * size) / GB, "GB/s", [&] {
+            for (size_t i = 0; i < count; ++i) {
+                buffer_type::mutable_buffers_type room = read_queue.prepare(size);
+                size_t copied = 0;
+                for (auto it = room.begin(); it != room.end(); ++it) {
+                    boost::asio::mutable_buffer b(*it);
+                    std::memcpy(b.data(), message.data() + copied, b.size());
+                    copied += b.size();
+                }
+                read_queue.commit(copied);
+                if (read_queue.size() > QUEUED) {
+                    read_queue.consume(size);
+                }
+            }
+            return read_queue.size();
+        });
+    }
+}
+
+/*
+ * loopback: a writer thread sends header + payload messages over TCP,
+ * this one reads them into a buffer
+ */
+void loopback_section()
+{
+    const size_t HEADER = 16;
+    const size_t TOTAL  = 64 << 20;
+    const size_t sizes[] = { 1024, 16384, 262144 };
+
+    boost::asio::io_service service;
+    boost::asio::ip::tcp::acceptor acceptor(service,
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    boost::asio::ip::tcp::socket reader(service), writer(service);
+    writer.connect(acceptor.local_endpoint());
+    acceptor.accept(reader);
+    writer.set_option(boost::asio::ip::tcp::no_delay(true));
+
+    for (size_t size : sizes) {
+        buffer_type payload;
+        std::vector<char> bytes(size, 'p');
+        payload.append(bytes.data(), size);
+        char header[HEADER] = { 0 };
+        size_t count = TOTAL / (HEADER + size);
+        size_t total = count * (HEADER + size);
+
+        // 0: copied into one vector, 1: header and payload gathered from two
+        // contiguous arrays, 2: gathered from the buckets of a buffer
+        const char *modes[] = { "copied", "gathered, 2 arrays", "gathered, buckets" };
+        for (int mode = 0; mode < 3; ++mode) {
+            char title[64];
+            snprintf(title, sizeof(title), "%s, %zu byte payload", modes[mode], size);
+            buffer_type incoming;
+            measure(title, double(total) / GB, "GB/s", [&] {
+                std::thread sender([&] {
+                    pin(1);
+                    std::vector<char> flat;
+                    buffer_type message;
+                    for (size_t i = 0; i < count; ++i) {
+                        if (mode == 2) {
+                            message.append(header, HEADER);
+                            message.append(payload.slice());
+                            boost::asio::write(writer, message.data());
+                            message.clear();
+                        } else if (mode == 1) {
+                            std::array<boost::asio::const_buffer, 2> two = {{
+                                boost::asio::buffer(header), boost::asio::buffer(bytes)
+                            }};
+                            boost::asio::write(writer, two);
+                        } else {
+                            flat.assign(header, header + HEADER);
+                            flat.resize(HEADER + size);
+                            payload.copy_to(flat.data() + HEADER, size);
+                            boost::asio::write(writer, boost::asio::buffer(flat));
+                        }
+                    }
+                });
+                size_t received = 0;
+                while (received < total) {
+                    size_t n = reader.read_some(incoming.prepare(65536));
+                    incoming.commit(n);
+                    incoming.consume(n);
+                    received += n;
+                }
+                sender.join();
+                return received;
+            });
+        }
+    }
+}
+
+/*
+ * fanout: a payload queued for each subscriber, by copy into a buffer of
+ * its own or as a slice
+ */
+void fanout_section()
+{
+    const size_t PAYLOAD = 16384;
+    const size_t subscribers[] = { 8, 64 };
+
+    std::vector<char> bytes(PAYLOAD, 'f');
+
+    for (size_t n : subscribers) {
+        char title[64];
+
+        // a payload of its own for each mode, share() below is for good
+        buffer_type copied;
+        copied.append(bytes.data(), PAYLOAD);
+        std::vector<buffer_type> copies(n);
+        snprintf(title, sizeof(title), "copied to %zu subscribers", n);
+        measure(title, double(n) / MOPS, "M/s", [&] {
+            for (buffer_type& b : copies) {
+                b.append(copied);
+                b.consume(PAYLOAD);
+            }
+            return copies.size();
+        });
+
+        buffer_type sliced;
+        sliced.append(bytes.data(), PAYLOAD);
+        std::vector<buffer_type::slice_type> slices(n);
+        snprintf(title, sizeof(title), "sliced to %zu subscribers", n);
+        measure(title, double(n) / MOPS, "M/s", [&] {
+            for (buffer_type::slice_type& s : slices) {
+                s = sliced.slice();
+            }
+            return slices.size();
+        });
+        slices.assign(n, buffer_type::slice_type());
+
+        // the slice is marked for other threads, references become atomic
+        buffer_type shared_payload;
+        shared_payload.append(bytes.data(), PAYLOAD);
+        buffer_type::slice_type shared = shared_payload.slice();
+        shared.share();
+        snprintf(title, sizeof(title), "shared slice to %zu subscribers", n);
+        measure(title, double(n) / MOPS, "M/s", [&] {
+            for (buffer_type::slice_type& s : slices) {
+                s = shared;
+            }
+            return slices.size();
+        });
+    }
+}
+
+/*
+ * allocator: every thread allocates a burst of buckets and frees them
+ */
+void allocator_section()
+{
+    const size_t BURST  = 64;
+    const size_t ROUNDS = 4096;
+    const size_t OBJECT = buffer_type::allocator_type::STRIDE;  // what the slab hands out
+
+    buffer_type::allocator_type& slab = buffer_type::allocator();
+    std::vector<unsigned> counts = { 1, 2, 4 };
+    if (cpus > 4) {
+        counts.push_back(cpus);
+    }
+
+    for (unsigned threads : counts) {
+        for (int use_slab = 0; use_slab < 2; ++use_slab) {
+            char title[64];
+            snprintf(title, sizeof(title), "%s, %u threads", use_slab ? "slab_allocator" : "operator new", threads);
+            measure(title, double(threads * ROUNDS * BURST) / MOPS, "M/s", [&] {
+                std::vector<std::thread> workers;
+                for (unsigned t = 0; t < threads; ++t) {
+                    workers.emplace_back([&, t] {
+                        pin(t);
+                        void *objects[BURST];
+                        for (size_t r = 0; r < ROUNDS; ++r) {
+                            for (size_t i = 0; i < BURST; ++i) {
+                                objects[i] = use_slab ? slab.allocate() : ::operator new(OBJECT);
+                                *static_cast<char*>(objects[i]) = char(i);
+                            }
+                            for (size_t i = 0; i < BURST; ++i) {
+                                if (use_slab) {
+                                    slab.deallocate(objects[i]);
+                                } else {
+                                    ::operator delete(objects[i]);
+                                }
+                            }
+                        }
+                    });
+                }
+                for (std::thread& w : workers) {
+                    w.join();
+                }
+                return size_t(threads);
+            });
+        }
+    }
+}
+
+size_t naive_find(const char *p, size_t n, char c)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (p[i] == c) {
+            return i;
+        }
+    }
+    return n;
+}
+
+size_t naive_span(const char *p, size_t n, const bool *table)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (!table[uint8_t(p[i])]) {
+            return i;
+        }
+    }
+    return n;
+}
+
+/*
+ * scan: searches over 64 KB that find nothing, so everything is scanned
+ */
+void scan_section()
+{
+    const size_t RANGE = 65536;
+    const char *TOKEN = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_.";
+
+    std::vector<char> data(RANGE);
+    for (size_t i = 0; i < RANGE; ++i) {
+        data[i] = TOKEN[(i * 7) % strlen(TOKEN)];
+    }
+    const char *p = data.data();
+    buffer_type chain;
+    chain.append(p, RANGE);
+    byte_class token(TOKEN);
+    bool table[256] = { false };
+    for (const char *t = TOKEN; *t; ++t) {
+        table[uint8_t(*t)] = true;
+    }
+
+    double units = double(RANGE) / GB;
+    printf("  (byte_scan: %s)\n", byte_scan::name(byte_scan::best()));
+    measure("find '\\n', naive loop", units, "GB/s", [&] { return naive_find(p, RANGE, '\n'); });
+    measure("find '\\n', byte_scan", units, "GB/s", [&] { return byte_scan::find(p, RANGE, '\n'); });
+    measure("find '\\n', byte_scan chained", units, "GB/s", [&] { return byte_scan::find(chain.data(), '\n'); });
+    measure("token span, naive table loop", units, "GB/s", [&] { return naive_span(p, RANGE, table); });
+    measure("token span, byte_scan", units, "GB/s", [&] { return byte_scan::find_not_in(p, RANGE, token); });
+    measure("token span, byte_scan chained", units, "GB/s", [&] { return byte_scan::find_not_in(chain.data(), token); });
+}
+
+struct section {
+    const char *name;
+    void      (*run)();
+};
+
+const section SECTIONS[] = {
+    { "append",    append_section },
+    { "loopback",  loopback_section },
+    { "fanout",    fanout_section },
+    { "allocator", allocator_section },
+    { "scan",      scan_section },
+};
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string which = argc > 1 ? argv[1] : "all";
+    repetitions       = argc > 2 ? std::max(1ul, strtoul(argv[2], nullptr, 10)) : repetitions;
+    first_cpu         = argc > 3 ? atoi(argv[3]) : first_cpu;
+
+    bool found = which == "all";
+    for (const section& s : SECTIONS) {
+        found = found || which == s.name;
+    }
+    if (!found) {
+        fprintf(stderr, "unknown section %s\n", which.c_str());
+        return 1;
+    }
+
+    pin(0);
+    printf("%zu repetitions, %u cpus, median [min - max] spread\n", repetitions, cpus);
+    for (const section& s : SECTIONS) {
+        if (which == "all" || which == s.name) {
+            printf("%s\n", s.name);
+            s.run();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,258 @@
+/**
+ * \file busy_poll.cpp
+ * \author ichramm
+ *
+ * Ping-pong over loopback comparing round trips when both ends wait in the
+ * reactor against both ends spinning in busy_receive() on threads of their
+ * own, for UDP and TCP. The difference is the cost of waking up, twice per
+ * round trip.
+ *
+ * Busy polling only pays off with a free core for each spinning thread.
+ *
+ * Build: g++ -std=c++11 -O2 -I.. busy_poll.cpp -o busy_poll -lboost_system -lpthread
+ * Usage: busy_poll [round_trips] [client_cpu server_cpu]
+ */
+#include "transport/latency_histogram.hpp"
+#include "transport/tcp_connection.hpp"
+#include "transport/udp_connection.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+using namespace et::transport;
+
+namespace {
+
+const size_t MESSAGE = 64;
+
+size_t round_trips = 100000;
+int    client_cpu  = -1;
+int    server_cpu  = -1;
+
+uint64_t now()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void pin(int cpu)
+{
+    if (cpu >= 0) {
+        busy_poll::pin(unsigned(cpu));
+    }
+}
+
+void report(const char *title, const latency_histogram& rtt, double seconds)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "%s (%.0f k/s)", title, double(rtt.count()) / seconds / 1000);
+    rtt.print(stdout, line, 1000);
+}
+
+void udp(bool busy)
+{
+    boost::asio::io_service client_service, server_service;
+    udp_connection client(client_service), server(server_service);
+    udp_connection::endpoint_type any(boost::asio::ip::address_v4::loopback(), 0);
+    server.socket().open(boost::asio::ip::udp::v4());
+    server.socket().bind(any);
+    client.socket().open(boost::asio::ip::udp::v4());
+    client.socket().bind(any);
+    client.socket().connect(server.socket().local_endpoint());
+    if (busy) {
+        server.enable_busy_poll();
+        client.enable_busy_poll();
+    }
+
+    std::atomic<bool> running(true);
+    latency_histogram rtt;
+    char ping[MESSAGE] = { 0 };
+    uint64_t sent = 0;
+
+    auto echo = [&](const udp_connection::error_code& error, const udp_connection::received_batch& batch) {
+        for (const udp_connection::received_datagram& datagram : batch) {
+            udp_connection::error_code ignored;
+            server.socket().send_to(boost::asio::buffer(datagram.data), datagram.endpoint, 0, ignored);
+        }
+        (void)error;
+    };
+    auto pong = [&](const udp_connection::error_code& error, const udp_connection::received_batch& batch) {
+        if (error || batch.empty()) {
+            return;
+        }
+        rtt.record(now() - sent);
+        if (rtt.count() == round_trips) {
+            running = false;
+            client_service.stop();
+            server_service.stop();
+            return;
+        }
+        sent = now();
+        udp_connection::error_code ignored;
+        client.socket().send(boost::asio::buffer(ping), 0, ignored);
+    };
+
+    std::thread server_thread([&] {
+        pin(server_cpu);
+        if (busy) {
+            server.busy_receive(echo, running);
+        } else {
+            server.receive(echo);
+            server_service.run();
+        }
+    });
+
+    pin(client_cpu);
+    uint64_t start = now();
+    sent = start;
+    client.socket().send(boost::asio::buffer(ping));
+    if (busy) {
+        client.busy_receive(pong, running);
+    } else {
+        client.receive(pong);
+        client_service.run();
+    }
+    double seconds = double(now() - start) / 1e9;
+    server_thread.join();
+
+    report(busy ? "udp busy poll" : "udp reactor", rtt, seconds);
+}
+
+void tcp(bool busy)
+{
+    boost::asio::io_service client_service, server_service;
+    boost::asio::ip::tcp::acceptor acceptor(server_service,
+        tcp_connection::endpoint_type(boost::asio::ip::address_v4::loopback(), 0));
+    tcp_connection client(client_service), server(server_service);
+    client.socket().connect(acceptor.local_endpoint());
+    acceptor.accept(server.socket());
+    client.socket().set_option(boost::asio::ip::tcp::no_delay(true));
+    server.socket().set_option(boost::asio::ip::tcp::no_delay(true));
+    if (busy) {
+        server.enable_busy_poll();
+        client.enable_busy_poll();
+    }
+
+    std::atomic<bool> running(true);
+    latency_histogram rtt;
+    std::vector<char> ping(MESSAGE, 0);
+    std::vector<char> server_buffer(MESSAGE), client_buffer(MESSAGE);
+    uint64_t sent = 0;
+    uint64_t start = 0;
+
+    if (busy) {
+        std::thread server_thread([&] {
+            pin(server_cpu);
+            server.busy_receive([&](const tcp_connection::error_code& error, boost::asio::const_buffer data) {
+                if (!error) {
+                    tcp_connection::error_code ignored;
+                    boost::asio::write(server.socket(), boost::asio::buffer(data), ignored);
+                }
+            }, running);
+        });
+
+        pin(client_cpu);
+        size_t pending = 0;
+        start = sent = now();
+        boost::asio::write(client.socket(), boost::asio::buffer(ping));
+        client.busy_receive([&](const tcp_connection::error_code& error, boost::asio::const_buffer data) {
+            pending += boost::asio::buffer_size(data);
+            if (error || pending < MESSAGE) {
+                return;
+            }
+            pending -= MESSAGE;
+            rtt.record(now() - sent);
+            if (rtt.count() == round_trips) {
+                running = false;
+                return;
+            }
+            sent = now();
+            tcp_connection::error_code ignored;
+            boost::asio::write(client.socket(), boost::asio::buffer(ping), ignored);
+        }, running);
+        double seconds = double(now() - start) / 1e9;
+        server_thread.join();
+        report("tcp busy poll", rtt, seconds);
+        return;
+    }
+
+    // the reactor path, plain asio so that only waking up differs
+    std::function<void()> serve = [&] {
+        boost::asio::async_read(server.socket(), boost::asio::buffer(server_buffer),
+                                [&](const tcp_connection::error_code& error, size_t) {
+            if (error) {
+                return;
+            }
+            boost::asio::async_write(server.socket(), boost::asio::buffer(server_buffer),
+                                     [&](const tcp_connection::error_code& error, size_t) {
+                if (!error) {
+                    serve();
+                }
+            });
+        });
+    };
+    std::function<void()> ask = [&] {
+        sent = now();
+        boost::asio::async_write(client.socket(), boost::asio::buffer(ping),
+                                 [&](const tcp_connection::error_code& error, size_t) {
+            if (error) {
+                return;
+            }
+            boost::asio::async_read(client.socket(), boost::asio::buffer(client_buffer),
+                                    [&](const tcp_connection::error_code& error, size_t) {
+                if (error) {
+                    return;
+                }
+                rtt.record(now() - sent);
+                if (rtt.count() == round_trips) {
+                    client_service.stop();
+                    server_service.stop();
+                    return;
+                }
+                ask();
+            });
+        });
+    };
+
+    serve();
+    std::thread server_thread([&] {
+        pin(server_cpu);
+        server_service.run();
+    });
+    pin(client_cpu);
+    start = now();
+    ask();
+    client_service.run();
+    double seconds = double(now() - start) / 1e9;
+    server_thread.join();
+    report("tcp reactor", rtt, seconds);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    round_trips = argc > 1 ? strtoul(argv[1], nullptr, 10) : round_trips;
+    client_cpu  = argc > 3 ? atoi(argv[2]) : -1;
+    server_cpu  = argc > 3 ? atoi(argv[3]) : -1;
+
+    printf("%zu round trips of %zu bytes (values in us)\n", round_trips, MESSAGE);
+    udp(false);
+    tcp(false);
+
+    if (std::thread::hardware_concurrency() < 2) {
+        // both spinners share the core, each round trip waits for a time slice
+        printf("busy polling needs a core per side, only %u here: capping at 1000 round trips\n",
+               std::thread::hardware_concurrency());
+        round_trips = std::min(round_trips, size_t(1000));
+    }
+    udp(true);
+    tcp(true);
+    return 0;
+}
@@ -0,0 +1,135 @@
+/**
+ * \file byte_scan.cpp
+ * \author ichramm
+ *
+ * Measures the searches in byte_scan against the byte at a time loops they
+ * replace, in GB/s of bytes scanned, with every implementation the CPU
+ * supports. The byte searched for is never there so the whole range is
+ * scanned, which is what a parser waiting for the end of a header does.
+ * Ranges are searched both contiguous and as a chain of 1 KB buckets.
+ *
+ * Build: g++ -std=c++11 -O2 -I.. byte_scan.cpp -o byte_scan
+ * Usage: byte_scan [megabytes] [range]
+ */
+#include "transport/__buffer.hpp"
+#include "transport/byte_scan.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+using namespace et::transport;
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+// token characters from RFC 7230, with no delimiters among them
+const char *TOKEN = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!#$%&'*+-.^_`|~";
+
+size_t megabytes = 256;
+size_t range     = 4096;
+
+/**
+ * Runs \p scan over the range until \p megabytes have been scanned
+ */
+void measure(const char *title, const std::function<size_t()>& scan)
+{
+    size_t rounds = megabytes * 1048576 / range;
+    size_t sink = 0;
+    clock_type::time_point start = clock_type::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        sink += scan();
+    }
+    double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    printf("  %-28s %8.2f GB/s%s\n", title, double(rounds * range) / seconds / 1e9,
+           sink == 0 ? "" : "  (found?)");
+}
+
+size_t naive_find(const char *p, size_t n, char c)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (p[i] == c) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+size_t naive_find_any(const char *p, size_t n, const char *set, size_t count)
+{
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t k = 0; k < count; ++k) {
+            if (p[i] == set[k]) {
+                return i;
+            }
+        }
+    }
+    return 0;
+}
+
+size_t naive_span(const char *p, size_t n, const bool *table)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (!table[uint8_t(p[i])]) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+size_t found(size_t position)
+{
+    return position == byte_scan::npos ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : megabytes;
+    range     = argc > 2 ? strtoul(argv[2], nullptr, 10) : range;
+
+    // token characters only: no delimiter, no newline, all in the class
+    std::vector<char> data(range);
+    for (size_t i = 0; i < range; ++i) {
+        data[i] = TOKEN[(i * 7) % strlen(TOKEN)];
+    }
+    const char *p = data.data();
+    buffer<char> chain;
+    chain.append(p, range);
+
+    const char delimiters[] = "\r\n:;";
+    byte_class token(TOKEN);
+    bool table[256] = { false };
+    for (const char *t = TOKEN; *t; ++t) {
+        table[uint8_t(*t)] = true;
+    }
+
+    printf("%zu MB in ranges of %zu bytes\n", megabytes, range);
+    printf("find '\\n'\n");
+    measure("naive loop", [&] { return naive_find(p, range, '\n'); });
+    measure("memchr", [&] { return size_t(memchr(p, '\n', range) != nullptr); });
+    printf("find_any \"\\r\\n:;\"\n");
+    measure("naive loop", [&] { return naive_find_any(p, range, delimiters, 4); });
+    printf("find_not_in token\n");
+    measure("naive table loop", [&] { return naive_span(p, range, table); });
+
+    const byte_scan::implementation implementations[] = { byte_scan::scalar, byte_scan::ssse3, byte_scan::avx2 };
+    for (byte_scan::implementation impl : implementations) {
+        if (!byte_scan::select(impl)) {
+            continue;
+        }
+        printf("%s\n", byte_scan::name(impl));
+        measure("find", [&] { return found(byte_scan::find(p, range, '\n')); });
+        measure("find, chained", [&] { return found(byte_scan::find(chain.data(), '\n')); });
+        measure("find_any", [&] { return found(byte_scan::find_any(p, range, delimiters, 4)); });
+        measure("find_any, chained", [&] { return found(byte_scan::find_any(chain.data(), delimiters, 4)); });
+        measure("find_not_in", [&] { return found(byte_scan::find_not_in(p, range, token)); });
+        measure("find_not_in, chained", [&] { return found(byte_scan::find_not_in(chain.data(), token)); });
+    }
+    return 0;
+}
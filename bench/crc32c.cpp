@@ -0,0 +1,127 @@
+/**
+ * \file crc32c.cpp
+ * \author ichramm
+ *
+ * Measures crc32c with every implementation the CPU supports against a
+ * byte at a time table loop, in GB/s, over contiguous ranges and chains of
+ * 1 KB buckets, then the cost of verifying frames in frame_reader.
+ *
+ * Build: g++ -std=c++11 -O2 -I.. crc32c.cpp -o crc32c
+ * Usage: crc32c [megabytes] [range]
+ */
+#include "transport/checksum.hpp"
+#include "transport/framing.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+using namespace et::transport;
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+size_t megabytes = 256;
+size_t range     = 4096;
+
+/**
+ * Runs \p run, which goes over \p bytes, until \p megabytes have been
+ * processed
+ */
+void measure(const char *title, size_t bytes, const std::function<uint32_t()>& run)
+{
+    size_t rounds = std::max(size_t(1), megabytes * 1048576 / bytes);
+    uint32_t sink = 0;
+    clock_type::time_point start = clock_type::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        sink += run();
+    }
+    double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    printf("  %-28s %8.2f GB/s  (%08x)\n", title, double(rounds * bytes) / seconds / 1e9, sink);
+}
+
+uint32_t table[256];
+
+uint32_t bytewise(const uint8_t *p, size_t n)
+{
+    uint32_t crc = ~uint32_t(0);
+    for (size_t i = 0; i < n; ++i) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : megabytes;
+    range     = argc > 2 ? strtoul(argv[2], nullptr, 10) : range;
+
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t crc = n;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+        }
+        table[n] = crc;
+    }
+
+    std::vector<uint8_t> data(range);
+    for (size_t i = 0; i < range; ++i) {
+        data[i] = uint8_t(i * 131 + 7);
+    }
+    const uint8_t *p = data.data();
+    buffer<char> chain;
+    chain.append(reinterpret_cast<const char*>(p), range);
+
+    // a stream of frames the size of the range, fed back to the reader
+    const size_t FRAMES = 64;
+    std::vector<char> stream[2];
+    for (int checksum = 0; checksum < 2; ++checksum) {
+        framing_config config;
+        config.checksum = checksum != 0;
+        buffer<char> frames;
+        {
+            buffer_writer<char> writer(frames);
+            for (size_t i = 0; i < FRAMES; ++i) {
+                frame_writer<char>(config).write(writer, p, range);
+            }
+        }
+        stream[checksum].resize(frames.size());
+        frames.copy_to(stream[checksum].data(), frames.size());
+    }
+
+    printf("%zu MB in ranges of %zu bytes\n", megabytes, range);
+    measure("byte at a time table", range, [&] { return bytewise(p, range); });
+
+    const crc32c::implementation implementations[] = { crc32c::slicing8, crc32c::sse42 };
+    for (crc32c::implementation impl : implementations) {
+        if (!crc32c::select(impl)) {
+            continue;
+        }
+        printf("%s\n", crc32c::name(impl));
+        measure("contiguous", range, [&] { return crc32c::compute(p, range); });
+        measure("chained", range, [&] { return crc32c::compute(chain.data()); });
+
+        for (int checksum = 0; checksum < 2; ++checksum) {
+            framing_config config;
+            config.checksum = checksum != 0;
+            frame_reader<char> reader(config);
+            buffer<char> in;
+            const std::vector<char>& bytes = stream[checksum];
+            measure(checksum ? "frames, verified" : "frames, not verified", FRAMES * range, [&] {
+                uint32_t delivered = 0;
+                // as if read 16 KB at a time
+                for (size_t offset = 0; offset < bytes.size(); offset += 16384) {
+                    in.append(&bytes[offset], std::min(size_t(16384), bytes.size() - offset));
+                    reader.parse(in, [&](const buffer_slice<char>&) { ++delivered; });
+                }
+                return delivered;
+            });
+        }
+    }
+    return 0;
+}
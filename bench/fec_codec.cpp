@@ -0,0 +1,125 @@
+/**
+ * \file fec_codec.cpp
+ * \author ichramm
+ *
+ * Measures the cost of fec_encoder and fec_decoder per MB of payload, with
+ * every GF(256) implementation the CPU supports. Decoding is measured with
+ * no loss and with as many data packets lost per group as parity can
+ * repair, the worst case that still recovers everything.
+ *
+ * Build: g++ -std=c++11 -O2 -I.. fec_codec.cpp -o fec_codec
+ * Usage: fec_codec [megabytes] [payload]
+ */
+#include "transport/fec.hpp"
+
+#include <boost/asio/buffers_iterator.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace et::transport;
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+double elapsed(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+void run(const char *name, const fec_config& config, size_t megabytes, size_t payload)
+{
+    size_t count = megabytes * 1048576 / payload;
+    std::vector<char> message(payload);
+    for (size_t i = 0; i < payload; ++i) {
+        message[i] = char(i * 131 + 7);
+    }
+
+    // encode, keeping the packets of a few groups around to decode
+    fec_encoder encoder(0, config);
+    size_t group = config.data_shards + config.parity_shards;
+    std::vector<std::vector<char>> packets;
+    size_t bytes = 0;
+    clock_type::time_point start = clock_type::now();
+    for (size_t i = 0; i < count; ++i) {
+        encoder.send(boost::asio::buffer(message), [&](const fec_encoder::buffers_type& packet) {
+            bytes += boost::asio::buffer_size(packet);
+            if (packets.size() < group * 16) {
+                packets.emplace_back(boost::asio::buffers_begin(packet), boost::asio::buffers_end(packet));
+            }
+        });
+    }
+    double encode = elapsed(start);
+
+    double decode[2];
+    size_t delivered[2] = { 0, 0 };
+    size_t corrupted[2] = { 0, 0 };
+    for (int lossy = 0; lossy < 2; ++lossy) {
+        fec_decoder decoder;
+        decoder.on_deliver([&](uint16_t, boost::asio::const_buffer payload) {
+            // recovered shards must be the message, not just the right count
+            if (boost::asio::buffer_size(payload) == message.size() &&
+                std::memcmp(boost::asio::buffer_cast<const char*>(payload), message.data(), message.size()) == 0) {
+                ++delivered[lossy];
+            } else {
+                ++corrupted[lossy];
+            }
+        });
+        // the same groups over and over, rewriting their group number
+        uint32_t number = 0;
+        start = clock_type::now();
+        for (size_t done = 0; done < count; ) {
+            for (size_t i = 0; i < packets.size(); ++i) {
+                std::vector<char>& packet = packets[i];
+                if (i % group == 0) {
+                    ++number;
+                    done += config.data_shards;
+                }
+                if (lossy && i % group < config.parity_shards) {
+                    continue;
+                }
+                packet[4] = char(number >> 24);
+                packet[5] = char(number >> 16);
+                packet[6] = char(number >> 8);
+                packet[7] = char(number);
+                decoder.receive(boost::asio::buffer(packet));
+            }
+        }
+        decode[lossy] = elapsed(start);
+    }
+
+    double mb = double(count * payload) / 1048576;
+    printf("%-8s %-20s overhead %5.1f%%  encode %8.1f MB/s %7.0f us/MB  decode %8.1f MB/s  repairing %8.1f MB/s %7.0f us/MB\n",
+           gf256::name(gf256::best()), name, 100.0 * (double(bytes) / double(count * payload) - 1),
+           mb / encode, encode * 1e6 / mb, mb / decode[0], mb / decode[1], decode[1] * 1e6 / mb);
+    if (delivered[0] < count || delivered[1] < count) {
+        printf("  lost messages: %zu, %zu of %zu\n", count - delivered[0], count - delivered[1], count);
+    }
+    if (corrupted[0] || corrupted[1]) {
+        printf("  corrupted messages: %zu, %zu\n", corrupted[0], corrupted[1]);
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 256;
+    size_t payload   = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1200;
+
+    const gf256::implementation implementations[] = { gf256::scalar, gf256::ssse3, gf256::avx2 };
+    for (gf256::implementation impl : implementations) {
+        if (!gf256::select(impl)) {
+            continue;
+        }
+        run("xor(8)", fec_config(fec_config::xor_parity, 8), megabytes, payload);
+        run("rs(10,2)", fec_config(fec_config::reed_solomon, 10, 2), megabytes, payload);
+        run("rs(10,4)", fec_config(fec_config::reed_solomon, 10, 4), megabytes, payload);
+        run("rs(50,10)", fec_config(fec_config::reed_solomon, 50, 10), megabytes, payload);
+    }
+    return 0;
+}
@@ -0,0 +1,847 @@
+/**
+ * \file loadgen.cpp
+ * \author ichramm
+ *
+ * Load generator for udp_connection and tcp_connection. Clients send
+ * messages of a fixed size, either as fast as replies come back (closed
+ * loop, \c depth messages in flight per connection) or at a fixed rate per
+ * connection (open loop, latency counted from when each message was due so
+ * that a stalled server is not hidden). Patterns:
+ *
+ *   echo    the server sends every message back
+ *   rr      the server answers every request with \c response bytes
+ *   stream  one way, the server measures latency and loss
+ *
+ * Server and clients run in the same process over loopback unless --listen
+ * or --connect split them; latencies of a split stream compare clocks of
+ * two hosts. Both sides must agree on protocol, pattern and sizes.
+ *
+ * Build: g++ -std=c++11 -O2 -I.. -D__TRACE_MASK=0 loadgen.cpp -o loadgen -lboost_system -lpthread
+ * Usage: loadgen [--protocol udp|tcp] [--pattern echo|rr|stream] [--size bytes] [--response bytes]
+ *                [--rate messages/s] [--connections n] [--depth n] [--threads n] [--duration s]
+ *                [--listen port | --connect host:port]
+ */
+#include "transport/latency_histogram.hpp"
+#include "transport/tcp_connection.hpp"
+#include "transport/udp_connection.hpp"
+
+#include <boost/asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace et::transport;
+
+namespace {
+
+struct options {
+    bool        udp;
+    std::string pattern;
+    size_t      size;
+    size_t      response;
+    double      rate;         // per connection, zero for a closed loop
+    size_t      connections;
+    size_t      depth;
+    size_t      threads;
+    double      duration;
+    bool        server;
+    bool        client;
+    std::string host;
+    uint16_t    port;
+
+    options()
+     : udp(true)
+     , pattern("echo")
+     , size(64)
+     , response(0)
+     , rate(0)
+     , connections(1)
+     , depth(1)
+     , threads(1)
+     , duration(5)
+     , server(true)
+     , client(true)
+     , host("127.0.0.1")
+     , port(0)
+    { }
+
+    bool stream() const
+    {
+        return pattern == "stream";
+    }
+
+    size_t reply_size() const
+    {
+        return pattern == "echo" ? size : response;
+    }
+};
+
+options config;
+
+/**
+ * Every message starts with its sequence number and the time it was due
+ */
+const size_t HEADER = 16;
+
+uint64_t now()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void write_header(char *p, uint64_t sequence, uint64_t due)
+{
+    std::memcpy(p, &sequence, 8);
+    std::memcpy(p + 8, &due, 8);
+}
+
+void read_header(const char *p, uint64_t& sequence, uint64_t& due)
+{
+    std::memcpy(&sequence, p, 8);
+    std::memcpy(&due, p + 8, 8);
+}
+
+struct counters {
+    uint64_t          sent;
+    uint64_t          received;
+    uint64_t          bytes_sent;
+    uint64_t          bytes_received;
+    uint64_t          errors;
+    latency_histogram latency;
+
+    counters()
+     : sent(0)
+     , received(0)
+     , bytes_sent(0)
+     , bytes_received(0)
+     , errors(0)
+    { }
+
+    void merge(const counters& other)
+    {
+        sent           += other.sent;
+        received       += other.received;
+        bytes_sent     += other.bytes_sent;
+        bytes_received += other.bytes_received;
+        errors         += other.errors;
+        latency.merge(other.latency);
+    }
+};
+
+/**
+ * Sends at most this many overdue messages per connection and tick, an
+ * open loop that cannot keep up shows as a lower throughput
+ */
+const size_t MAX_BURST = 256;
+
+// ------------------------------------------------------------------ server
+
+class server
+{
+public:
+    server(boost::asio::io_service& service, const udp_connection::endpoint_type& endpoint)
+     : service_(service)
+     , udp_(service)
+     , acceptor_(service)
+     , reply_(std::max(config.reply_size(), HEADER))
+    {
+        if (config.udp) {
+            udp_.socket().open(endpoint.protocol());
+            udp_.socket().set_option(boost::asio::socket_base::reuse_address(true));
+            udp_.socket().bind(endpoint);
+            udp_.socket().set_option(boost::asio::socket_base::receive_buffer_size(8 << 20));
+            udp_.set_receive_buffers(64, std::max(config.size, size_t(2048)));
+        } else {
+            tcp_connection::endpoint_type tcp_endpoint(endpoint.address(), endpoint.port());
+            acceptor_.open(tcp_endpoint.protocol());
+            acceptor_.set_option(boost::asio::socket_base::reuse_address(true));
+            acceptor_.bind(tcp_endpoint);
+            acceptor_.listen();
+        }
+    }
+
+    uint16_t port()
+    {
+        return config.udp ? udp_.socket().local_endpoint().port() : acceptor_.local_endpoint().port();
+    }
+
+    void start()
+    {
+        if (config.udp) {
+            udp_.receive([this](const udp_connection::error_code& error, const udp_connection::received_batch& batch) {
+                if (error) {
+                    return;
+                }
+                for (const udp_connection::received_datagram& datagram : batch) {
+                    on_udp(datagram);
+                }
+            });
+        } else {
+            accept();
+        }
+    }
+
+    void stop()
+    {
+        udp_connection::error_code ignored;
+        udp_.socket().close(ignored);
+        acceptor_.close(ignored);
+        for (std::shared_ptr<peer>& p : peers_) {
+            p->connection.socket().close(ignored);
+        }
+    }
+
+    const counters& stats() const
+    {
+        return stats_;
+    }
+
+    /**
+     * Messages missing from the sequence of each source, stream only
+     */
+    uint64_t gaps() const
+    {
+        uint64_t missing = 0;
+        for (const std::map<udp_connection::endpoint_type, source>::value_type& s : sources_) {
+            missing += s.second.next - s.second.received;
+        }
+        return missing;
+    }
+
+private:
+
+    struct source {
+        uint64_t next;
+        uint64_t received;
+
+        source()
+         : next(0)
+         , received(0)
+        { }
+    };
+
+    struct peer {
+        tcp_connection                 connection;
+        std::vector<char>              request;
+        std::deque<std::vector<char> > replies;
+        bool                           writing;
+        udp_connection::endpoint_type  key;      // tells sequences apart
+
+        explicit peer(boost::asio::io_service& service)
+         : connection(service)
+         , request(config.size)
+         , writing(false)
+        { }
+    };
+
+    boost::asio::io_service&                        service_;
+    udp_connection                                  udp_;
+    boost::asio::ip::tcp::acceptor                  acceptor_;
+    std::vector<std::shared_ptr<peer> >             peers_;
+    std::vector<char>                               reply_;
+    counters                                        stats_;
+    std::map<udp_connection::endpoint_type, source> sources_;
+
+    /**
+     * Counts a message, in a stream it also tells latency and loss
+     */
+    void count(const char *data, size_t size, const udp_connection::endpoint_type& from)
+    {
+        ++stats_.received;
+        stats_.bytes_received += size;
+        if (!config.stream() || size < HEADER) {
+            return;
+        }
+        uint64_t sequence, due;
+        read_header(data, sequence, due);
+        stats_.latency.record(now() - std::min(now(), due));
+        source& s = sources_[from];
+        ++s.received;
+        s.next = std::max(s.next, sequence + 1);
+    }
+
+    void on_udp(const udp_connection::received_datagram& datagram)
+    {
+        const char *data = boost::asio::buffer_cast<const char*>(datagram.data);
+        size_t size = boost::asio::buffer_size(datagram.data);
+        count(data, size, datagram.endpoint);
+        if (config.stream()) {
+            return;
+        }
+
+        boost::asio::const_buffer reply = datagram.data;
+        if (config.pattern == "rr") {
+            std::memcpy(reply_.data(), data, std::min(size, HEADER));
+            reply = boost::asio::buffer(reply_.data(), config.response);
+        }
+        udp_connection::error_code error;
+        udp_.socket().send_to(boost::asio::buffer(reply), datagram.endpoint, 0, error);
+        if (error) {
+            ++stats_.errors;
+        } else {
+            ++stats_.sent;
+            stats_.bytes_sent += boost::asio::buffer_size(reply);
+        }
+    }
+
+    void accept()
+    {
+        std::shared_ptr<peer> p = std::make_shared<peer>(service_);
+        acceptor_.async_accept(p->connection.socket(), [this, p](const boost::system::error_code& error) {
+            if (error) {
+                return;
+            }
+            p->connection.socket().set_option(boost::asio::ip::tcp::no_delay(true));
+            boost::system::error_code ignored;
+            tcp_connection::endpoint_type remote = p->connection.socket().remote_endpoint(ignored);
+            p->key = udp_connection::endpoint_type(remote.address(), remote.port());
+            peers_.push_back(p);
+            read(p.get());
+            accept();
+        });
+    }
+
+    void read(peer *p)
+    {
+        p->connection.read(config.size, p->request, [this, p](const tcp_connection::error_code& error) {
+            if (error) {
+                return;
+            }
+            count(p->request.data(), p->request.size(), p->key);
+            if (!config.stream()) {
+                std::vector<char> reply(config.reply_size());
+                std::memcpy(reply.data(), p->request.data(), std::min(reply.size(), HEADER));
+                if (config.pattern == "echo") {
+                    reply = p->request;
+                }
+                p->replies.push_back(std::move(reply));
+                write(p);
+            }
+            read(p);
+        });
+    }
+
+    void write(peer *p)
+    {
+        if (p->writing || p->replies.empty()) {
+            return;
+        }
+        p->writing = true;
+        size_t size = p->replies.front().size();
+        p->connection.write(std::move(p->replies.front()), [this, p, size](const tcp_connection::error_code& error) {
+            p->writing = false;
+            if (error) {
+                ++stats_.errors;
+                return;
+            }
+            ++stats_.sent;
+            stats_.bytes_sent += size;
+            write(p);
+        });
+        p->replies.pop_front();
+    }
+};
+
+// ------------------------------------------------------------------ client
+
+class client
+{
+public:
+    client(counters& stats, const std::atomic<bool>& sending)
+     : stats_(stats)
+     , sending_(sending)
+     , sequence_(0)
+     , message_(std::max(config.size, HEADER))
+    { }
+
+    virtual ~client()
+    { }
+
+    virtual void start() = 0;
+    virtual void stop() = 0;
+
+    /**
+     * Sends the next message, which was due at \p due
+     */
+    void send(uint64_t due)
+    {
+        write_header(message_.data(), sequence_++, due);
+        transmit(message_);
+    }
+
+    uint64_t sequence() const
+    {
+        return sequence_;
+    }
+
+    /**
+     * \return \c true while messages pile up in user space
+     */
+    virtual bool backlogged() const
+    {
+        return false;
+    }
+
+protected:
+
+    counters&                stats_;
+    const std::atomic<bool>& sending_;
+    uint64_t                 sequence_;
+    std::vector<char>        message_;
+
+    virtual void transmit(const std::vector<char>& message) = 0;
+
+    void on_reply(const char *data, size_t size)
+    {
+        ++stats_.received;
+        stats_.bytes_received += size;
+        if (size >= HEADER) {
+            uint64_t sequence, due;
+            read_header(data, sequence, due);
+            stats_.latency.record(now() - std::min(now(), due));
+        }
+        if (config.rate == 0 && sending_) {
+            send(now());
+        }
+    }
+};
+
+class udp_client : public client
+{
+public:
+    udp_client(boost::asio::io_service& service, counters& stats, const std::atomic<bool>& sending,
+               const udp_connection::endpoint_type& server)
+     : client(stats, sending)
+     , connection_(service)
+    {
+        connection_.socket().open(server.protocol());
+        connection_.socket().connect(server);
+        connection_.set_receive_buffers(64, std::max(config.reply_size(), size_t(2048)));
+    }
+
+    void start()
+    {
+        if (config.stream()) {
+            return;
+        }
+        connection_.receive([this](const udp_connection::error_code& error, const udp_connection::received_batch& batch) {
+            if (error) {
+                return;
+            }
+            for (const udp_connection::received_datagram& datagram : batch) {
+                on_reply(boost::asio::buffer_cast<const char*>(datagram.data), boost::asio::buffer_size(datagram.data));
+            }
+        });
+    }
+
+    void stop()
+    {
+        udp_connection::error_code ignored;
+        connection_.socket().close(ignored);
+    }
+
+private:
+
+    udp_connection connection_;
+
+    void transmit(const std::vector<char>& message)
+    {
+        udp_connection::error_code error;
+        connection_.socket().send(boost::asio::buffer(message.data(), config.size), 0, error);
+        if (error) {
+            // a full socket buffer is one more loss
+            ++stats_.errors;
+        } else {
+            ++stats_.sent;
+            stats_.bytes_sent += config.size;
+        }
+    }
+};
+
+class tcp_client : public client
+{
+public:
+    tcp_client(boost::asio::io_service& service, counters& stats, const std::atomic<bool>& sending,
+               const tcp_connection::endpoint_type& server)
+     : client(stats, sending)
+     , connection_(service)
+     , reply_(config.reply_size())
+     , writing_(false)
+    {
+        connection_.socket().connect(server);
+        connection_.socket().set_option(boost::asio::ip::tcp::no_delay(true));
+    }
+
+    void start()
+    {
+        if (!config.stream()) {
+            read();
+        }
+    }
+
+    void stop()
+    {
+        tcp_connection::error_code ignored;
+        connection_.socket().close(ignored);
+    }
+
+    bool backlogged() const
+    {
+        return queue_.size() >= MAX_BURST;
+    }
+
+private:
+
+    tcp_connection                 connection_;
+    std::vector<char>              reply_;
+    std::deque<std::vector<char> > queue_;
+    bool                           writing_;
+
+    void transmit(const std::vector<char>& message)
+    {
+        queue_.push_back(std::vector<char>(message.begin(), message.begin() + config.size));
+        write();
+    }
+
+    void write()
+    {
+        if (writing_ || queue_.empty()) {
+            return;
+        }
+        writing_ = true;
+        connection_.write(std::move(queue_.front()), [this](const tcp_connection::error_code& error) {
+            writing_ = false;
+            if (error) {
+                ++stats_.errors;
+                return;
+            }
+            ++stats_.sent;
+            stats_.bytes_sent += config.size;
+            write();
+        });
+        queue_.pop_front();
+    }
+
+    void read()
+    {
+        connection_.read(reply_.size(), reply_, [this](const tcp_connection::error_code& error) {
+            if (error) {
+                return;
+            }
+            on_reply(reply_.data(), reply_.size());
+            read();
+        });
+    }
+};
+
+/**
+ * The connections of one client thread and the timer pacing them
+ */
+class client_thread
+{
+public:
+    client_thread(const udp_connection::endpoint_type& server, size_t connections, const std::atomic<bool>& sending)
+     : timer_(service_)
+     , sending_(sending)
+     , start_(0)
+    {
+        for (size_t i = 0; i < connections; ++i) {
+            if (config.udp) {
+                clients_.emplace_back(new udp_client(service_, stats_, sending, server));
+            } else {
+                clients_.emplace_back(new tcp_client(service_, stats_, sending,
+                                                     tcp_connection::endpoint_type(server.address(), server.port())));
+            }
+        }
+    }
+
+    void run()
+    {
+        for (std::unique_ptr<client>& c : clients_) {
+            c->start();
+        }
+        start_ = now();
+        if (config.rate > 0) {
+            tick();
+        } else {
+            // closed loop: fill the pipe, replies keep it full
+            size_t depth = config.stream() ? MAX_BURST : config.depth;
+            service_.post([this, depth] {
+                for (std::unique_ptr<client>& c : clients_) {
+                    for (size_t i = 0; i < depth; ++i) {
+                        c->send(now());
+                    }
+                }
+                if (config.stream()) {
+                    stream();
+                }
+            });
+        }
+        service_.run();
+    }
+
+    void stop()
+    {
+        service_.post([this] {
+            boost::system::error_code ignored;
+            timer_.cancel(ignored);
+            for (std::unique_ptr<client>& c : clients_) {
+                c->stop();
+            }
+        });
+    }
+
+    const counters& stats() const
+    {
+        return stats_;
+    }
+
+private:
+
+    boost::asio::io_service                service_;
+    boost::asio::steady_timer              timer_;
+    const std::atomic<bool>&               sending_;
+    counters                               stats_;
+    std::vector<std::unique_ptr<client> >  clients_;
+    uint64_t                               start_;
+
+    /**
+     * Open loop: sends whatever became due since the last tick
+     */
+    void tick()
+    {
+        if (!sending_) {
+            return;
+        }
+        uint64_t elapsed = now() - start_;
+        double interval = 1e9 / config.rate;
+        for (std::unique_ptr<client>& c : clients_) {
+            uint64_t due = uint64_t(double(elapsed) / interval) + 1;
+            for (size_t burst = 0; c->sequence() < due && burst < MAX_BURST; ++burst) {
+                c->send(start_ + uint64_t(double(c->sequence()) * interval));
+            }
+        }
+        timer_.expires_from_now(std::chrono::nanoseconds(std::max(uint64_t(interval), uint64_t(20000))));
+        timer_.async_wait([this](const boost::system::error_code& error) {
+            if (!error) {
+                tick();
+            }
+        });
+    }
+
+    /**
+     * Closed loop one way: keeps sending in bursts, yielding to the
+     * io_service in between so that TCP writes complete and catch up
+     */
+    void stream()
+    {
+        if (!sending_) {
+            return;
+        }
+        for (std::unique_ptr<client>& c : clients_) {
+            for (size_t i = 0; i < MAX_BURST && !c->backlogged(); ++i) {
+                c->send(now());
+            }
+        }
+        service_.post([this] {
+            stream();
+        });
+    }
+};
+
+// ------------------------------------------------------------------ main
+
+void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [--protocol udp|tcp] [--pattern echo|rr|stream] [--size bytes] [--response bytes]\n"
+            "          [--rate messages/s] [--connections n] [--depth n] [--threads n] [--duration s]\n"
+            "          [--listen port | --connect host:port]\n", program);
+    exit(2);
+}
+
+void parse(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        std::string value = argv[++i];
+        if (option == "--protocol") {
+            config.udp = value == "udp";
+            if (!config.udp && value != "tcp") {
+                usage(argv[0]);
+            }
+        } else if (option == "--pattern") {
+            config.pattern = value;
+            if (value != "echo" && value != "rr" && value != "stream") {
+                usage(argv[0]);
+            }
+        } else if (option == "--size") {
+            config.size = strtoul(value.c_str(), nullptr, 10);
+        } else if (option == "--response") {
+            config.response = strtoul(value.c_str(), nullptr, 10);
+        } else if (option == "--rate") {
+            config.rate = atof(value.c_str());
+        } else if (option == "--connections") {
+            config.connections = std::max(1ul, strtoul(value.c_str(), nullptr, 10));
+        } else if (option == "--depth") {
+            config.depth = std::max(1ul, strtoul(value.c_str(), nullptr, 10));
+        } else if (option == "--threads") {
+            config.threads = std::max(1ul, strtoul(value.c_str(), nullptr, 10));
+        } else if (option == "--duration") {
+            config.duration = atof(value.c_str());
+        } else if (option == "--listen") {
+            config.client = false;
+            config.host   = "0.0.0.0";
+            config.port   = uint16_t(strtoul(value.c_str(), nullptr, 10));
+        } else if (option == "--connect") {
+            size_t colon = value.rfind(':');
+            if (colon == std::string::npos) {
+                usage(argv[0]);
+            }
+            config.server = false;
+            config.host   = value.substr(0, colon);
+            config.port   = uint16_t(strtoul(value.c_str() + colon + 1, nullptr, 10));
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    config.size = std::max(config.size, HEADER);
+    if (config.response == 0) {
+        config.response = config.size;
+    }
+    config.response = std::max(config.response, HEADER);
+    if (config.udp && std::max(config.size, config.response) > 65507) {
+        fprintf(stderr, "UDP messages are limited to 65507 bytes\n");
+        exit(2);
+    }
+    config.threads = std::min(config.threads, config.connections);
+}
+
+void report(const char *side, const counters& stats, double seconds, uint64_t lost, uint64_t expected)
+{
+    printf("%-7s sent %llu (%.0f msg/s, %.1f MB/s), received %llu (%.0f msg/s, %.1f MB/s), errors %llu",
+           side,
+           (unsigned long long)stats.sent, double(stats.sent) / seconds, double(stats.bytes_sent) / seconds / 1e6,
+           (unsigned long long)stats.received, double(stats.received) / seconds, double(stats.bytes_received) / seconds / 1e6,
+           (unsigned long long)stats.errors);
+    if (expected != 0) {
+        printf(", lost %llu (%.3f%%)", (unsigned long long)lost, 100.0 * double(lost) / double(expected));
+    }
+    printf("\n");
+    if (stats.latency.count() != 0) {
+        stats.latency.print(stdout, config.stream() ? "one way latency (us)" : "round trip (us)", 1000);
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    parse(argc, argv);
+
+    udp_connection::endpoint_type endpoint(boost::asio::ip::address::from_string(config.host), config.port);
+
+    boost::asio::io_service server_service;
+    std::unique_ptr<server> srv;
+    std::thread server_thread;
+    if (config.server) {
+        srv.reset(new server(server_service, endpoint));
+        endpoint.port(srv->port());
+        srv->start();
+        server_thread = std::thread([&] {
+            server_service.run();
+        });
+    }
+
+    printf("%s %s, %zu byte messages", config.udp ? "udp" : "tcp", config.pattern.c_str(), config.size);
+    if (config.pattern == "rr") {
+        printf(", %zu byte responses", config.response);
+    }
+    if (config.client) {
+        printf(", %zu connections on %zu threads, ", config.connections, config.threads);
+        if (config.rate > 0) {
+            printf("%.0f msg/s each", config.rate);
+        } else if (config.stream()) {
+            printf("as fast as possible");
+        } else {
+            printf("closed loop, depth %zu", config.depth);
+        }
+    }
+    printf(", %.1f s\n", config.duration);
+    fflush(stdout);
+
+    std::atomic<bool> sending(true);
+    std::vector<std::unique_ptr<client_thread> > clients;
+    std::vector<std::thread> client_threads;
+    if (config.client) {
+        for (size_t t = 0; t < config.threads; ++t) {
+            size_t connections = config.connections / config.threads + (t < config.connections % config.threads ? 1 : 0);
+            clients.emplace_back(new client_thread(endpoint, connections, sending));
+        }
+        for (std::unique_ptr<client_thread>& c : clients) {
+            client_thread *ct = c.get();
+            client_threads.emplace_back([ct] {
+                ct->run();
+            });
+        }
+    }
+
+    uint64_t start = now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(config.duration));
+    sending = false;
+    double seconds = double(now() - start) / 1e9;
+
+    // let whatever is in flight arrive
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    counters client_stats;
+    for (std::unique_ptr<client_thread>& c : clients) {
+        c->stop();
+    }
+    for (std::thread& t : client_threads) {
+        t.join();
+    }
+    for (std::unique_ptr<client_thread>& c : clients) {
+        client_stats.merge(c->stats());
+    }
+
+    if (srv) {
+        server_service.post([&] {
+            srv->stop();
+        });
+        server_thread.join();
+    }
+
+    if (config.client) {
+        uint64_t lost = 0;
+        if (!config.stream() && client_stats.sent > client_stats.received) {
+            lost = client_stats.sent - client_stats.received;
+        }
+        report("client", client_stats, seconds, lost, config.stream() ? 0 : client_stats.sent);
+    }
+    if (srv) {
+        uint64_t lost = 0;
+        uint64_t expected = 0;
+        if (config.stream()) {
+            // in process the clients know what was sent, otherwise go by sequence numbers
+            expected = config.client ? client_stats.sent : srv->stats().received + srv->gaps();
+            lost = expected > srv->stats().received ? expected - srv->stats().received : 0;
+        }
+        report("server", srv->stats(), seconds, lost, expected);
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * \file reliable_lossy.cpp
+ * \author ichramm
+ *
+ * Pushes messages between two reliable_session objects over a lossy_link
+ * and checks that every stream is delivered complete and in order. Time is
+ * simulated, in microseconds, so results only depend on the arguments.
+ *
+ * Build: g++ -std=c++11 -O2 -I.. reliable_lossy.cpp -o reliable_lossy
+ * Usage: reliable_lossy [messages] [streams] [loss] [delay_us] [jitter_us] [seed]
+ */
+#include "transport/lossy_link.hpp"
+#include "transport/reliable_session.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace et::transport;
+
+int main(int argc, char *argv[])
+{
+    size_t   messages = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    size_t   streams  = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4;
+    double   loss     = argc > 3 ? atof(argv[3]) : 0.05;
+    uint64_t delay    = argc > 4 ? strtoull(argv[4], nullptr, 10) : 5000;
+    uint64_t jitter   = argc > 5 ? strtoull(argv[5], nullptr, 10) : 1000;
+
+    lossy_link::config link_config;
+    link_config.loss      = loss;
+    link_config.duplicate = loss / 10;
+    link_config.delay     = delay;
+    link_config.jitter    = jitter;
+    link_config.seed      = argc > 6 ? uint32_t(strtoul(argv[6], nullptr, 10)) : 1;
+
+    lossy_link link(link_config);
+    reliable_session sessions[2];
+
+    // side 0 sends, side 1 receives and checks the order
+    std::vector<uint32_t> expected(streams, 0);
+    size_t delivered = 0;
+    size_t errors    = 0;
+    sessions[1].on_deliver([&](uint16_t stream, boost::asio::const_buffer message) {
+        uint32_t value;
+        if (stream >= streams || boost::asio::buffer_size(message) < sizeof(value)) {
+            ++errors;
+            return;
+        }
+        std::memcpy(&value, boost::asio::buffer_cast<const char*>(message), sizeof(value));
+        if (value != expected[stream]) {
+            ++errors;
+        }
+        expected[stream] = value + 1;
+        ++delivered;
+    });
+
+    std::vector<uint32_t> next(streams, 0);
+    std::vector<char> payload(64 + sessions[0].max_message() / 4);
+    size_t queued = 0;
+
+    uint64_t now = 0;
+    while (delivered < messages && now < 3600ull * 1000000) {
+        // keep the sender busy, alternating streams
+        size_t before = queued;
+        for (size_t i = 0; queued < messages && i < streams; ++i) {
+            size_t stream = queued % streams;
+            std::memcpy(payload.data(), &next[stream], sizeof(uint32_t));
+            if (!sessions[0].send(uint16_t(stream), boost::asio::buffer(payload))) {
+                break;
+            }
+            ++next[stream];
+            ++queued;
+        }
+
+        for (int side = 0; side < 2; ++side) {
+            sessions[side].poll(now, [&](boost::asio::const_buffer packet) {
+                link.send(1 - side, packet, now);
+            });
+        }
+        link.deliver(now, [&](int to, boost::asio::const_buffer packet) {
+            sessions[to].receive(packet, now);
+        });
+
+        // jump to whatever happens next, a sender with room goes right away
+        uint64_t wake = 0;
+        for (int side = 0; side < 2; ++side) {
+            uint64_t t = sessions[side].next_timeout();
+            if (t != 0 && (wake == 0 || t < wake)) {
+                wake = t;
+            }
+        }
+        uint64_t t = link.next_delivery();
+        if (t != 0 && (wake == 0 || t < wake)) {
+            wake = t;
+        }
+        if (queued != before && sessions[0].in_flight() < sessions[0].window()) {
+            wake = now + 1;
+        }
+        now = wake > now ? wake : now + 1;
+    }
+
+    const reliable_session::statistics& tx = sessions[0].stats();
+    const reliable_session::statistics& rx = sessions[1].stats();
+    const lossy_link::statistics& ls = link.stats();
+
+    printf("delivered %zu/%zu messages on %zu streams in %.3f s simulated, %zu order errors\n",
+           delivered, messages, streams, now / 1e6, errors);
+    printf("link: %llu sent, %llu dropped, %llu duplicated\n",
+           (unsigned long long)ls.sent, (unsigned long long)ls.dropped, (unsigned long long)ls.duplicated);
+    printf("sender: %llu packets, %llu retransmitted messages, %llu lost packets (%llu spurious), %llu timeouts, rtt %llu us, window %zu\n",
+           (unsigned long long)tx.packets_sent, (unsigned long long)tx.retransmissions,
+           (unsigned long long)tx.lost, (unsigned long long)tx.spurious, (unsigned long long)tx.timeouts,
+           (unsigned long long)sessions[0].rtt(), sessions[0].window());
+    printf("receiver: %llu packets, %llu duplicate messages, %llu malformed\n",
+           (unsigned long long)rx.packets_received, (unsigned long long)rx.duplicates,
+           (unsigned long long)rx.malformed);
+
+    return delivered == messages && errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/**
+ * \file rpc_channel.cpp
+ * \author ichramm
+ *
+ * Calls per second and latency of rpc_channel over loopback, with one call
+ * in flight at a time, as a client waiting for each response would do, and
+ * with deeper pipelines. The server echoes the request. Also prints how
+ * many calls went out in each write on average.
+ *
+ * Build: g++ -std=c++11 -O2 -I.. -D__TRACE_MASK=0 rpc_channel.cpp -o rpc_channel -lboost_system -lpthread
+ * Usage: rpc_channel [size] [seconds] [depth...]
+ */
+#include "transport/latency_histogram.hpp"
+#include "transport/rpc_channel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+using namespace et::transport;
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+const uint32_t ECHO_METHOD = 1;
+
+size_t size    = 64;
+double seconds = 1;
+
+uint64_t nanoseconds(clock_type::time_point t)
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count());
+}
+
+/**
+ * Keeps \p depth calls in flight on \p client until \c seconds are over
+ */
+void run(boost::asio::io_service& io, rpc_channel& client, size_t depth)
+{
+    latency_histogram latency;
+    std::vector<char> request(std::max(size, sizeof(uint64_t)));
+    clock_type::time_point start = clock_type::now();
+    clock_type::time_point stop  = start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(seconds));
+    uint64_t calls  = 0;
+    uint64_t writes = client.stats().writes;
+    size_t   active = 0;
+    bool     failed = false;
+
+    std::function<void()> issue = [&] {
+        uint64_t sent = nanoseconds(clock_type::now());
+        std::memcpy(request.data(), &sent, sizeof(sent));
+        ++active;
+        client.call(ECHO_METHOD, request.data(), request.size(), [&](const boost::system::error_code& error,
+                                                            const rpc_channel::slice_type& response) {
+            --active;
+            if (error) {
+                failed = true;
+                return;
+            }
+            uint64_t sent;
+            response.copy_to(reinterpret_cast<char*>(&sent), sizeof(sent));
+            clock_type::time_point now = clock_type::now();
+            latency.record(nanoseconds(now) - sent);
+            ++calls;
+            if (now < stop) {
+                issue();
+            }
+        });
+    };
+    for (size_t i = 0; i < depth; ++i) {
+        issue();
+    }
+    while (active > 0 && !failed) {
+        io.run_one();
+    }
+
+    double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+    writes = client.stats().writes - writes;
+    printf("depth %-6zu %12.0f calls/s  %8.1f calls/write\n",
+           depth, double(calls) / elapsed, writes ? double(calls) / double(writes) : 0.0);
+    latency.print(stdout, "  latency (us)", 1000);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    size    = argc > 1 ? strtoul(argv[1], nullptr, 10) : size;
+    seconds = argc > 2 ? strtod(argv[2], nullptr) : seconds;
+    std::vector<size_t> depths;
+    for (int i = 3; i < argc; ++i) {
+        depths.push_back(strtoul(argv[i], nullptr, 10));
+    }
+    if (depths.empty()) {
+        depths = { 1, 16, 256, 4096, 32768 };
+    }
+
+    boost::asio::io_service io;
+    boost::asio::ip::tcp::acceptor acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    tcp_connection::ptr a = std::make_shared<tcp_connection>(io);
+    tcp_connection::ptr b = std::make_shared<tcp_connection>(io);
+    a->socket().connect(acceptor.local_endpoint());
+    acceptor.accept(b->socket());
+    a->socket().set_option(boost::asio::ip::tcp::no_delay(true));
+    b->socket().set_option(boost::asio::ip::tcp::no_delay(true));
+
+    rpc_config config;
+    config.max_pending = 1 << 20;
+    rpc_channel::ptr client = rpc_channel::create(a, config);
+    rpc_channel::ptr server = rpc_channel::create(b, config);
+    server->on_request(ECHO_METHOD, [](const rpc_channel::slice_type& request, const rpc_channel::responder& reply) {
+        reply.respond(request);
+    });
+    client->start();
+    server->start();
+
+    printf("%zu byte calls, %.1f s per depth\n", size, seconds);
+    for (size_t depth : depths) {
+        run(io, *client, depth);
+    }
+
+    client->close();
+    io.run();
+    return 0;
+}
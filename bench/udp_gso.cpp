@@ -0,0 +1,145 @@
+/**
+ * \file udp_gso.cpp
+ * \author ichramm
+ *
+ * Loopback throughput of udp_connection with and without segmentation offload.
+ * Rates are those of the datagrams received, from the first send to the last
+ * receive; received datagrams not of the segment size, GRO splitting
+ * included, are counted apart.
+ *
+ * Build: g++ -std=c++11 -O2 -I.. udp_gso.cpp -o udp_gso -lboost_system -lpthread
+ * Usage: udp_gso [megabytes] [segment_size]
+ */
+#include "transport/udp_connection.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace et::transport;
+
+namespace {
+
+struct result {
+    double seconds;     ///< First send to last receive
+    size_t sent;
+    size_t received;
+    size_t wrong_size;  ///< Received, but not \c segment_size bytes
+};
+
+result run(size_t megabytes, size_t segment_size, bool gso, bool gro)
+{
+    boost::asio::io_service rx_service;
+    boost::asio::io_service tx_service;
+
+    udp_connection receiver(rx_service);
+    receiver.socket().open(boost::asio::ip::udp::v4());
+    receiver.socket().bind(udp_connection::endpoint_type(boost::asio::ip::address_v4::loopback(), 0));
+    receiver.socket().set_option(boost::asio::socket_base::receive_buffer_size(32 << 20));
+    if (gro && !receiver.enable_gro()) {
+        fprintf(stderr, "UDP_GRO not supported, receiving without it\n");
+    }
+
+    udp_connection sender(tx_service);
+    sender.socket().open(boost::asio::ip::udp::v4());
+    sender.socket().set_option(boost::asio::socket_base::send_buffer_size(32 << 20));
+
+    // only touched by the receiving thread until it is joined
+    size_t received   = 0;
+    size_t wrong_size = 0;
+    std::chrono::steady_clock::time_point last_received;
+    receiver.receive([&](const udp_connection::error_code& error, const udp_connection::received_batch& batch) {
+        if (!error) {
+            for (const udp_connection::received_datagram& datagram : batch) {
+                if (boost::asio::buffer_size(datagram.data) == segment_size && !datagram.truncated) {
+                    ++received;
+                } else {
+                    ++wrong_size;
+                }
+            }
+            last_received = std::chrono::steady_clock::now();
+        }
+    });
+    std::thread rx_thread([&] {
+        rx_service.run();
+    });
+
+    std::vector<char> chunk(segment_size * udp_connection::MAX_GSO_SEGMENTS, 'x');
+    udp_connection::endpoint_type destination = receiver.socket().local_endpoint();
+    size_t chunks = (megabytes << 20) / chunk.size();
+    size_t sent = 0;
+
+    std::vector<boost::asio::const_buffer> segments;
+    for (size_t offset = 0; offset < chunk.size(); offset += segment_size) {
+        segments.push_back(boost::asio::buffer(&chunk[offset], segment_size));
+    }
+    std::vector<udp_connection::datagram> batch;
+    for (const boost::asio::const_buffer& segment : segments) {
+        batch.push_back(udp_connection::datagram(segment, destination));
+    }
+
+    std::function<void(size_t)> send_next;
+    send_next = [&](size_t remaining) {
+        if (remaining == 0) {
+            return;
+        }
+        auto done = [&, remaining](const udp_connection::error_code& error, size_t count) {
+            sent += count;
+            if (error) {
+                fprintf(stderr, "send failed: %s\n", error.message().c_str());
+            } else {
+                send_next(remaining - 1);
+            }
+        };
+        if (gso) {
+            sender.send_segmented_to(boost::asio::buffer(chunk), segment_size, destination, done);
+        } else {
+            sender.send_batch_to(batch, done);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    send_next(chunks);
+    tx_service.run();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200)); // let the receiver catch up
+    rx_service.post([&] {
+        receiver.socket().close();
+    });
+    rx_thread.join();
+
+    result r;
+    r.seconds    = std::chrono::duration<double>(last_received - start).count();
+    r.sent       = sent;
+    r.received   = received;
+    r.wrong_size = wrong_size;
+    return r;
+}
+
+void report(const char *name, size_t segment_size, const result& r)
+{
+    double megabytes = double(r.received * segment_size) / (1 << 20);
+    double seconds   = r.seconds > 0 ? r.seconds : 1;
+    printf("%-16s %10zu sent %10zu received %5.1f%% lost %8.1f MB/s %10.0f datagrams/s\n",
+           name, r.sent, r.received, r.sent ? 100.0 * double(r.sent - std::min(r.sent, r.received)) / double(r.sent) : 0.0,
+           megabytes / seconds, double(r.received) / seconds);
+    if (r.wrong_size > 0) {
+        printf("  %zu datagrams of the wrong size\n", r.wrong_size);
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes    = argc > 1 ? strtoul(argv[1], nullptr, 10) : 512;
+    size_t segment_size = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1400;
+
+    report("sendmmsg",     segment_size, run(megabytes, segment_size, false, false));
+    report("gso",          segment_size, run(megabytes, segment_size, true,  false));
+    report("gso+gro",      segment_size, run(megabytes, segment_size, true,  true));
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * \file udp_timestamps.cpp
+ * \author ichramm
+ *
+ * Splits the latency of loopback datagrams using kernel timestamps:
+ *   send -> tx stamp      time in the sending stack
+ *   send -> rx stamp      one way through the kernel
+ *   rx stamp -> handler   time queued in the receiving socket
+ *   handler               time in our own code (simulated with a spin)
+ *
+ * Build: g++ -std=c++11 -O2 -I.. udp_timestamps.cpp -o udp_timestamps -lboost_system -lpthread
+ * Usage: udp_timestamps [datagrams] [burst] [work_ns]
+ */
+#include "transport/latency_histogram.hpp"
+#include "transport/udp_connection.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace et::transport;
+
+int main(int argc, char *argv[])
+{
+    size_t   datagrams = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+    size_t   burst     = argc > 2 ? strtoul(argv[2], nullptr, 10) : 16;
+    uint64_t work      = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1000;
+
+    boost::asio::io_service rx_service;
+    udp_connection receiver(rx_service);
+    receiver.socket().open(boost::asio::ip::udp::v4());
+    receiver.socket().bind(udp_connection::endpoint_type(boost::asio::ip::address_v4::loopback(), 0));
+    receiver.socket().set_option(boost::asio::socket_base::receive_buffer_size(8 << 20));
+    if (!(receiver.enable_timestamps(kernel_timestamps::rx) & kernel_timestamps::rx)) {
+        fprintf(stderr, "receive timestamps not supported\n");
+        return 1;
+    }
+
+    boost::asio::io_service tx_service;
+    udp_connection sender(tx_service);
+    sender.socket().open(boost::asio::ip::udp::v4());
+    bool tx_stamps = (sender.enable_timestamps(kernel_timestamps::tx) & kernel_timestamps::tx) != 0;
+    if (!tx_stamps) {
+        fprintf(stderr, "transmit timestamps not supported\n");
+    }
+
+    latency_histogram tx_stack, one_way, queued, handler;
+    std::vector<uint64_t> sent_at(datagrams);
+    std::atomic<size_t> received(0);
+
+    receiver.receive([&](const udp_connection::error_code& error, const udp_connection::received_batch& batch) {
+        if (error) {
+            return;
+        }
+        for (const udp_connection::received_datagram& datagram : batch) {
+            uint64_t start = kernel_timestamps::now();
+            uint64_t sent;
+            std::memcpy(&sent, boost::asio::buffer_cast<const char*>(datagram.data), sizeof(sent));
+            if (datagram.timestamp != 0) {
+                one_way.record(datagram.timestamp - sent);
+                queued.record(start - datagram.timestamp);
+            }
+            while (kernel_timestamps::now() - start < work) {
+                // pretend to do something useful
+            }
+            handler.record(kernel_timestamps::now() - start);
+            if (++received == datagrams) {
+                rx_service.stop();
+            }
+        }
+    });
+
+    sender.receive_tx_timestamps([&](const udp_connection::error_code& error, uint32_t id, uint64_t timestamp) {
+        if (!error && id < datagrams) {
+            tx_stack.record(timestamp - sent_at[id]);
+        }
+    });
+
+    std::thread rx_thread([&] {
+        rx_service.run();
+    });
+
+    udp_connection::endpoint_type destination = receiver.socket().local_endpoint();
+    char payload[64] = { 0 };
+    for (size_t i = 0; i < datagrams; ++i) {
+        sent_at[i] = kernel_timestamps::now();
+        std::memcpy(payload, &sent_at[i], sizeof(sent_at[i]));
+        udp_connection::error_code ignored;
+        sender.socket().send_to(boost::asio::buffer(payload), destination, 0, ignored);
+        if ((i + 1) % burst == 0) {
+            tx_service.poll();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    // drain the last timestamps, lost datagrams would make us wait forever
+    for (int i = 0; i < 100 && received < datagrams; ++i) {
+        tx_service.poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    tx_service.poll();
+    rx_service.stop();
+    rx_thread.join();
+
+    printf("%zu/%zu datagrams, bursts of %zu, %llu ns of work each (values in us)\n",
+           size_t(received), datagrams, burst, (unsigned long long)work);
+    if (tx_stamps) {
+        tx_stack.print(stdout, "send -> tx stamp", 1000);
+    }
+    one_way.print(stdout, "send -> rx stamp", 1000);
+    queued.print(stdout, "rx stamp -> handler", 1000);
+    handler.print(stdout, "handler", 1000);
+    return 0;
+}
@@ -1,27 +1,1081 @@
-#ifndef buffer_hpp__
-#define buffer_hpp__
+/**
+ * \file __buffer.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_buffer_hpp__
+#define transport_buffer_hpp__
 
-#include <boost/shared_ptr.hpp>
+#include "transport/slab_allocator.hpp"
 
+#include <boost/asio/buffer.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace et {
 namespace transport {
 
+template <class T, size_t Size>
+class buffer;
+
+template <class T, size_t Size>
+class mapped_file;
+
+/**
+ * \brief Storage unit of \c buffer, reference counted so that
+ * \c buffer_slice objects can keep it alive after the buffer lets it go
+ *
+ * References are counted with plain loads and stores while they all live on
+ * one thread. \c share() switches the bucket to atomic read-modify-writes,
+ * for good, before a reference crosses threads.
+ *
+ * Buckets with memory of their own come from a \c slab_allocator, cache
+ * line aligned: the elements first and the bucket right after them, see
+ * \c buffer::allocator(). External buckets are just the bucket.
+ */
+template <class T, size_t Size>
+class buffer_bucket
+{
+public:
+    static_assert(std::is_trivial<T>::value, "Buckets hold raw memory");
+
+    /**
+     * Bytes taken by the elements of a bucket with memory of its own
+     */
+    static const size_t storage_size = (Size * sizeof(T) + alignof(std::max_align_t) - 1)
+                                     & ~(alignof(std::max_align_t) - 1);
+
+    /**
+     * \brief A bucket for \c Size elements
+     */
+    static buffer_bucket *create()
+    {
+        char *memory = static_cast<char*>(slab_allocator<storage_size + sizeof(buffer_bucket)>::instance().allocate());
+        return new (memory + storage_size) buffer_bucket(reinterpret_cast<T*>(memory), 0, nullptr);
+    }
+
+    /**
+     * \brief A bucket for \p size elements of memory it does not own, such
+     * as a file mapping, given to \p dispose with the last reference
+     *
+     * External buckets are read only, a buffer never writes to nor reuses
+     * them, and they may be larger than \c Size.
+     */
+    static buffer_bucket *external(const T *data, size_t size, void (*dispose)(const T*, size_t))
+    {
+        void *memory = slab_allocator<sizeof(buffer_bucket)>::instance().allocate();
+        return new (memory) buffer_bucket(const_cast<T*>(data), size, dispose);
+    }
+
+    /**
+     * \brief Frees \p b, external memory goes to its \c dispose function
+     */
+    static void destroy(buffer_bucket *b)
+    {
+        T *data = b->data_;
+        void (*dispose)(const T*, size_t) = b->dispose_;
+        size_t external_size = b->external_size_;
+        b->~buffer_bucket();
+        if (dispose != nullptr) {
+            slab_allocator<sizeof(buffer_bucket)>::instance().deallocate(b);
+            dispose(data, external_size);
+        } else {
+            slab_allocator<storage_size + sizeof(buffer_bucket)>::instance().deallocate(data);
+        }
+    }
+
+    T *data()
+    {
+        return data_;
+    }
+
+    const T *data() const
+    {
+        return data_;
+    }
+
+    bool external() const
+    {
+        return dispose_ != nullptr;
+    }
+
+    void acquire()
+    {
+        if (shared_.load(std::memory_order_relaxed)) {
+            refs_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            refs_.store(refs_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * \return \c true if that was the last reference, the caller disposes
+     * of the bucket
+     */
+    bool release()
+    {
+        if (shared_.load(std::memory_order_relaxed)) {
+            return refs_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+        uint32_t refs = refs_.load(std::memory_order_relaxed) - 1;
+        refs_.store(refs, std::memory_order_relaxed);
+        return refs == 0;
+    }
+
+    /**
+     * \return \c true if the caller holds the only reference to memory of
+     * the bucket's own, so nobody else is reading it and it can be written
+     * to or reused
+     */
+    bool writable() const
+    {
+        return dispose_ == nullptr && refs_.load(std::memory_order_acquire) == 1;
+    }
+
+    /**
+     * \brief Makes reference counting safe across threads
+     *
+     * Must be called by the thread holding the references, before another
+     * thread gets one.
+     */
+    void share()
+    {
+        shared_.store(true, std::memory_order_relaxed);
+    }
 
     /**
-     * This is going to be a layered buffer someday..
+     * \brief Back to a single, thread local, reference, for reuse
      */
-    template <class T, size_t size = 1024>
-    class buffer {
+    void reset()
+    {
+        refs_.store(1, std::memory_order_relaxed);
+        shared_.store(false, std::memory_order_relaxed);
+    }
+
+private:
+    buffer_bucket(T *data, size_t external_size, void (*dispose)(const T*, size_t))
+     : data_(data)
+     , external_size_(external_size)
+     , dispose_(dispose)
+     , refs_(1)
+     , shared_(false)
+    { }
 
+    buffer_bucket(const buffer_bucket&);
+    buffer_bucket& operator=(const buffer_bucket&);
+
+    T                    *data_;           // right before the bucket, or external memory
+    size_t                external_size_;
+    void                (*dispose_)(const T*, size_t);
+    std::atomic<uint32_t> refs_;
+    std::atomic<bool>     shared_;
+};
+
+/**
+ * \brief An immutable range of a \c buffer, sharing its buckets instead of
+ * copying them
+ *
+ * Copying a slice, or taking a \c sub() slice, costs a reference count
+ * increment per bucket spanned. Slices are ConstBufferSequences, so the same
+ * payload can be written to many connections at once:
+ *
+ * \code
+ *  buffer_slice<char> payload = message.slice();
+ *  for (const tcp_connection::ptr& c : subscribers) {
+ *      c->write(payload, handler);
+ *  }
+ * \endcode
+ *
+ * Slices are counted without atomic operations. Call \c share() before a
+ * slice, or any copy of it, reaches another thread; connections served by
+ * other threads included.
+ */
+template <class T, size_t Size = 1024>
+class buffer_slice
+{
+    typedef buffer_bucket<T, Size> bucket;
+
+    /**
+     * A bucket and the range of it in the slice, [begin, end)
+     */
+    struct piece {
+        bucket *data;
+        size_t  begin;
+        size_t  end;
+    };
 
+public:
+    typedef T value_type;
+
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag  iterator_category;
+        typedef boost::asio::const_buffer  value_type;
+        typedef std::ptrdiff_t             difference_type;
+        typedef const value_type          *pointer;
+        typedef value_type                 reference;
+
+        const_iterator()
+         : piece_(nullptr)
+        { }
+
+        boost::asio::const_buffer operator*() const
+        {
+            return boost::asio::const_buffer(piece_->data->data() + piece_->begin,
+                                             (piece_->end - piece_->begin) * sizeof(T));
+        }
+
+        const_iterator& operator++()
+        {
+            ++piece_;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator previous = *this;
+            ++piece_;
+            return previous;
+        }
+
+        bool operator==(const const_iterator& other) const
+        {
+            return piece_ == other.piece_;
+        }
+
+        bool operator!=(const const_iterator& other) const
+        {
+            return piece_ != other.piece_;
+        }
 
     private:
-        typedef std::array<T, size> bucket;
-        typedef bucket* bucket_ptr;
-        std::vector<bucket_ptr> buffer_;
+        friend class buffer_slice;
+
+        const piece *piece_;
+
+        explicit const_iterator(const piece *p)
+         : piece_(p)
+        { }
     };
 
+    typedef const_iterator iterator;
+
+    buffer_slice()
+     : size_(0)
+    { }
+
+    buffer_slice(const buffer_slice& other)
+     : pieces_(other.pieces_)
+     , size_(other.size_)
+    {
+        for (const piece& p : pieces_) {
+            p.data->acquire();
+        }
+    }
+
+    buffer_slice(buffer_slice&& other)
+     : pieces_(std::move(other.pieces_))
+     , size_(other.size_)
+    {
+        other.pieces_.clear();
+        other.size_ = 0;
+    }
+
+    buffer_slice& operator=(buffer_slice other)
+    {
+        pieces_.swap(other.pieces_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    ~buffer_slice()
+    {
+        for (const piece& p : pieces_) {
+            if (p.data->release()) {
+                bucket::destroy(p.data);
+            }
+        }
+    }
+
+    /**
+     * \return Number of elements in the slice
+     */
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    /**
+     * \return Number of buffers in the sequence, one per bucket spanned
+     */
+    size_t buffers() const
+    {
+        return pieces_.size();
+    }
+
+    /**
+     * \return The slice of \p length elements starting at \p offset, or of
+     * as many as there are
+     */
+    buffer_slice sub(size_t offset, size_t length = size_t(-1)) const
+    {
+        buffer_slice result;
+        for (const piece& p : pieces_) {
+            if (length == 0) {
+                break;
+            }
+            size_t available = p.end - p.begin;
+            if (offset >= available) {
+                offset -= available;
+                continue;
+            }
+            size_t n = std::min(length, available - offset);
+            result.add(p.data, p.begin + offset, p.begin + offset + n);
+            length -= n;
+            offset  = 0;
+        }
+        return result;
+    }
+
+    /**
+     * \brief Copies up to \p count elements starting at \p offset to \p out
+     *
+     * \return Number of elements copied
+     */
+    size_t copy_to(T *out, size_t count, size_t offset = 0) const
+    {
+        size_t copied = 0;
+        for (const piece& p : pieces_) {
+            if (copied == count) {
+                break;
+            }
+            size_t length = p.end - p.begin;
+            if (offset >= length) {
+                offset -= length;
+                continue;
+            }
+            size_t n = std::min(count - copied, length - offset);
+            std::copy(p.data->data() + p.begin + offset, p.data->data() + p.begin + offset + n, out + copied);
+            copied += n;
+            offset  = 0;
+        }
+        return copied;
+    }
+
+    /**
+     * \brief Makes the slice, its copies and every other reference to the
+     * buckets it spans safe to use from other threads
+     *
+     * Counting turns atomic from then on, call it right before handing the
+     * slice over.
+     */
+    buffer_slice& share()
+    {
+        for (const piece& p : pieces_) {
+            p.data->share();
+        }
+        return *this;
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(pieces_.data());
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(pieces_.data() + pieces_.size());
+    }
+
+private:
+    friend class buffer<T, Size>;
+    friend class mapped_file<T, Size>;
+
+    std::vector<piece> pieces_;
+    size_t             size_;
+
+    /**
+     * Takes a new reference to \p b
+     */
+    void add(bucket *b, size_t begin, size_t end)
+    {
+        piece p;
+        p.data  = b;
+        p.begin = begin;
+        p.end   = end;
+        b->acquire();
+        pieces_.push_back(p);
+        size_ += end - begin;
+    }
+};
+
+/**
+ * \brief A chain of fixed size buckets holding a byte stream
+ *
+ * Data is appended at the back and consumed from the front, both ends also
+ * grow and shrink the other way (\c prepend(), \c consume_back()), all in
+ * O(1) per bucket touched: nothing is ever moved to make room. Buckets
+ * emptied by consuming are kept for reuse, up to \c max_spare() of them.
+ *
+ * The buffer is also an asio DynamicBuffer: \c prepare() exposes free space
+ * as a MutableBufferSequence for reads to fill in and \c commit(), \c data()
+ * exposes the content as a ConstBufferSequence for gathered writes, without
+ * flattening either into a contiguous copy:
+ *
+ * \code
+ *  buffer<char> incoming;
+ *  size_t n = socket.read_some(incoming.prepare(65536));
+ *  incoming.commit(n);
+ *  boost::asio::write(socket, incoming.data());
+ * \endcode
+ *
+ * \c slice() hands out parts of the content as \c buffer_slice objects
+ * sharing the buckets, \c append() links slices into a buffer the same way.
+ * A bucket referenced from elsewhere is never written to again, the buffer
+ * takes a new one instead. Slices of a \c mapped_file are linked the same
+ * way, file contents are then part of the buffer without being read.
+ *
+ * Sequences returned by \c data() and \c prepare() are invalidated by any
+ * other call that modifies the buffer, and by \c slice() in between
+ * \c prepare() and \c commit().
+ *
+ * Not thread safe.
+ */
+template <class T, size_t Size = 1024>
+class buffer
+{
+    typedef buffer_bucket<T, Size> bucket;
+
+    /**
+     * A bucket and the part of it in use, [begin, end)
+     */
+    struct segment {
+        bucket *data;
+        size_t  begin;
+        size_t  end;
+    };
+
+    /**
+     * Forward-only view of the ring, either of the content of each segment
+     * or of the room after it, capped at a total of \c limit elements
+     */
+    template <
+        typename Buffer_Type>
+    class view
+    {
+    public:
+        typedef Buffer_Type value_type;
+
+        class const_iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef Buffer_Type               value_type;
+            typedef std::ptrdiff_t            difference_type;
+            typedef const Buffer_Type        *pointer;
+            typedef Buffer_Type               reference;
+
+            const_iterator()
+             : ring_(nullptr)
+             , mask_(0)
+             , index_(0)
+             , last_(0)
+             , remaining_(0)
+             , room_(false)
+            { }
+
+            Buffer_Type operator*() const
+            {
+                const segment& s = ring_[index_ & mask_];
+                size_t begin = room_ ? s.end : s.begin;
+                size_t end   = room_ ? Size : s.end;
+                return Buffer_Type(s.data->data() + begin, std::min(end - begin, remaining_) * sizeof(T));
+            }
+
+            const_iterator& operator++()
+            {
+                const segment& s = ring_[index_ & mask_];
+                remaining_ -= std::min(room_ ? Size - s.end : s.end - s.begin, remaining_);
+                ++index_;
+                if (remaining_ == 0) {
+                    index_ = last_;
+                }
+                return *this;
+            }
+
+            const_iterator operator++(int)
+            {
+                const_iterator previous = *this;
+                ++*this;
+                return previous;
+            }
+
+            bool operator==(const const_iterator& other) const
+            {
+                return index_ == other.index_;
+            }
+
+            bool operator!=(const const_iterator& other) const
+            {
+                return index_ != other.index_;
+            }
+
+        private:
+            friend class view;
+
+            // a copy of the view, iterators outlive the temporaries they come from
+            const segment *ring_;
+            size_t         mask_;
+            size_t         index_;
+            size_t         last_;
+            size_t         remaining_;
+            bool           room_;
+
+            const_iterator(const view& v, size_t index, size_t remaining)
+             : ring_(v.ring_)
+             , mask_(v.mask_)
+             , index_(index)
+             , last_(v.last_)
+             , remaining_(remaining)
+             , room_(v.room_)
+            { }
+        };
+
+        typedef const_iterator iterator;
+
+        view()
+         : ring_(nullptr)
+         , mask_(0)
+         , first_(0)
+         , last_(0)
+         , limit_(0)
+         , room_(false)
+        { }
+
+        const_iterator begin() const
+        {
+            return const_iterator(*this, limit_ == 0 ? last_ : first_, limit_);
+        }
+
+        const_iterator end() const
+        {
+            return const_iterator(*this, last_, 0);
+        }
+
+    private:
+        friend class buffer;
+
+        const segment *ring_;
+        size_t         mask_;
+        size_t         first_;  // ring positions, not yet masked
+        size_t         last_;
+        size_t         limit_;
+        bool           room_;
+
+        view(const segment *ring, size_t mask, size_t first, size_t last, size_t limit, bool room)
+         : ring_(ring)
+         , mask_(mask)
+         , first_(first)
+         , last_(limit == 0 ? first : last)
+         , limit_(limit)
+         , room_(room)
+        { }
+    };
+
+public:
+    typedef T value_type;
+
+    typedef view<boost::asio::const_buffer>   const_buffers_type;
+    typedef view<boost::asio::mutable_buffer> mutable_buffers_type;
+    typedef buffer_slice<T, Size>             slice_type;
+    typedef slab_allocator<bucket::storage_size + sizeof(bucket)> allocator_type;
+
+    static const size_t bucket_size = Size;
+
+    explicit buffer(size_t max_spare = 8)
+     : ring_(4)
+     , head_(0)
+     , count_(0)
+     , prepared_(0)
+     , prepared_room_(0)
+     , size_(0)
+     , max_spare_(max_spare)
+    { }
+
+    buffer(const buffer& other)
+     : ring_(4)
+     , head_(0)
+     , count_(0)
+     , prepared_(0)
+     , prepared_room_(0)
+     , size_(0)
+     , max_spare_(other.max_spare_)
+    {
+        append(other);
+    }
+
+    buffer& operator=(const buffer& other)
+    {
+        if (this != &other) {
+            clear();
+            append(other);
+        }
+        return *this;
+    }
+
+    ~buffer()
+    {
+        clear();
+        for (size_t i = 0; i < prepared_; ++i) {
+            bucket::destroy(at(count_ + i).data);
+        }
+        for (bucket *b : spare_) {
+            bucket::destroy(b);
+        }
+    }
+
+    /**
+     * \return Number of elements in the buffer
+     */
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    size_t max_size() const
+    {
+        return std::numeric_limits<size_t>::max() / sizeof(T);
+    }
+
+    /**
+     * \return Elements the buffer holds without taking more buckets
+     */
+    size_t capacity() const
+    {
+        return size_ + room() + prepared_ * Size;
+    }
+
+    /**
+     * \return Number of buckets holding data
+     */
+    size_t buckets() const
+    {
+        return count_;
+    }
+
+    size_t max_spare() const
+    {
+        return max_spare_;
+    }
+
+    /**
+     * \return The allocator shared by every buffer with buckets like these,
+     * to \c configure() it or read its \c stats()
+     */
+    static allocator_type& allocator()
+    {
+        return allocator_type::instance();
+    }
+
+    /**
+     * \brief Copies \p count elements to the back
+     */
+    void append(const T *data, size_t count)
+    {
+        while (count > 0) {
+            if (room() == 0) {
+                push_back_bucket();
+            }
+            segment& s = at(count_ - 1);
+            size_t n = std::min(count, Size - s.end);
+            std::copy(data, data + n, s.data->data() + s.end);
+            s.end += n;
+            size_ += n;
+            data  += n;
+            count -= n;
+        }
+    }
+
+    /**
+     * \brief Copies the content of \p other to the back
+     */
+    void append(const buffer& other)
+    {
+        for (size_t i = 0; i < other.count_; ++i) {
+            const segment& s = other.at(i);
+            append(s.data->data() + s.begin, s.end - s.begin);
+        }
+    }
+
+    /**
+     * \brief Links the content of \p other to the back, without copying it
+     */
+    void append(const slice_type& other)
+    {
+        for (const typename slice_type::piece& p : other.pieces_) {
+            if (count_ + prepared_ == ring_.size()) {
+                grow();
+            }
+            if (prepared_ > 0) {
+                at(count_ + prepared_) = at(count_);
+            }
+            segment& s = at(count_);
+            s.data  = p.data;
+            s.begin = p.begin;
+            s.end   = p.end;
+            p.data->acquire();
+            ++count_;
+            size_ += p.end - p.begin;
+        }
+    }
+
+    /**
+     * \brief Copies \p count elements to the front, before what is there
+     */
+    void prepend(const T *data, size_t count)
+    {
+        while (count > 0) {
+            if (count_ == 0 || at(0).begin == 0 || !at(0).data->writable()) {
+                push_front_bucket();
+            }
+            segment& s = at(0);
+            size_t n = std::min(count, s.begin);
+            std::copy(data + count - n, data + count, s.data->data() + s.begin - n);
+            s.begin -= n;
+            size_  += n;
+            count  -= n;
+        }
+    }
+
+    /**
+     * \brief Removes \p count elements from the front, or all of them
+     */
+    void consume(size_t count)
+    {
+        count = std::min(count, size_);
+        while (count > 0) {
+            segment& s = at(0);
+            size_t n = std::min(count, s.end - s.begin);
+            s.begin += n;
+            size_   -= n;
+            count   -= n;
+            if (s.begin == s.end) {
+                pop_front_bucket();
+            }
+        }
+    }
+
+    /**
+     * \brief Removes \p count elements from the back, or all of them
+     */
+    void consume_back(size_t count)
+    {
+        count = std::min(count, size_);
+        while (count > 0) {
+            segment& s = at(count_ - 1);
+            size_t n = std::min(count, s.end - s.begin);
+            s.end -= n;
+            size_ -= n;
+            count -= n;
+            if (s.begin == s.end) {
+                pop_back_bucket();
+            }
+        }
+    }
+
+    /**
+     * \brief Removes everything, buckets are kept for reuse
+     */
+    void clear()
+    {
+        consume(size_);
+    }
+
+    /**
+     * \brief Copies up to \p count elements starting at \p offset to \p out
+     *
+     * \return Number of elements copied
+     */
+    size_t copy_to(T *out, size_t count, size_t offset = 0) const
+    {
+        size_t copied = 0;
+        for (size_t i = 0; i < count_ && copied < count; ++i) {
+            const segment& s = at(i);
+            size_t length = s.end - s.begin;
+            if (offset >= length) {
+                offset -= length;
+                continue;
+            }
+            size_t n = std::min(count - copied, length - offset);
+            std::copy(s.data->data() + s.begin + offset, s.data->data() + s.begin + offset + n, out + copied);
+            copied += n;
+            offset  = 0;
+        }
+        return copied;
+    }
+
+    /**
+     * \return The \p length elements starting at \p offset, or as many as
+     * there are, sharing the buckets holding them
+     */
+    slice_type slice(size_t offset = 0, size_t length = size_t(-1)) const
+    {
+        slice_type result;
+        for (size_t i = 0; i < count_ && length > 0; ++i) {
+            const segment& s = at(i);
+            size_t available = s.end - s.begin;
+            if (offset >= available) {
+                offset -= available;
+                continue;
+            }
+            size_t n = std::min(length, available - offset);
+            result.add(s.data, s.begin + offset, s.begin + offset + n);
+            length -= n;
+            offset  = 0;
+        }
+        return result;
+    }
+
+    /**
+     * \return The content, as a ConstBufferSequence
+     */
+    const_buffers_type data() const
+    {
+        return const_buffers_type(ring_.data(), ring_.size() - 1, head_, head_ + count_, size_, false);
+    }
+
+    /**
+     * \brief Makes room for \p count more elements at the back
+     *
+     * \return The room, as a MutableBufferSequence of exactly \p count
+     * elements, made part of the content by \c commit()
+     */
+    mutable_buffers_type prepare(size_t count)
+    {
+        size_t available = room() + prepared_ * Size;
+        while (available < count) {
+            if (count_ + prepared_ == ring_.size()) {
+                grow();
+            }
+            at(count_ + prepared_) = make_segment(take_bucket(), 0);
+            ++prepared_;
+            available += Size;
+        }
+
+        // the room left in the last bucket comes first
+        prepared_room_ = room();
+        size_t first = head_ + count_ - (prepared_room_ > 0 ? 1 : 0);
+        return mutable_buffers_type(ring_.data(), ring_.size() - 1, first, head_ + count_ + prepared_, count, true);
+    }
+
+    /**
+     * \brief Appends \p count elements written to the sequence returned by
+     * \c prepare()
+     */
+    void commit(size_t count)
+    {
+        // the room as prepare() saw it, a slice of the last bucket may have
+        // gone, or come, since
+        size_t room = count_ == 0 ? 0 : std::min(prepared_room_, Size - at(count_ - 1).end);
+        count = std::min(count, room + prepared_ * Size);
+        while (count > 0) {
+            if (room == 0) {
+                // the next prepared bucket joins the content
+                --prepared_;
+                ++count_;
+                room = Size;
+            }
+            segment& s = at(count_ - 1);
+            size_t n = std::min(count, room);
+            s.end += n;
+            size_ += n;
+            room  -= n;
+            count -= n;
+        }
+        prepared_room_ = room;
+    }
+
+    /**
+     * \brief Frees the buckets kept for reuse
+     */
+    void shrink_to_fit()
+    {
+        for (bucket *b : spare_) {
+            bucket::destroy(b);
+        }
+        spare_.clear();
+    }
+
+private:
+
+    std::vector<segment> ring_;      // power of two sized
+    size_t               head_;      // ring position of the first segment, unmasked
+    size_t               count_;     // segments holding data
+    size_t               prepared_;  // empty segments after them, from prepare()
+    size_t               prepared_room_;  // room() when prepare() was called
+    size_t               size_;
+    size_t               max_spare_;
+    std::vector<bucket*> spare_;
+
+    segment& at(size_t i)
+    {
+        return ring_[(head_ + i) & (ring_.size() - 1)];
+    }
+
+    const segment& at(size_t i) const
+    {
+        return ring_[(head_ + i) & (ring_.size() - 1)];
+    }
+
+    /**
+     * Free elements after the last segment holding data, none if the bucket
+     * is shared
+     */
+    size_t room() const
+    {
+        if (count_ == 0 || !at(count_ - 1).data->writable()) {
+            return 0;
+        }
+        return Size - at(count_ - 1).end;
+    }
+
+    static segment make_segment(bucket *b, size_t offset)
+    {
+        segment s;
+        s.data  = b;
+        s.begin = offset;
+        s.end   = offset;
+        return s;
+    }
+
+    bucket *take_bucket()
+    {
+        if (spare_.empty()) {
+            return bucket::create();
+        }
+        bucket *b = spare_.back();
+        spare_.pop_back();
+        return b;
+    }
+
+    /**
+     * Drops the buffer's reference to \p b, slices holding others free it
+     */
+    void give_bucket(bucket *b)
+    {
+        if (!b->release()) {
+            return;
+        }
+        if (spare_.size() < max_spare_ && !b->external()) {
+            b->reset();
+            spare_.push_back(b);
+        } else {
+            bucket::destroy(b);
+        }
+    }
+
+    /**
+     * Doubles the ring, keeping every segment at the same logical position
+     */
+    void grow()
+    {
+        std::vector<segment> larger(ring_.size() * 2);
+        for (size_t i = 0; i < count_ + prepared_; ++i) {
+            larger[i] = at(i);
+        }
+        ring_.swap(larger);
+        head_ = 0;
+    }
+
+    void push_back_bucket()
+    {
+        if (prepared_ > 0) {
+            --prepared_;
+            ++count_;
+            return;
+        }
+        if (count_ == ring_.size()) {
+            grow();
+        }
+        at(count_) = make_segment(take_bucket(), 0);
+        ++count_;
+    }
+
+    void push_front_bucket()
+    {
+        if (count_ == 0 && prepared_ > 0) {
+            // filled from the end, appending will take another one
+            segment& s = at(0);
+            s.begin = Size;
+            s.end   = Size;
+            --prepared_;
+            ++count_;
+            return;
+        }
+        if (count_ + prepared_ == ring_.size()) {
+            grow();
+        }
+        --head_;
+        at(0) = make_segment(take_bucket(), Size);
+        ++count_;
+    }
+
+    void pop_front_bucket()
+    {
+        bucket *b = at(0).data;
+        ++head_;
+        --count_;
+        if (count_ == 0 && prepared_ == 0 && b->writable()) {
+            // empty again, the bucket stays as the one to fill next
+            at(0) = make_segment(b, 0);
+            ++prepared_;
+            return;
+        }
+        give_bucket(b);
+    }
+
+    void pop_back_bucket()
+    {
+        --count_;
+        segment& s = at(count_);
+        if (prepared_ > 0 || !s.data->writable()) {
+            give_bucket(s.data);
+            if (prepared_ > 0) {
+                // one empty bucket after the content is enough, the last takes its place
+                s = at(count_ + prepared_);
+            }
+            return;
+        }
+        s.begin = 0;
+        s.end   = 0;
+        ++prepared_;
+    }
+};
+
+template <class T, size_t Size>
+const size_t buffer<T, Size>::bucket_size;
 
-}
+} // namespace transport
+} // namespace et
 
-#endif // buffer_hpp__
+#endif // transport_buffer_hpp__
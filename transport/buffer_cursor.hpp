@@ -0,0 +1,629 @@
+/**
+ * \file buffer_cursor.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_buffer_cursor_hpp__
+#define transport_buffer_cursor_hpp__
+
+#include "transport/__buffer.hpp"
+
+#include <boost/asio/buffer.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Encoding of integers to and from bytes
+ *
+ * Fixed width integers in either byte order, and LEB128 varints, unsigned
+ * and zigzag encoded signed ones, the way protobuf has them.
+ */
+struct byte_codec
+{
+    /**
+     * Longest varint, a 64 bit value takes 10 bytes
+     */
+    static const size_t MAX_VARINT = 10;
+
+    template <
+        typename Int>
+    static Int load_be(const uint8_t *p)
+    {
+        return load<Int>(p, !host_big_endian());
+    }
+
+    template <
+        typename Int>
+    static Int load_le(const uint8_t *p)
+    {
+        return load<Int>(p, host_big_endian());
+    }
+
+    template <
+        typename Int>
+    static void store_be(uint8_t *p, Int value)
+    {
+        store(p, value, !host_big_endian());
+    }
+
+    template <
+        typename Int>
+    static void store_le(uint8_t *p, Int value)
+    {
+        store(p, value, host_big_endian());
+    }
+
+    /**
+     * \brief Writes \p value to \p p, which has room for \c MAX_VARINT bytes
+     *
+     * \return Bytes written
+     */
+    static size_t store_varint(uint8_t *p, uint64_t value)
+    {
+        size_t n = 0;
+        while (value >= 0x80) {
+            p[n++] = uint8_t(value | 0x80);
+            value >>= 7;
+        }
+        p[n++] = uint8_t(value);
+        return n;
+    }
+
+    /**
+     * \brief Reads a varint from the \p size bytes at \p p
+     *
+     * \return Bytes read, 0 if the varint is cut short or longer than 64 bits
+     */
+    static size_t load_varint(const uint8_t *p, size_t size, uint64_t& value)
+    {
+        uint64_t result = 0;
+        size_t   limit  = std::min(size, size_t(MAX_VARINT));
+        for (size_t i = 0; i < limit; ++i) {
+            uint64_t byte = p[i];
+            if (i == MAX_VARINT - 1 && byte > 1) {
+                return 0;
+            }
+            result |= (byte & 0x7F) << (7 * i);
+            if (byte < 0x80) {
+                value = result;
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+
+    static uint64_t zigzag(int64_t value)
+    {
+        return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+    }
+
+    static int64_t unzigzag(uint64_t value)
+    {
+        return int64_t(value >> 1) ^ -int64_t(value & 1);
+    }
+
+    static bool host_big_endian()
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+
+    static uint8_t  swap(uint8_t value)  { return value; }
+    static uint16_t swap(uint16_t value) { return __builtin_bswap16(value); }
+    static uint32_t swap(uint32_t value) { return __builtin_bswap32(value); }
+    static uint64_t swap(uint64_t value) { return __builtin_bswap64(value); }
+
+    template <
+        typename Int>
+    static Int load(const uint8_t *p, bool swapped)
+    {
+        static_assert(std::is_integral<Int>::value, "Fixed width codecs are for integers");
+        typedef typename std::make_unsigned<Int>::type unsigned_type;
+        unsigned_type value;
+        std::memcpy(&value, p, sizeof(value));
+        return Int(swapped ? swap(value) : value);
+    }
+
+    template <
+        typename Int>
+    static void store(uint8_t *p, Int value, bool swapped)
+    {
+        static_assert(std::is_integral<Int>::value, "Fixed width codecs are for integers");
+        typedef typename std::make_unsigned<Int>::type unsigned_type;
+        unsigned_type raw = unsigned_type(value);
+        raw = swapped ? swap(raw) : raw;
+        std::memcpy(p, &raw, sizeof(raw));
+    }
+};
+
+/**
+ * \brief Reads encoded values from a ConstBufferSequence, such as
+ * \c buffer::data(), a \c buffer_slice or a single \c const_buffer, in place
+ *
+ * Values within one of the buffers of the sequence are decoded right from
+ * it, those cut by the end of one are gathered first. Every read checks
+ * there are enough bytes left; a read that fails returns \c false and leaves
+ * the cursor where it was, so a parser can wait for more data and retry:
+ *
+ * \code
+ *  buffer_reader<buffer<char>::const_buffers_type> reader(incoming.data());
+ *  uint32_t    id;
+ *  std::string name;
+ *  if (reader.read_be(id) && reader.read_string(name, 256)) {
+ *      incoming.consume(reader.position());
+ *  }
+ * \endcode
+ *
+ * The sequence is copied, the memory it refers to must stay as it is while
+ * the reader is used. Not copyable, for the copy would point at the
+ * original's sequence.
+ */
+template <
+    typename Const_Buffers>
+class buffer_reader
+{
+    typedef decltype(boost::asio::buffer_sequence_begin(std::declval<const Const_Buffers&>())) iterator;
+
+public:
+
+    explicit buffer_reader(const Const_Buffers& buffers)
+     : buffers_(buffers)
+     , next_(boost::asio::buffer_sequence_begin(static_cast<const Const_Buffers&>(buffers_)))
+     , end_(boost::asio::buffer_sequence_end(static_cast<const Const_Buffers&>(buffers_)))
+     , current_(nullptr)
+     , current_end_(nullptr)
+     , position_(0)
+     , size_(boost::asio::buffer_size(buffers_))
+    {
+        advance();
+    }
+
+    /**
+     * \return Bytes read so far
+     */
+    size_t position() const
+    {
+        return position_;
+    }
+
+    /**
+     * \return Bytes left to read
+     */
+    size_t remaining() const
+    {
+        return size_ - position_;
+    }
+
+    bool empty() const
+    {
+        return remaining() == 0;
+    }
+
+    bool read_u8(uint8_t& value)
+    {
+        return read(&value, 1);
+    }
+
+    /**
+     * \brief Reads a big endian, network order, \c Int
+     */
+    template <
+        typename Int>
+    bool read_be(Int& value)
+    {
+        uint8_t bytes[sizeof(Int)];
+        const uint8_t *p = take(bytes, sizeof(Int));
+        if (p == nullptr) {
+            return false;
+        }
+        value = byte_codec::load_be<Int>(p);
+        return true;
+    }
+
+    /**
+     * \brief Reads a little endian \c Int
+     */
+    template <
+        typename Int>
+    bool read_le(Int& value)
+    {
+        uint8_t bytes[sizeof(Int)];
+        const uint8_t *p = take(bytes, sizeof(Int));
+        if (p == nullptr) {
+            return false;
+        }
+        value = byte_codec::load_le<Int>(p);
+        return true;
+    }
+
+    /**
+     * \brief Reads an unsigned LEB128 varint
+     *
+     * Fails as well on varints longer than 64 bits.
+     */
+    bool read_varint(uint64_t& value)
+    {
+        size_t available = size_t(current_end_ - current_);
+        if (available >= byte_codec::MAX_VARINT || available == remaining()) {
+            size_t n = byte_codec::load_varint(current_, available, value);
+            if (n == 0) {
+                return false;
+            }
+            skip_current(n);
+            return true;
+        }
+
+        // cut by the end of the buffer, gather what may be the varint
+        uint8_t bytes[byte_codec::MAX_VARINT];
+        size_t  length = std::min(remaining(), size_t(byte_codec::MAX_VARINT));
+        state   saved  = save();
+        copy(bytes, length);
+        restore(saved);
+        size_t n = byte_codec::load_varint(bytes, length, value);
+        if (n == 0) {
+            return false;
+        }
+        skip(n);
+        return true;
+    }
+
+    /**
+     * \brief Reads a zigzag encoded signed varint
+     */
+    bool read_svarint(int64_t& value)
+    {
+        uint64_t raw;
+        if (!read_varint(raw)) {
+            return false;
+        }
+        value = byte_codec::unzigzag(raw);
+        return true;
+    }
+
+    /**
+     * \brief Reads a string preceded by its length, as a varint
+     *
+     * Fails as well if the length is over \p max_length, before the string
+     * arrives, so a peer cannot make a parser wait for gigabytes.
+     */
+    bool read_string(std::string& value, size_t max_length = size_t(-1))
+    {
+        state    saved = save();
+        uint64_t length;
+        if (!read_varint(length) || length > max_length || length > remaining()) {
+            restore(saved);
+            return false;
+        }
+        value.resize(size_t(length));
+        copy(&value[0], size_t(length));
+        return true;
+    }
+
+    /**
+     * \brief Copies the next \p count bytes to \p out
+     */
+    bool read(void *out, size_t count)
+    {
+        if (count > remaining()) {
+            return false;
+        }
+        copy(static_cast<uint8_t*>(out), count);
+        return true;
+    }
+
+    bool skip(size_t count)
+    {
+        if (count > remaining()) {
+            return false;
+        }
+        while (count > 0) {
+            size_t n = std::min(count, size_t(current_end_ - current_));
+            skip_current(n);
+            count -= n;
+        }
+        return true;
+    }
+
+private:
+    buffer_reader(const buffer_reader&) = delete;
+    buffer_reader& operator=(const buffer_reader&) = delete;
+
+    struct state {
+        iterator       next;
+        const uint8_t *current;
+        const uint8_t *current_end;
+        size_t         position;
+    };
+
+    Const_Buffers  buffers_;
+    iterator       next_;         // the buffer after the current one
+    iterator       end_;
+    const uint8_t *current_;      // what is left of the current buffer
+    const uint8_t *current_end_;
+    size_t         position_;
+    size_t         size_;
+
+    /**
+     * Moves on to the next buffer with something in it, if the current one
+     * is done
+     */
+    void advance()
+    {
+        while (current_ == current_end_ && next_ != end_) {
+            boost::asio::const_buffer b(*next_);
+            ++next_;
+            current_     = static_cast<const uint8_t*>(b.data());
+            current_end_ = current_ + b.size();
+        }
+    }
+
+    void skip_current(size_t count)
+    {
+        current_  += count;
+        position_ += count;
+        advance();
+    }
+
+    /**
+     * The next \p count bytes, where they are if they are together, or
+     * gathered in \p scratch
+     */
+    const uint8_t *take(uint8_t *scratch, size_t count)
+    {
+        if (size_t(current_end_ - current_) >= count) {
+            const uint8_t *p = current_;
+            skip_current(count);
+            return p;
+        }
+        if (count > remaining()) {
+            return nullptr;
+        }
+        copy(scratch, count);
+        return scratch;
+    }
+
+    /**
+     * Copies \p count bytes, there are that many
+     */
+    void copy(void *out, size_t count)
+    {
+        uint8_t *p = static_cast<uint8_t*>(out);
+        while (count > 0) {
+            size_t n = std::min(count, size_t(current_end_ - current_));
+            std::memcpy(p, current_, n);
+            p     += n;
+            count -= n;
+            skip_current(n);
+        }
+    }
+
+    state save() const
+    {
+        state s = { next_, current_, current_end_, position_ };
+        return s;
+    }
+
+    void restore(const state& s)
+    {
+        next_        = s.next;
+        current_     = s.current;
+        current_end_ = s.current_end;
+        position_    = s.position;
+    }
+};
+
+/**
+ * \brief Appends encoded values to a \c buffer, writing them in place
+ *
+ * Values go straight into the room after the content, those that do not
+ * fit in what is left of a bucket are split across it and the next. What
+ * is written becomes part of the buffer's content on \c flush(), done as
+ * well by the destructor:
+ *
+ * \code
+ *  buffer<char> outgoing;
+ *  {
+ *      buffer_writer<char> writer(outgoing);
+ *      writer.write_be(uint32_t(id));
+ *      writer.write_string(name);
+ *  }
+ *  connection->write(outgoing, on_written);
+ * \endcode
+ *
+ * The buffer must not be changed otherwise between flushes.
+ */
+template <
+    class T,
+    size_t Size = 1024>
+class buffer_writer
+{
+public:
+    static_assert(sizeof(T) == 1, "buffer_writer writes bytes");
+
+    typedef buffer<T, Size> buffer_type;
+
+    explicit buffer_writer(buffer_type& target)
+     : buffer_(target)
+     , flushed_(nullptr)
+     , current_(nullptr)
+     , end_(nullptr)
+     , written_(0)
+    { }
+
+    ~buffer_writer()
+    {
+        flush();
+    }
+
+    /**
+     * \return Bytes written so far, flushed or not
+     */
+    size_t position() const
+    {
+        return written_;
+    }
+
+    /**
+     * \brief Makes what has been written part of the buffer's content
+     *
+     * The buffer may be changed afterwards, the writer takes new room the
+     * next time it writes.
+     */
+    void flush()
+    {
+        buffer_.commit(size_t(current_ - flushed_));
+        flushed_ = current_ = end_ = nullptr;
+    }
+
+    void write_u8(uint8_t value)
+    {
+        write(&value, 1);
+    }
+
+    /**
+     * \brief Writes \p value big endian, network order
+     */
+    template <
+        typename Int>
+    void write_be(Int value)
+    {
+        if (size_t(end_ - current_) >= sizeof(Int)) {
+            byte_codec::store_be(current_, value);
+            skip_current(sizeof(Int));
+            return;
+        }
+        uint8_t bytes[sizeof(Int)];
+        byte_codec::store_be(bytes, value);
+        write(bytes, sizeof(Int));
+    }
+
+    /**
+     * \brief Writes \p value little endian
+     */
+    template <
+        typename Int>
+    void write_le(Int value)
+    {
+        if (size_t(end_ - current_) >= sizeof(Int)) {
+            byte_codec::store_le(current_, value);
+            skip_current(sizeof(Int));
+            return;
+        }
+        uint8_t bytes[sizeof(Int)];
+        byte_codec::store_le(bytes, value);
+        write(bytes, sizeof(Int));
+    }
+
+    /**
+     * \brief Writes \p value as an unsigned LEB128 varint
+     */
+    void write_varint(uint64_t value)
+    {
+        if (size_t(end_ - current_) >= byte_codec::MAX_VARINT) {
+            skip_current(byte_codec::store_varint(current_, value));
+            return;
+        }
+        uint8_t bytes[byte_codec::MAX_VARINT];
+        write(bytes, byte_codec::store_varint(bytes, value));
+    }
+
+    /**
+     * \brief Writes \p value as a zigzag encoded varint
+     */
+    void write_svarint(int64_t value)
+    {
+        write_varint(byte_codec::zigzag(value));
+    }
+
+    /**
+     * \brief Writes the \p length bytes at \p data preceded by \p length,
+     * as a varint
+     */
+    void write_string(const char *data, size_t length)
+    {
+        write_varint(length);
+        write(data, length);
+    }
+
+    void write_string(const std::string& value)
+    {
+        write_string(value.data(), value.size());
+    }
+
+    /**
+     * \brief Copies \p count bytes
+     */
+    void write(const void *data, size_t count)
+    {
+        const uint8_t *p = static_cast<const uint8_t*>(data);
+        while (count > 0) {
+            if (current_ == end_) {
+                next_room();
+            }
+            size_t n = std::min(count, size_t(end_ - current_));
+            std::memcpy(current_, p, n);
+            skip_current(n);
+            p     += n;
+            count -= n;
+        }
+    }
+
+    /**
+     * \brief Links the content of \p slice to the buffer, without copying
+     * it, after flushing what came before
+     */
+    void write(const typename buffer_type::slice_type& slice)
+    {
+        flush();
+        buffer_.append(slice);
+        written_ += slice.size();
+    }
+
+private:
+    buffer_writer(const buffer_writer&) = delete;
+    buffer_writer& operator=(const buffer_writer&) = delete;
+
+    buffer_type& buffer_;
+    uint8_t     *flushed_;  // the room taken from the buffer, written up to current_
+    uint8_t     *current_;
+    uint8_t     *end_;
+    size_t       written_;
+
+    void skip_current(size_t count)
+    {
+        current_ += count;
+        written_ += count;
+    }
+
+    /**
+     * Flushes the current room and takes the next one, the rest of the last
+     * bucket or a new one
+     */
+    void next_room()
+    {
+        flush();
+        boost::asio::mutable_buffer room(*buffer_.prepare(Size).begin());
+        flushed_ = current_ = static_cast<uint8_t*>(room.data());
+        end_     = current_ + room.size();
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_buffer_cursor_hpp__
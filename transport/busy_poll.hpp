@@ -0,0 +1,126 @@
+/**
+ * \file busy_poll.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_busy_poll_hpp__
+#define transport_busy_poll_hpp__
+
+#include <atomic>
+#include <cstddef>
+
+#if defined(__linux__)
+ #include <pthread.h>
+ #include <sched.h>
+ #include <sys/socket.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+ #include <immintrin.h>
+#endif
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Helpers for receive loops that spin on a dedicated core instead
+ * of sleeping in the reactor
+ *
+ * Waking a thread parked in epoll costs several microseconds, and more
+ * when its core has gone to a deep idle state. A busy loop trades a whole
+ * core for never sleeping: the socket is polled without blocking and
+ * handlers run inline as soon as data is there. With \c SO_BUSY_POLL the
+ * kernel additionally polls the device queue from the receive call itself,
+ * skipping the interrupt for NICs that support it.
+ *
+ * The loops are \c udp_connection::busy_receive() and
+ * \c tcp_connection::busy_receive(), run on a thread of their own.
+ */
+class busy_poll
+{
+public:
+    /**
+     * \brief Asks the kernel to poll the device for up to \p usec
+     * microseconds when the socket queue is empty
+     *
+     * Values above \c net.core.busy_read need \c CAP_NET_ADMIN.
+     * \c SO_PREFER_BUSY_POLL is also set where available.
+     *
+     * \return \c false if \c SO_BUSY_POLL was not accepted
+     */
+    static bool enable(int fd, unsigned usec)
+    {
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+        int value = int(usec);
+        if (::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0) {
+            return false;
+        }
+ #if defined(SO_PREFER_BUSY_POLL)
+        int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+ #endif
+        return true;
+#else
+        (void)fd;
+        (void)usec;
+        return false;
+#endif
+    }
+
+    /**
+     * \brief Tells the CPU we are spinning, a few cycles at most
+     */
+    static void relax()
+    {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        _mm_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    /**
+     * \brief Binds the calling thread to \p cpu, so the spinning core is
+     * the one with the socket's data in cache
+     */
+    static bool pin(unsigned cpu)
+    {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
+    /**
+     * \brief Calls \p poll until \p running is cleared or it returns \c false
+     *
+     * \param poll Polls once:
+     * \code poll(progress: size_t&) -> bool \endcode
+     * it sets \c progress to the amount of work done, zero to spin.
+     */
+    template <
+        typename Poll>
+    static void run(const std::atomic<bool>& running, Poll poll)
+    {
+        while (running.load(std::memory_order_relaxed)) {
+            size_t progress = 0;
+            if (!poll(progress)) {
+                return;
+            }
+            if (progress == 0) {
+                relax();
+            }
+        }
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_busy_poll_hpp__
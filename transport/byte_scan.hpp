@@ -0,0 +1,508 @@
+/**
+ * \file byte_scan.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_byte_scan_hpp__
+#define transport_byte_scan_hpp__
+
+#include <boost/asio/buffer.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+ #define TRANSPORT_BYTE_SCAN_X86 1
+ #include <immintrin.h>
+#endif
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief A set of byte values, for \c byte_scan::find_in() and
+ * \c byte_scan::find_not_in()
+ *
+ * \code
+ *  byte_class space(" \t\r\n");
+ *  byte_class digit = byte_class().add_range('0', '9');
+ * \endcode
+ */
+class byte_class
+{
+public:
+    byte_class()
+    {
+        std::memset(low_, 0, sizeof(low_));
+        std::memset(high_, 0, sizeof(high_));
+        std::memset(member_, 0, sizeof(member_));
+    }
+
+    /**
+     * \brief The bytes in the NUL terminated string \p chars
+     */
+    explicit byte_class(const char *chars)
+     : byte_class()
+    {
+        add(chars);
+    }
+
+    byte_class& add(uint8_t c)
+    {
+        uint8_t bit = uint8_t(1 << ((c >> 4) & 7));
+        if (c & 0x80) {
+            high_[c & 15] |= bit;
+        } else {
+            low_[c & 15] |= bit;
+        }
+        member_[c] = 1;
+        return *this;
+    }
+
+    byte_class& add(const char *chars)
+    {
+        while (*chars) {
+            add(uint8_t(*chars++));
+        }
+        return *this;
+    }
+
+    byte_class& add_range(uint8_t first, uint8_t last)
+    {
+        for (unsigned c = first; c <= last; ++c) {
+            add(uint8_t(c));
+        }
+        return *this;
+    }
+
+    /**
+     * \return Every byte not in this class
+     */
+    byte_class operator~() const
+    {
+        byte_class result;
+        for (size_t i = 0; i < 16; ++i) {
+            result.low_[i]  = uint8_t(~low_[i]);
+            result.high_[i] = uint8_t(~high_[i]);
+        }
+        for (size_t i = 0; i < 256; ++i) {
+            result.member_[i] = uint8_t(!member_[i]);
+        }
+        return result;
+    }
+
+    bool contains(uint8_t c) const
+    {
+        return member_[c] != 0;
+    }
+
+private:
+    friend class byte_scan;
+
+    // bit h of low_[l] is set if byte (h << 4 | l) is in, high_ is for 0x80
+    // and up; member_ is the same as a plain table, for byte at a time loops
+    uint8_t low_[16];
+    uint8_t high_[16];
+    uint8_t member_[256];
+};
+
+/**
+ * \brief Searches for bytes, 16 or 32 at a time
+ *
+ * Every search comes in two forms: over a contiguous range, returning the
+ * index of the match, and over a ConstBufferSequence such as
+ * \c buffer::data(), a \c buffer_slice or \c magic_ring::data(), returning
+ * its position in the sequence. Sequences are searched from \p offset for
+ * at most \p limit bytes, so a scan for a header delimiter can be bounded
+ * by the longest header allowed. Not finding anything returns \c npos.
+ *
+ * The fastest implementation supported by the CPU is picked on first use,
+ * the 128 bit one needs SSSE3 for the class searches.
+ */
+class byte_scan
+{
+public:
+    enum implementation {
+        scalar,
+        ssse3,
+        avx2
+    };
+
+    static const size_t npos = size_t(-1);
+
+    /**
+     * Largest set \c find_any() searches comparing with each byte, larger
+     * ones are faster as a \c byte_class
+     */
+    static const size_t MAX_SET = 2;
+
+    /**
+     * The result of searching a ConstBufferSequence, keeps pointers out of
+     * those overloads
+     */
+    template <
+        typename Const_Buffers>
+    struct sequence_result
+        : std::enable_if<boost::asio::is_const_buffer_sequence<Const_Buffers>::value, size_t>
+    { };
+
+    /**
+     * \return Index of the first \p c in \p data
+     *
+     * This one is \c memchr(), already vectorized, and faster, in libc.
+     */
+    static size_t find(const void *data, size_t size, char c)
+    {
+        const void *found = std::memchr(data, c, size);
+        return found ? size_t(static_cast<const uint8_t*>(found) - static_cast<const uint8_t*>(data)) : npos;
+    }
+
+    /**
+     * \return Index of the first byte in \p data that is any of the
+     * \p count bytes in \p set
+     */
+    static size_t find_any(const void *data, size_t size, const char *set, size_t count)
+    {
+        if (count == 1) {
+            return find(data, size, set[0]);
+        }
+        if (count == 0 || count > MAX_SET || selected() == scalar) {
+            byte_class c;
+            for (size_t i = 0; i < count; ++i) {
+                c.add(uint8_t(set[i]));
+            }
+            return find_in(data, size, c);
+        }
+        const uint8_t *p = static_cast<const uint8_t*>(data);
+        switch (selected()) {
+#if defined(TRANSPORT_BYTE_SCAN_X86)
+            case avx2:
+                return find_pair_avx2(p, size, reinterpret_cast<const uint8_t*>(set));
+            case ssse3:
+                return find_pair_sse2(p, size, reinterpret_cast<const uint8_t*>(set));
+#endif
+            default:
+                return npos;
+        }
+    }
+
+    /**
+     * \return Index of the first byte in \p data that is in \p c
+     */
+    static size_t find_in(const void *data, size_t size, const byte_class& c)
+    {
+        return find_class(static_cast<const uint8_t*>(data), size, c, false);
+    }
+
+    /**
+     * \return Index of the first byte in \p data that is not in \p c, the
+     * length of the span of bytes in it
+     */
+    static size_t find_not_in(const void *data, size_t size, const byte_class& c)
+    {
+        return find_class(static_cast<const uint8_t*>(data), size, c, true);
+    }
+
+    /**
+     * \return Position of the first \p c in \p buffers
+     */
+    template <
+        typename Const_Buffers>
+    static typename sequence_result<Const_Buffers>::type
+    find(const Const_Buffers& buffers, char c, size_t offset = 0, size_t limit = npos)
+    {
+        return search(buffers, offset, limit, [c](const uint8_t *p, size_t n) {
+            return find(p, n, c);
+        });
+    }
+
+    /**
+     * \return Position of the first byte in \p buffers that is any of
+     * the \p count bytes in \p set
+     */
+    template <
+        typename Const_Buffers>
+    static typename sequence_result<Const_Buffers>::type
+    find_any(const Const_Buffers& buffers, const char *set, size_t count, size_t offset = 0, size_t limit = npos)
+    {
+        if (count > MAX_SET || selected() == scalar) {
+            byte_class c;
+            for (size_t i = 0; i < count; ++i) {
+                c.add(uint8_t(set[i]));
+            }
+            return find_in(buffers, c, offset, limit);
+        }
+        return search(buffers, offset, limit, [set, count](const uint8_t *p, size_t n) {
+            return find_any(p, n, set, count);
+        });
+    }
+
+    /**
+     * \return Position of the first byte in \p buffers that is in \p c
+     */
+    template <
+        typename Const_Buffers>
+    static typename sequence_result<Const_Buffers>::type
+    find_in(const Const_Buffers& buffers, const byte_class& c, size_t offset = 0, size_t limit = npos)
+    {
+        return search(buffers, offset, limit, [&c](const uint8_t *p, size_t n) {
+            return find_in(p, n, c);
+        });
+    }
+
+    /**
+     * \return Position of the first byte in \p buffers that is not in \p c
+     */
+    template <
+        typename Const_Buffers>
+    static typename sequence_result<Const_Buffers>::type
+    find_not_in(const Const_Buffers& buffers, const byte_class& c, size_t offset = 0, size_t limit = npos)
+    {
+        return search(buffers, offset, limit, [&c](const uint8_t *p, size_t n) {
+            return find_not_in(p, n, c);
+        });
+    }
+
+    static bool supported(implementation impl)
+    {
+#if defined(TRANSPORT_BYTE_SCAN_X86)
+        switch (impl) {
+            case avx2:
+                return __builtin_cpu_supports("avx2");
+            case ssse3:
+                return __builtin_cpu_supports("ssse3");
+            default:
+                return true;
+        }
+#else
+        return impl == scalar;
+#endif
+    }
+
+    /**
+     * \return The implementation in use, the fastest one unless another was
+     * \c select()ed
+     */
+    static implementation best()
+    {
+        return selected();
+    }
+
+    /**
+     * \brief Makes every search use \p impl, for benchmarks and tests
+     *
+     * \return \c false if \p impl is not supported by this CPU
+     */
+    static bool select(implementation impl)
+    {
+        if (!supported(impl)) {
+            return false;
+        }
+        selected() = impl;
+        return true;
+    }
+
+    static const char *name(implementation impl)
+    {
+        return impl == avx2 ? "avx2" : impl == ssse3 ? "ssse3" : "scalar";
+    }
+
+private:
+
+    static implementation& selected()
+    {
+        static implementation impl = supported(avx2) ? avx2 : supported(ssse3) ? ssse3 : scalar;
+        return impl;
+    }
+
+    /**
+     * Runs \p scan on each buffer of the sequence, within [offset, offset + limit)
+     */
+    template <
+        typename Const_Buffers,
+        typename Scan>
+    static size_t search(const Const_Buffers& buffers, size_t offset, size_t limit, Scan scan)
+    {
+        size_t position = 0;
+        for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers); ++it) {
+            boost::asio::const_buffer b(*it);
+            size_t size = b.size();
+            if (offset >= size) {
+                offset   -= size;
+                position += size;
+                continue;
+            }
+            size_t n = size - offset;
+            if (n > limit) {
+                n = limit;
+            }
+            size_t found = scan(static_cast<const uint8_t*>(b.data()) + offset, n);
+            if (found != npos) {
+                return position + offset + found;
+            }
+            limit    -= n;
+            position += size;
+            offset    = 0;
+            if (limit == 0) {
+                break;
+            }
+        }
+        return npos;
+    }
+
+    static size_t find_class(const uint8_t *p, size_t size, const byte_class& c, bool negate)
+    {
+        switch (selected()) {
+#if defined(TRANSPORT_BYTE_SCAN_X86)
+            case avx2:
+                return find_class_avx2(p, size, c, negate);
+            case ssse3:
+                return find_class_ssse3(p, size, c, negate);
+#endif
+            default:
+                return find_class_scalar(p, size, c, negate);
+        }
+    }
+
+    static size_t find_any_scalar(const uint8_t *p, size_t size, const uint8_t *set, size_t count)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            for (size_t k = 0; k < count; ++k) {
+                if (p[i] == set[k]) {
+                    return i;
+                }
+            }
+        }
+        return npos;
+    }
+
+    static size_t find_class_scalar(const uint8_t *p, size_t size, const byte_class& c, bool negate)
+    {
+        const uint8_t *member = c.member_;
+        const uint8_t  wanted = negate ? 0 : 1;
+        for (size_t i = 0; i < size; ++i) {
+            if (member[p[i]] == wanted) {
+                return i;
+            }
+        }
+        return npos;
+    }
+
+#if defined(TRANSPORT_BYTE_SCAN_X86)
+    static size_t first(uint32_t mask)
+    {
+        return size_t(__builtin_ctz(mask));
+    }
+
+    __attribute__((target("sse2")))
+    static size_t find_pair_sse2(const uint8_t *p, size_t size, const uint8_t *set)
+    {
+        const __m128i a = _mm_set1_epi8(char(set[0]));
+        const __m128i b = _mm_set1_epi8(char(set[1]));
+        size_t i = 0;
+        for ( ; i + 16 <= size; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            uint32_t mask = uint32_t(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, a), _mm_cmpeq_epi8(x, b))));
+            if (mask) {
+                return i + first(mask);
+            }
+        }
+        size_t found = find_any_scalar(p + i, size - i, set, 2);
+        return found == npos ? npos : i + found;
+    }
+
+    __attribute__((target("avx2")))
+    static size_t find_pair_avx2(const uint8_t *p, size_t size, const uint8_t *set)
+    {
+        const __m256i a = _mm256_set1_epi8(char(set[0]));
+        const __m256i b = _mm256_set1_epi8(char(set[1]));
+        size_t i = 0;
+        for ( ; i + 32 <= size; i += 32) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+            uint32_t mask = uint32_t(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, a), _mm256_cmpeq_epi8(x, b))));
+            if (mask) {
+                return i + first(mask);
+            }
+        }
+        size_t found = find_any_scalar(p + i, size - i, set, 2);
+        return found == npos ? npos : i + found;
+    }
+
+    /*
+     * Class membership for 16 bytes at once: the low nibble picks a row of
+     * the table for the byte's half (PSHUFB yields zero for indices with the
+     * top bit set, which selects the half), bits 4 to 6 pick the bit in it.
+     */
+    __attribute__((target("ssse3")))
+    static uint32_t class_mask_ssse3(__m128i x, __m128i low, __m128i high, __m128i bits)
+    {
+        __m128i rows = _mm_or_si128(_mm_shuffle_epi8(low, x),
+                                    _mm_shuffle_epi8(high, _mm_xor_si128(x, _mm_set1_epi8(char(0x80)))));
+        __m128i bit  = _mm_shuffle_epi8(bits, _mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi8(0x0F)));
+        return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(rows, bit), bit)));
+    }
+
+    __attribute__((target("ssse3")))
+    static size_t find_class_ssse3(const uint8_t *p, size_t size, const byte_class& c, bool negate)
+    {
+        const __m128i low  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c.low_));
+        const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c.high_));
+        const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+        const uint32_t flip = negate ? 0xFFFF : 0;
+        size_t i = 0;
+        for ( ; i + 16 <= size; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            uint32_t mask = class_mask_ssse3(x, low, high, bits) ^ flip;
+            if (mask) {
+                return i + first(mask);
+            }
+        }
+        size_t found = find_class_scalar(p + i, size - i, c, negate);
+        return found == npos ? npos : i + found;
+    }
+
+    __attribute__((target("avx2")))
+    static uint32_t class_mask_avx2(__m256i x, __m256i low, __m256i high, __m256i bits)
+    {
+        __m256i rows = _mm256_or_si256(_mm256_shuffle_epi8(low, x),
+                                       _mm256_shuffle_epi8(high, _mm256_xor_si256(x, _mm256_set1_epi8(char(0x80)))));
+        __m256i bit  = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(x, 4), _mm256_set1_epi8(0x0F)));
+        return uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(rows, bit), bit)));
+    }
+
+    __attribute__((target("avx2")))
+    static size_t find_class_avx2(const uint8_t *p, size_t size, const byte_class& c, bool negate)
+    {
+        const __m256i low  = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.low_)));
+        const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.high_)));
+        const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                              1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+        const uint32_t flip = negate ? 0xFFFFFFFF : 0;
+        size_t i = 0;
+        for ( ; i + 64 <= size; i += 64) {
+            // one branch per cache line
+            uint32_t a = class_mask_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), low, high, bits) ^ flip;
+            uint32_t b = class_mask_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 32)), low, high, bits) ^ flip;
+            if (a | b) {
+                return a ? i + first(a) : i + 32 + first(b);
+            }
+        }
+        for ( ; i + 32 <= size; i += 32) {
+            uint32_t mask = class_mask_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), low, high, bits) ^ flip;
+            if (mask) {
+                return i + first(mask);
+            }
+        }
+        size_t found = find_class_scalar(p + i, size - i, c, negate);
+        return found == npos ? npos : i + found;
+    }
+#endif
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_byte_scan_hpp__
@@ -0,0 +1,335 @@
+/**
+ * \file checksum.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_checksum_hpp__
+#define transport_checksum_hpp__
+
+#include <boost/asio/buffer.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+ #define TRANSPORT_CRC32C_X86 1
+ #include <nmmintrin.h>
+#endif
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief CRC-32C, the Castagnoli polynomial used by iSCSI, SCTP and ext4,
+ * computed incrementally
+ *
+ * \code
+ *  crc32c crc;
+ *  crc.update(header, sizeof(header)).update(payload.data());
+ *  uint32_t sum = crc.value();
+ * \endcode
+ *
+ * With SSE 4.2 the \c crc32 instruction does 8 bytes at a time; as each
+ * one depends on the previous, long inputs are split in three streams
+ * interleaved to keep the unit busy, their CRCs combined at the end. Other
+ * CPUs use tables, 8 bytes at a time as well. The implementation is picked
+ * on first use.
+ */
+class crc32c
+{
+public:
+    enum implementation {
+        slicing8,
+        sse42
+    };
+
+    crc32c()
+     : value_(0)
+    { }
+
+    /**
+     * \brief Resumes from the CRC of what came before, \p value
+     */
+    explicit crc32c(uint32_t value)
+     : value_(value)
+    { }
+
+    /**
+     * \return The CRC of everything so far
+     */
+    uint32_t value() const
+    {
+        return value_;
+    }
+
+    void reset()
+    {
+        value_ = 0;
+    }
+
+    crc32c& update(const void *data, size_t size)
+    {
+        value_ = ~extend(~value_, static_cast<const uint8_t*>(data), size);
+        return *this;
+    }
+
+    /**
+     * \brief Goes on with the content of a ConstBufferSequence, such as
+     * \c buffer::data() or a \c buffer_slice, from \p offset for at most
+     * \p limit bytes
+     */
+    template <
+        typename Const_Buffers>
+    typename std::enable_if<boost::asio::is_const_buffer_sequence<Const_Buffers>::value, crc32c&>::type
+    update(const Const_Buffers& buffers, size_t offset = 0, size_t limit = size_t(-1))
+    {
+        uint32_t crc = ~value_;
+        for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers) && limit > 0; ++it) {
+            boost::asio::const_buffer b(*it);
+            if (offset >= b.size()) {
+                offset -= b.size();
+                continue;
+            }
+            size_t n = std::min(b.size() - offset, limit);
+            crc = extend(crc, static_cast<const uint8_t*>(b.data()) + offset, n);
+            limit -= n;
+            offset = 0;
+        }
+        value_ = ~crc;
+        return *this;
+    }
+
+    /**
+     * \return The CRC of the \p size bytes at \p data
+     */
+    static uint32_t compute(const void *data, size_t size)
+    {
+        return crc32c().update(data, size).value();
+    }
+
+    /**
+     * \return The CRC of the content of a ConstBufferSequence
+     */
+    template <
+        typename Const_Buffers>
+    static typename std::enable_if<boost::asio::is_const_buffer_sequence<Const_Buffers>::value, uint32_t>::type
+    compute(const Const_Buffers& buffers)
+    {
+        return crc32c().update(buffers).value();
+    }
+
+    static bool supported(implementation impl)
+    {
+#if defined(TRANSPORT_CRC32C_X86)
+        return impl == sse42 ? __builtin_cpu_supports("sse4.2") : true;
+#else
+        return impl == slicing8;
+#endif
+    }
+
+    /**
+     * \return The implementation in use, the fastest one unless another was
+     * \c select()ed
+     */
+    static implementation best()
+    {
+        return selected();
+    }
+
+    /**
+     * \brief Makes every CRC use \p impl, for benchmarks and tests
+     *
+     * \return \c false if \p impl is not supported by this CPU
+     */
+    static bool select(implementation impl)
+    {
+        if (!supported(impl)) {
+            return false;
+        }
+        selected() = impl;
+        return true;
+    }
+
+    static const char *name(implementation impl)
+    {
+        return impl == sse42 ? "sse4.2" : "slicing-by-8";
+    }
+
+private:
+
+    static const uint32_t POLYNOMIAL = 0x82F63B78;  // reflected
+    static const size_t   LONG       = 8192;        // bytes per stream, interleaving long inputs
+    static const size_t   SHORT      = 256;         // and shorter ones
+
+    struct table_set {
+        uint32_t slice[8][256];       // slice[k][n]: n followed by k zero bytes
+        uint32_t long_shift[4][256];  // a CRC followed by LONG zero bytes, a byte of it at a time
+        uint32_t short_shift[4][256];
+
+        table_set()
+        {
+            for (uint32_t n = 0; n < 256; ++n) {
+                uint32_t crc = n;
+                for (int bit = 0; bit < 8; ++bit) {
+                    crc = (crc >> 1) ^ (POLYNOMIAL & (0 - (crc & 1)));
+                }
+                slice[0][n] = crc;
+            }
+            for (uint32_t n = 0; n < 256; ++n) {
+                for (size_t k = 1; k < 8; ++k) {
+                    slice[k][n] = (slice[k - 1][n] >> 8) ^ slice[0][slice[k - 1][n] & 0xFF];
+                }
+            }
+            make_shift(long_shift, LONG);
+            make_shift(short_shift, SHORT);
+        }
+
+        /*
+         * Appending zeros is linear on the CRC register, so it is enough to
+         * know what they do to each bit of it
+         */
+        void make_shift(uint32_t (&shift)[4][256], size_t zeros)
+        {
+            uint32_t bit[32];
+            for (size_t i = 0; i < 32; ++i) {
+                uint32_t crc = uint32_t(1) << i;
+                for (size_t n = 0; n < zeros; ++n) {
+                    crc = slice[0][crc & 0xFF] ^ (crc >> 8);
+                }
+                bit[i] = crc;
+            }
+            for (size_t byte = 0; byte < 4; ++byte) {
+                for (uint32_t n = 0; n < 256; ++n) {
+                    uint32_t crc = 0;
+                    for (size_t i = 0; i < 8; ++i) {
+                        crc ^= (n >> i) & 1 ? bit[byte * 8 + i] : 0;
+                    }
+                    shift[byte][n] = crc;
+                }
+            }
+        }
+    };
+
+    uint32_t value_;
+
+    static implementation& selected()
+    {
+        static implementation impl = supported(sse42) ? sse42 : slicing8;
+        return impl;
+    }
+
+    static const table_set& tables()
+    {
+        static const table_set t;
+        return t;
+    }
+
+    /**
+     * Runs the CRC register, not inverted, over \p size bytes
+     */
+    static uint32_t extend(uint32_t crc, const uint8_t *p, size_t size)
+    {
+#if defined(TRANSPORT_CRC32C_X86)
+        if (selected() == sse42) {
+            return extend_sse42(crc, p, size);
+        }
+#endif
+        return extend_slicing8(crc, p, size);
+    }
+
+    static uint32_t load32(const uint8_t *p)
+    {
+        return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+    }
+
+    static uint32_t extend_slicing8(uint32_t crc, const uint8_t *p, size_t size)
+    {
+        const table_set& t = tables();
+        for ( ; size >= 8; size -= 8, p += 8) {
+            uint32_t low  = load32(p) ^ crc;
+            uint32_t high = load32(p + 4);
+            crc = t.slice[7][low & 0xFF] ^ t.slice[6][(low >> 8) & 0xFF]
+                ^ t.slice[5][(low >> 16) & 0xFF] ^ t.slice[4][low >> 24]
+                ^ t.slice[3][high & 0xFF] ^ t.slice[2][(high >> 8) & 0xFF]
+                ^ t.slice[1][(high >> 16) & 0xFF] ^ t.slice[0][high >> 24];
+        }
+        for ( ; size > 0; --size, ++p) {
+            crc = t.slice[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#if defined(TRANSPORT_CRC32C_X86)
+    static uint32_t shift(const uint32_t (&table)[4][256], uint32_t crc)
+    {
+        return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF]
+             ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+    }
+
+    static uint64_t load64(const uint8_t *p)
+    {
+        uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    /*
+     * Three CRCs over consecutive blocks of \p block bytes at once, the
+     * first one continuing \p crc, the other two from zero, then put
+     * together: the CRC of A followed by B is the CRC of A followed by as
+     * many zeros as B has, xor the CRC of B alone.
+     */
+    __attribute__((target("sse4.2")))
+    static uint32_t extend_blocks(uint32_t crc, const uint8_t *&p, size_t& size, size_t block,
+                                  const uint32_t (&zeros)[4][256])
+    {
+        while (size >= block * 3) {
+            uint64_t crc0 = crc;
+            uint64_t crc1 = 0;
+            uint64_t crc2 = 0;
+            for (const uint8_t *end = p + block; p < end; p += 8) {
+                crc0 = _mm_crc32_u64(crc0, load64(p));
+                crc1 = _mm_crc32_u64(crc1, load64(p + block));
+                crc2 = _mm_crc32_u64(crc2, load64(p + block * 2));
+            }
+            crc = shift(zeros, uint32_t(crc0)) ^ uint32_t(crc1);
+            crc = shift(zeros, crc) ^ uint32_t(crc2);
+            p    += block * 2;
+            size -= block * 3;
+        }
+        return crc;
+    }
+
+    __attribute__((target("sse4.2")))
+    static uint32_t extend_sse42(uint32_t crc, const uint8_t *p, size_t size)
+    {
+        // up to an 8 byte boundary
+        for ( ; size > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0; --size, ++p) {
+            crc = _mm_crc32_u8(crc, *p);
+        }
+        if (size >= SHORT * 3) {
+            const table_set& t = tables();
+            crc = extend_blocks(crc, p, size, LONG, t.long_shift);
+            crc = extend_blocks(crc, p, size, SHORT, t.short_shift);
+        }
+        uint64_t crc64 = crc;
+        for ( ; size >= 8; size -= 8, p += 8) {
+            crc64 = _mm_crc32_u64(crc64, load64(p));
+        }
+        crc = uint32_t(crc64);
+        for ( ; size > 0; --size, ++p) {
+            crc = _mm_crc32_u8(crc, *p);
+        }
+        return crc;
+    }
+#endif
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_checksum_hpp__
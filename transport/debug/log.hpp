@@ -60,6 +60,11 @@ enum value {
     fprintf(dest, "}\n"); \
 } while(false)
 
+#define __TRACE_BUFFER(mask, dest, title, inbuff, inlen) do { \
+    if (mask & __TRACE_MASK) \
+        __DUMP_BUFFER(dest, title, inbuff, inlen); \
+} while(false)
+
 
 #if defined(__clang__)
 /* restore warnings */
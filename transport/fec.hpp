@@ -0,0 +1,641 @@
+/**
+ * \file fec.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_fec_hpp__
+#define transport_fec_hpp__
+
+#include "transport/gf256.hpp"
+
+#include <boost/asio/buffer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief How a stream is protected, chosen by the sender
+ */
+struct fec_config
+{
+    enum scheme_type {
+        xor_parity   = 1,  ///< One parity packet per group, repairs one loss
+        reed_solomon = 2   ///< \c parity_shards parity packets, repair as many losses
+    };
+
+    scheme_type scheme;
+    size_t      data_shards;    ///< Packets per group
+    size_t      parity_shards;  ///< Parity packets per group, always 1 with \c xor_parity
+
+    fec_config(scheme_type scheme = reed_solomon, size_t data_shards = 10, size_t parity_shards = 2)
+     : scheme(scheme)
+     , data_shards(data_shards)
+     , parity_shards(scheme == xor_parity ? 1 : parity_shards)
+    { }
+};
+
+/**
+ * \brief Encoding shared by \c fec_encoder and \c fec_decoder
+ *
+ * Packets are grouped, each group being \c data_shards data packets followed
+ * by \c parity_shards parity packets. Every packet starts with a header,
+ * integers in network byte order:
+ * \code
+ *  version(1) scheme(1) stream(2) group(4) index(1) data(1) parity(1) shard(2)
+ * \endcode
+ *
+ * Data packets (\c index below \c data) carry \c length(2) \c payload, which
+ * is the shard they contribute, parity packets carry \c shard bytes of
+ * parity computed over the data shards padded with zeros. Parity row \c j
+ * weights data shard \c i with \c 1/(x_j+y_i), \c x_j=255-j and \c y_i=i, a
+ * Cauchy matrix: any \c data of the packets recover the group. Coefficients
+ * do not depend on the group size, so a group closed early by a flush is
+ * just a smaller code; parity packets carry the actual \c data count.
+ */
+struct fec_codec
+{
+    static const uint8_t VERSION = 1;
+    static const size_t  HEADER_SIZE = 13;
+    static const size_t  MAX_SHARDS = 256;
+    static const size_t  MAX_SHARD = 0xFFFF;
+
+    /**
+     * Largest payload of a protected packet
+     */
+    static const size_t  MAX_PAYLOAD = MAX_SHARD - 2;
+
+    struct header {
+        uint8_t  scheme;
+        uint16_t stream;
+        uint32_t group;
+        uint8_t  index;
+        uint8_t  data;
+        uint8_t  parity;
+        uint16_t shard;
+
+        void write(uint8_t *p) const
+        {
+            p[0]  = VERSION;
+            p[1]  = scheme;
+            p[2]  = uint8_t(stream >> 8);
+            p[3]  = uint8_t(stream);
+            p[4]  = uint8_t(group >> 24);
+            p[5]  = uint8_t(group >> 16);
+            p[6]  = uint8_t(group >> 8);
+            p[7]  = uint8_t(group);
+            p[8]  = index;
+            p[9]  = data;
+            p[10] = parity;
+            p[11] = uint8_t(shard >> 8);
+            p[12] = uint8_t(shard);
+        }
+
+        bool read(const uint8_t *p, size_t size)
+        {
+            if (size < HEADER_SIZE || p[0] != VERSION) {
+                return false;
+            }
+            scheme = p[1];
+            stream = uint16_t((p[2] << 8) | p[3]);
+            group  = (uint32_t(p[4]) << 24) | (uint32_t(p[5]) << 16) | (uint32_t(p[6]) << 8) | uint32_t(p[7]);
+            index  = p[8];
+            data   = p[9];
+            parity = p[10];
+            shard  = uint16_t((p[11] << 8) | p[12]);
+            return (scheme == fec_config::xor_parity || scheme == fec_config::reed_solomon) &&
+                   data != 0 && size_t(data) + parity <= MAX_SHARDS && index < size_t(data) + parity;
+        }
+    };
+
+    /**
+     * Weight of data shard \p i in parity shard \p j
+     */
+    static uint8_t coefficient(uint8_t scheme, size_t j, size_t i)
+    {
+        return scheme == fec_config::xor_parity ? 1 : gf256::inv(uint8_t((255 - j) ^ i));
+    }
+};
+
+/**
+ * \brief Adds parity packets to one stream of datagrams
+ *
+ * Data packets go out as soon as they are sent, so protection adds no
+ * latency when nothing is lost; parity is accumulated as they go, the
+ * payloads are neither copied nor kept. Parity packets follow the last data
+ * packet of each group, \c flush() closes a group early (call it when the
+ * stream goes quiet, or the tail of a burst stays unprotected).
+ *
+ * Every packet is passed to an output, as a header and a payload for a
+ * scatter/gather send:
+ * \code
+ *  encoder.send(boost::asio::buffer(message), [&](const fec_encoder::buffers_type& packet) {
+ *      connection.socket().send(packet, 0, error);
+ *  });
+ * \endcode
+ *
+ * Not thread safe.
+ */
+class fec_encoder
+{
+public:
+    typedef std::array<boost::asio::const_buffer, 2> buffers_type;
+
+    /**
+     * \throw std::invalid_argument If \p config has no data shards or too many shards
+     */
+    explicit fec_encoder(uint16_t stream, const fec_config& config = fec_config())
+     : config_(config)
+     , stream_(stream)
+     , group_(0)
+     , sent_(0)
+     , shard_(0)
+     , parity_(config.parity_shards)
+    {
+        if (config.data_shards == 0 || config.data_shards + config.parity_shards > fec_codec::MAX_SHARDS) {
+            throw std::invalid_argument("fec_config: data_shards must be 1 to 256 with parity_shards");
+        }
+    }
+
+    const fec_config& config() const
+    {
+        return config_;
+    }
+
+    /**
+     * \brief Sends \p payload, followed by the parity of its group if it completes it
+     *
+     * \param out Called once per packet, buffers are valid until it returns:
+     * \code out(packet: const buffers_type&) \endcode
+     *
+     * \return \c false if \p payload is larger than \c fec_codec::MAX_PAYLOAD
+     */
+    template <
+        typename Output>
+    bool send(boost::asio::const_buffer payload, Output out)
+    {
+        size_t length = boost::asio::buffer_size(payload);
+        if (length > fec_codec::MAX_PAYLOAD) {
+            return false;
+        }
+
+        fec_codec::header h = make_header(uint8_t(sent_), uint8_t(config_.data_shards));
+        h.shard = uint16_t(length + 2);
+        h.write(prefix_);
+        prefix_[fec_codec::HEADER_SIZE]     = uint8_t(length >> 8);
+        prefix_[fec_codec::HEADER_SIZE + 1] = uint8_t(length);
+
+        // parity over the shard: length and payload
+        if (shard_ < length + 2) {
+            shard_ = length + 2;
+            for (std::vector<uint8_t>& parity : parity_) {
+                if (parity.size() < shard_) {
+                    parity.resize(shard_, 0);
+                }
+            }
+        }
+        const uint8_t *data = boost::asio::buffer_cast<const uint8_t*>(payload);
+        for (size_t j = 0; j < parity_.size(); ++j) {
+            uint8_t c = fec_codec::coefficient(config_.scheme, j, sent_);
+            gf256::mul_add_region(parity_[j].data(), prefix_ + fec_codec::HEADER_SIZE, c, 2);
+            gf256::mul_add_region(parity_[j].data() + 2, data, c, length);
+        }
+
+        buffers_type packet = {{ boost::asio::buffer(prefix_), payload }};
+        out(static_cast<const buffers_type&>(packet));
+
+        if (++sent_ == config_.data_shards) {
+            flush(out);
+        }
+        return true;
+    }
+
+    /**
+     * \brief Sends the parity of the current group, if it has any packet, and starts a new one
+     */
+    template <
+        typename Output>
+    void flush(Output out)
+    {
+        if (sent_ == 0) {
+            return;
+        }
+        for (size_t j = 0; j < parity_.size(); ++j) {
+            fec_codec::header h = make_header(uint8_t(sent_ + j), uint8_t(sent_));
+            h.shard = uint16_t(shard_);
+            h.write(prefix_);
+            buffers_type packet = {{
+                boost::asio::buffer(prefix_, fec_codec::HEADER_SIZE),
+                boost::asio::buffer(parity_[j].data(), shard_)
+            }};
+            out(static_cast<const buffers_type&>(packet));
+            std::memset(parity_[j].data(), 0, shard_);
+        }
+        ++group_;
+        sent_  = 0;
+        shard_ = 0;
+    }
+
+    /**
+     * \return Data packets sent in the current group, unprotected until it is flushed
+     */
+    size_t pending() const
+    {
+        return sent_;
+    }
+
+private:
+
+    fec_config                        config_;
+    uint16_t                          stream_;
+    uint32_t                          group_;
+    size_t                            sent_;    // data packets in the current group
+    size_t                            shard_;   // largest shard in the current group
+    std::vector<std::vector<uint8_t>> parity_;  // never shrink, zeroed between groups
+    uint8_t                           prefix_[fec_codec::HEADER_SIZE + 2];
+
+    fec_codec::header make_header(uint8_t index, uint8_t data) const
+    {
+        fec_codec::header h;
+        h.scheme = uint8_t(config_.scheme);
+        h.stream = stream_;
+        h.group  = group_;
+        h.index  = index;
+        h.data   = data;
+        h.parity = uint8_t(parity_.size());
+        h.shard  = 0;
+        return h;
+    }
+};
+
+/**
+ * \brief Receives the packets of any number of \c fec_encoder streams and
+ * repairs losses from parity
+ *
+ * Data packets are delivered as soon as they arrive; a lost one is
+ * delivered as soon as enough packets of its group arrived to rebuild it,
+ * possibly after later packets. Nothing is reordered or retransmitted.
+ *
+ * The last \c window groups of each stream are kept, older ones are
+ * dropped as newer ones arrive, along with any loss they could not repair.
+ * Their buffers are reused.
+ *
+ * Not thread safe.
+ */
+class fec_decoder
+{
+public:
+    typedef std::function<void(uint16_t, boost::asio::const_buffer)> Deliver_Type;
+
+    struct statistics {
+        uint64_t packets;        ///< Packets received
+        uint64_t delivered;      ///< Data packets delivered, recovered ones included
+        uint64_t recovered;      ///< Data packets rebuilt from parity
+        uint64_t unrecoverable;  ///< Data packets lost for good
+        uint64_t duplicates;     ///< Packets received more than once, or after being rebuilt
+        uint64_t late;           ///< Packets of groups already dropped
+        uint64_t malformed;      ///< Packets dropped because they could not be parsed
+    };
+
+    explicit fec_decoder(size_t window = 8)
+     : window_(std::max(size_t(1), window))
+    {
+        std::memset(&stats_, 0, sizeof(stats_));
+    }
+
+    /**
+     * \brief Sets the function receiving the payloads, valid until it returns
+     */
+    void on_deliver(Deliver_Type deliver)
+    {
+        deliver_ = std::move(deliver);
+    }
+
+    /**
+     * \brief Processes a packet, delivering whatever it carries or repairs
+     */
+    void receive(boost::asio::const_buffer packet)
+    {
+        ++stats_.packets;
+
+        const uint8_t *p = boost::asio::buffer_cast<const uint8_t*>(packet);
+        size_t size = boost::asio::buffer_size(packet);
+        fec_codec::header h;
+        if (!h.read(p, size)) {
+            ++stats_.malformed;
+            return;
+        }
+        const uint8_t *body = p + fec_codec::HEADER_SIZE;
+        size_t length = size - fec_codec::HEADER_SIZE;
+        bool is_data = h.index < h.data;
+        if (is_data ? (length < 2 || size_t((body[0] << 8) | body[1]) != length - 2) : length != h.shard) {
+            ++stats_.malformed;
+            return;
+        }
+
+        stream_state& stream = streams_[h.stream];
+        if (stream.groups.empty()) {
+            stream.groups.resize(window_);
+            stream.newest = h.group;
+        }
+
+        // slide the window when a newer group shows up
+        int32_t ahead = int32_t(h.group - stream.newest);
+        if (ahead > 0) {
+            for (uint32_t g = stream.newest + 1; int32_t(h.group - g) >= 0; ++g) {
+                group_state& old = stream.groups[g % window_];
+                if (old.used) {
+                    finish(old);
+                }
+                if (int32_t(h.group - g) >= int32_t(window_)) {
+                    // skipping more than a whole window, the rest is empty
+                    g = h.group - uint32_t(window_);
+                }
+            }
+            stream.newest = h.group;
+        } else if (-ahead >= int32_t(window_)) {
+            ++stats_.late;
+            return;
+        }
+
+        group_state& group = stream.groups[h.group % window_];
+        if (!group.used || group.number != h.group) {
+            if (group.used) {
+                finish(group);
+            }
+            group.reset(h);
+        }
+        if (!is_data) {
+            // parity packets know the actual size of the group
+            group.scheme = h.scheme;
+            group.data   = h.data;
+            group.parity = h.parity;
+            group.sized  = true;
+            group.shard  = std::max<size_t>(group.shard, h.shard);
+        }
+        if (group.sized && (h.index >= group.data + group.parity || (is_data && h.index >= group.data))) {
+            // disagrees with the size parity gave the group, stray or forged
+            ++stats_.malformed;
+            return;
+        }
+        if (group.received[h.index]) {
+            ++stats_.duplicates;
+            return;
+        }
+
+        group.received[h.index] = true;
+        ++group.count;
+        std::vector<uint8_t>& shard = group.shard_buffer(h.index);
+        shard.assign(body, body + length);
+        group.shard = std::max(group.shard, length);
+
+        if (is_data) {
+            group.delivered[h.index] = true;
+            deliver(h.stream, boost::asio::buffer(body + 2, length - 2));
+        }
+        if (group.parity_known() && !group.complete() && group.count >= group.data) {
+            recover(h.stream, group);
+        }
+    }
+
+    const statistics& stats() const
+    {
+        return stats_;
+    }
+
+private:
+
+    struct group_state {
+        bool                              used;
+        uint32_t                          number;
+        uint8_t                           scheme;
+        size_t                            data;
+        size_t                            parity;
+        bool                              sized;     // got a parity packet
+        size_t                            shard;
+        size_t                            count;
+        std::bitset<fec_codec::MAX_SHARDS> received;
+        std::bitset<fec_codec::MAX_SHARDS> delivered;
+        std::vector<std::vector<uint8_t>> shards;    // reused by later groups
+
+        group_state()
+         : used(false)
+         , number(0)
+         , scheme(0)
+         , data(0)
+         , parity(0)
+         , sized(false)
+         , shard(0)
+         , count(0)
+        { }
+
+        void reset(const fec_codec::header& h)
+        {
+            used   = true;
+            number = h.group;
+            scheme = h.scheme;
+            data   = h.data;
+            parity = h.parity;
+            sized  = false;
+            shard  = 0;
+            count  = 0;
+            received.reset();
+            delivered.reset();
+        }
+
+        std::vector<uint8_t>& shard_buffer(size_t index)
+        {
+            if (shards.size() <= index) {
+                shards.resize(index + 1);
+            }
+            return shards[index];
+        }
+
+        bool parity_known() const
+        {
+            for (size_t j = data; j < data + parity; ++j) {
+                if (received[j]) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool complete() const
+        {
+            for (size_t i = 0; i < data; ++i) {
+                if (!delivered[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    struct stream_state {
+        uint32_t                 newest;
+        std::vector<group_state> groups;  // indexed by group % window
+    };
+
+    size_t                                     window_;
+    std::unordered_map<uint16_t, stream_state> streams_;
+    statistics                                 stats_;
+    Deliver_Type                               deliver_;
+    std::vector<uint8_t>                       matrix_;
+    std::vector<uint8_t>                       inverse_;
+
+    void deliver(uint16_t stream, boost::asio::const_buffer payload)
+    {
+        ++stats_.delivered;
+        if (deliver_) {
+            deliver_(stream, payload);
+        }
+    }
+
+    /**
+     * Drops \p group, counting what it could not repair
+     *
+     * Without parity the group size is the configured one, which a group
+     * flushed early never reached, so only the losses before the last data
+     * packet seen are certain.
+     */
+    void finish(group_state& group)
+    {
+        size_t data = group.data;
+        if (!group.sized) {
+            while (data > 0 && !group.received[data - 1]) {
+                --data;
+            }
+        }
+        for (size_t i = 0; i < data; ++i) {
+            if (!group.delivered[i]) {
+                ++stats_.unrecoverable;
+            }
+        }
+        group.used = false;
+    }
+
+    /**
+     * Rebuilds the missing data shards of \p group, which has at least
+     * \c data packets
+     */
+    void recover(uint16_t stream, group_state& group)
+    {
+        std::vector<size_t> missing;
+        std::vector<size_t> rows;
+        for (size_t i = 0; i < group.data; ++i) {
+            if (!group.received[i]) {
+                missing.push_back(i);
+            }
+        }
+        for (size_t j = 0; j < group.parity && rows.size() < missing.size(); ++j) {
+            if (group.received[group.data + j]) {
+                rows.push_back(j);
+            }
+        }
+        if (rows.size() < missing.size()) {
+            // count includes packets that are no shard of this group
+            return;
+        }
+        size_t e = missing.size();
+        size_t shard = group.shard;
+
+        // syndromes: each parity minus the contribution of the data we have
+        for (size_t r = 0; r < e; ++r) {
+            std::vector<uint8_t>& s = group.shards[group.data + rows[r]];
+            s.resize(shard, 0);
+            for (size_t i = 0; i < group.data; ++i) {
+                if (group.received[i]) {
+                    const std::vector<uint8_t>& d = group.shards[i];
+                    gf256::mul_add_region(s.data(), d.data(), fec_codec::coefficient(group.scheme, rows[r], i), d.size());
+                }
+            }
+        }
+
+        // invert the e x e submatrix of the missing columns
+        if (!invert(group.scheme, rows, missing)) {
+            return;
+        }
+
+        for (size_t t = 0; t < e; ++t) {
+            std::vector<uint8_t>& d = group.shard_buffer(missing[t]);
+            d.assign(shard, 0);
+            for (size_t r = 0; r < e; ++r) {
+                gf256::mul_add_region(d.data(), group.shards[group.data + rows[r]].data(), inverse_[t * e + r], shard);
+            }
+        }
+
+        for (size_t t = 0; t < e; ++t) {
+            const std::vector<uint8_t>& d = group.shards[missing[t]];
+            size_t length = size_t((d[0] << 8) | d[1]);
+            group.received[missing[t]] = true;
+            group.delivered[missing[t]] = true;
+            ++group.count;
+            if (length + 2 > shard) {
+                // only garbage could get here
+                ++stats_.unrecoverable;
+                continue;
+            }
+            ++stats_.recovered;
+            deliver(stream, boost::asio::buffer(d.data() + 2, length));
+        }
+    }
+
+    /**
+     * Gauss-Jordan elimination of the Cauchy submatrix into \c inverse_
+     */
+    bool invert(uint8_t scheme, const std::vector<size_t>& rows, const std::vector<size_t>& columns)
+    {
+        size_t n = rows.size();
+        matrix_.resize(n * n);
+        inverse_.assign(n * n, 0);
+        for (size_t r = 0; r < n; ++r) {
+            for (size_t c = 0; c < n; ++c) {
+                matrix_[r * n + c] = fec_codec::coefficient(scheme, rows[r], columns[c]);
+            }
+            inverse_[r * n + r] = 1;
+        }
+
+        for (size_t c = 0; c < n; ++c) {
+            size_t pivot = c;
+            while (pivot < n && matrix_[pivot * n + c] == 0) {
+                ++pivot;
+            }
+            if (pivot == n) {
+                return false;
+            }
+            if (pivot != c) {
+                std::swap_ranges(&matrix_[pivot * n], &matrix_[pivot * n] + n, &matrix_[c * n]);
+                std::swap_ranges(&inverse_[pivot * n], &inverse_[pivot * n] + n, &inverse_[c * n]);
+            }
+            uint8_t scale = gf256::inv(matrix_[c * n + c]);
+            for (size_t k = 0; k < n; ++k) {
+                matrix_[c * n + k]  = gf256::mul(matrix_[c * n + k], scale);
+                inverse_[c * n + k] = gf256::mul(inverse_[c * n + k], scale);
+            }
+            for (size_t r = 0; r < n; ++r) {
+                uint8_t factor = matrix_[r * n + c];
+                if (r != c && factor != 0) {
+                    gf256::mul_add_region(&matrix_[r * n], &matrix_[c * n], factor, n);
+                    gf256::mul_add_region(&inverse_[r * n], &inverse_[c * n], factor, n);
+                }
+            }
+        }
+        return true;
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_fec_hpp__
@@ -0,0 +1,534 @@
+/**
+ * \file fragmentation.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_fragmentation_hpp__
+#define transport_fragmentation_hpp__
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Wire format shared by \c fragmenter and \c reassembler
+ *
+ * Every datagram starts with a header, integers in network byte order:
+ * \code
+ *  version(1) message(4) index(2) count(2) total(4) payload
+ * \endcode
+ *
+ * A message of \c total bytes is split in \c count fragments of
+ * \c fragment_size(total,count) bytes, the last one possibly shorter, so
+ * the receiver knows where each fragment goes without it being sent.
+ */
+struct fragment_header
+{
+    static const uint8_t VERSION = 1;
+    static const size_t  SIZE = 13;
+    static const size_t  MAX_FRAGMENTS = 0xFFFF;
+
+    uint32_t message;
+    uint16_t index;
+    uint16_t count;
+    uint32_t total;
+
+    static size_t fragment_size(size_t total, size_t count)
+    {
+        return (total + count - 1) / count;
+    }
+
+    void write(uint8_t *p) const
+    {
+        p[0] = VERSION;
+        put32(p + 1, message);
+        p[5] = uint8_t(index >> 8);
+        p[6] = uint8_t(index);
+        p[7] = uint8_t(count >> 8);
+        p[8] = uint8_t(count);
+        put32(p + 9, total);
+    }
+
+    /**
+     * \return \c false if \p p does not hold a valid header
+     */
+    bool read(const uint8_t *p, size_t size)
+    {
+        if (size < SIZE || p[0] != VERSION) {
+            return false;
+        }
+        message = get32(p + 1);
+        index   = uint16_t((p[5] << 8) | p[6]);
+        count   = uint16_t((p[7] << 8) | p[8]);
+        total   = get32(p + 9);
+        return count != 0 && index < count && (count == 1 || total >= count);
+    }
+
+private:
+
+    static void put32(uint8_t *p, uint32_t value)
+    {
+        p[0] = uint8_t(value >> 24);
+        p[1] = uint8_t(value >> 16);
+        p[2] = uint8_t(value >> 8);
+        p[3] = uint8_t(value);
+    }
+
+    static uint32_t get32(const uint8_t *p)
+    {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+};
+
+/**
+ * \brief Splits messages into datagrams of at most \c max_datagram bytes
+ *
+ * Payloads are not copied: each fragment is a header kept by the fragmenter
+ * followed by a slice of the message, ready for a scatter/gather send:
+ *
+ * \code
+ *  fragments.fragment(boost::asio::buffer(message), [&](const fragmenter::buffers_type& datagram) {
+ *      connection.socket().send_to(datagram, peer, 0, error);
+ *  });
+ * \endcode
+ *
+ * Not thread safe, use one per sending thread (message ids are per fragmenter,
+ * so give each one a different \p first_message if they share a destination).
+ */
+class fragmenter
+{
+public:
+    typedef std::array<boost::asio::const_buffer, 2> buffers_type;
+
+    /**
+     * \throws std::invalid_argument if \p max_datagram leaves no room for
+     * payload after the fragment header
+     */
+    explicit fragmenter(size_t max_datagram = 1200, uint32_t first_message = 0)
+     : max_datagram_(max_datagram)
+     , next_message_(first_message)
+    {
+        if (max_datagram <= fragment_header::SIZE) {
+            throw std::invalid_argument("fragmenter: max_datagram must be larger than the fragment header");
+        }
+    }
+
+    size_t max_datagram() const
+    {
+        return max_datagram_;
+    }
+
+    /**
+     * Largest message that can be sent
+     */
+    size_t max_message() const
+    {
+        return std::min(size_t(0xFFFFFFFF), (max_datagram_ - fragment_header::SIZE) * fragment_header::MAX_FRAGMENTS);
+    }
+
+    /**
+     * \return Fragments needed for a message of \p size bytes
+     */
+    size_t fragments(size_t size) const
+    {
+        size_t payload = max_datagram_ - fragment_header::SIZE;
+        return std::max(size_t(1), (size + payload - 1) / payload);
+    }
+
+    /**
+     * \brief Splits \p message and passes each fragment to \p out, in order
+     *
+     * \param out Called once per datagram, the buffers are valid until it returns:
+     * \code out(datagram: const buffers_type&) \endcode
+     *
+     * \return Number of fragments, zero if \p message is larger than \c max_message()
+     */
+    template <
+        typename Output>
+    size_t fragment(boost::asio::const_buffer message, Output out)
+    {
+        size_t total = boost::asio::buffer_size(message);
+        if (total > max_message()) {
+            return 0;
+        }
+
+        fragment_header header;
+        header.message = next_message_++;
+        header.count   = uint16_t(fragments(total));
+        header.total   = uint32_t(total);
+        size_t size = fragment_header::fragment_size(total, header.count);
+
+        for (size_t i = 0; i < header.count; ++i) {
+            header.index = uint16_t(i);
+            header.write(header_);
+            size_t offset = i * size;
+            buffers_type datagram = {{
+                boost::asio::buffer(header_),
+                boost::asio::buffer(message + offset, std::min(size, total - offset))
+            }};
+            out(static_cast<const buffers_type&>(datagram));
+        }
+        return header.count;
+    }
+
+    /**
+     * \brief Splits \p message and keeps the fragments for a batched send
+     *
+     * Headers live in the fragmenter until the next call to \c fragment()
+     * or \c prepare(), payloads are slices of \p message.
+     *
+     * \return One buffer sequence per datagram, empty if \p message is too large
+     */
+    const std::vector<buffers_type>& prepare(boost::asio::const_buffer message)
+    {
+        prepared_.clear();
+        size_t count = fragments(boost::asio::buffer_size(message));
+        if (headers_.size() < count * fragment_header::SIZE) {
+            headers_.resize(count * fragment_header::SIZE);
+        }
+
+        uint8_t *header = headers_.data();
+        fragment(message, [&](const buffers_type& datagram) {
+            std::memcpy(header, header_, fragment_header::SIZE);
+            buffers_type copy = {{ boost::asio::buffer(header, fragment_header::SIZE), datagram[1] }};
+            prepared_.push_back(copy);
+            header += fragment_header::SIZE;
+        });
+        return prepared_;
+    }
+
+private:
+
+    size_t                    max_datagram_;
+    uint32_t                  next_message_;
+    uint8_t                   header_[fragment_header::SIZE];
+    std::vector<uint8_t>      headers_;
+    std::vector<buffers_type> prepared_;
+};
+
+/**
+ * \brief Limits of a \c reassembler
+ *
+ * Times are in microseconds, sizes in bytes.
+ */
+struct reassembly_config
+{
+    size_t   max_message;  ///< Larger messages are dropped on their first fragment
+    size_t   max_pending;  ///< Messages being reassembled at once
+    size_t   max_memory;   ///< Bytes of reassembly storage, reused or not
+    uint64_t timeout;      ///< Incomplete messages are dropped this long after their first fragment
+
+    reassembly_config()
+     : max_message(1 << 20)
+     , max_pending(64)
+     , max_memory(16 << 20)
+     , timeout(2000000)
+    { }
+};
+
+/**
+ * \brief Puts back together the messages split by \c fragmenter
+ *
+ * Messages arriving in a single datagram are delivered straight from it,
+ * without copies. Larger ones are copied into one of \c max_pending slots
+ * whose storage is kept and reused. When no slot is free, or growing one
+ * would take the storage of all of them above \c max_memory, the storage of
+ * idle slots is released first and then the oldest incomplete messages are
+ * evicted to make room; messages that never complete are dropped after
+ * \c timeout. Fragments may arrive in any order and duplicates are ignored
+ * while their message is pending; like plain UDP, nothing stops a message
+ * from being delivered twice if the network duplicates it.
+ *
+ * Like \c reliable_session it does no I/O and reads no clock: datagrams are
+ * fed to \c receive() with the current time and \c expire() should be called
+ * at \c next_timeout() for timed out messages to release their memory.
+ *
+ * Not thread safe.
+ */
+class reassembler
+{
+public:
+    typedef boost::asio::ip::udp::endpoint endpoint_type;
+    typedef std::function<void(const endpoint_type&, boost::asio::const_buffer)> Deliver_Type;
+
+    struct statistics {
+        uint64_t fragments;   ///< Datagrams received
+        uint64_t messages;    ///< Messages delivered
+        uint64_t duplicates;  ///< Fragments received more than once
+        uint64_t expired;     ///< Incomplete messages dropped after the timeout
+        uint64_t evicted;     ///< Incomplete messages dropped to make room
+        uint64_t oversized;   ///< Fragments of messages larger than max_message
+        uint64_t malformed;   ///< Datagrams dropped because they could not be parsed
+    };
+
+    explicit reassembler(const reassembly_config& config = reassembly_config())
+     : config_(config)
+     , slots_(config.max_pending)
+     , reserved_(0)
+    {
+        std::memset(&stats_, 0, sizeof(stats_));
+    }
+
+    /**
+     * \brief Sets the function receiving complete messages
+     *
+     * The buffer is only valid until it returns.
+     */
+    void on_deliver(Deliver_Type deliver)
+    {
+        deliver_ = std::move(deliver);
+    }
+
+    /**
+     * \brief Processes a datagram received from \p from
+     */
+    void receive(const endpoint_type& from, boost::asio::const_buffer datagram, uint64_t now)
+    {
+        ++stats_.fragments;
+
+        const uint8_t *p = boost::asio::buffer_cast<const uint8_t*>(datagram);
+        size_t size = boost::asio::buffer_size(datagram);
+        fragment_header header;
+        if (!header.read(p, size)) {
+            ++stats_.malformed;
+            return;
+        }
+
+        size_t length = size - fragment_header::SIZE;
+        size_t fragment = fragment_header::fragment_size(header.total, header.count);
+        size_t offset = size_t(header.index) * fragment;
+        if (length != std::min(fragment, size_t(header.total) - std::min(offset, size_t(header.total)))) {
+            ++stats_.malformed;
+            return;
+        }
+        if (header.total > config_.max_message) {
+            ++stats_.oversized;
+            return;
+        }
+
+        if (header.count == 1) {
+            deliver(from, boost::asio::buffer(p + fragment_header::SIZE, length));
+            return;
+        }
+
+        slot *s = find(from, header.message);
+        if (s == nullptr) {
+            s = allocate(header, now);
+            if (s == nullptr) {
+                return;
+            }
+            s->from    = from;
+            s->message = header.message;
+        } else if (s->count != header.count || s->total != header.total) {
+            ++stats_.malformed;
+            return;
+        }
+
+        uint64_t bit = uint64_t(1) << (header.index % 64);
+        uint64_t& word = s->received[header.index / 64];
+        if (word & bit) {
+            ++stats_.duplicates;
+            return;
+        }
+        word |= bit;
+        std::memcpy(s->storage.data() + offset, p + fragment_header::SIZE, length);
+
+        if (++s->arrived == s->count) {
+            deliver(s->from, boost::asio::buffer(s->storage.data(), s->total));
+            release(*s);
+        }
+    }
+
+    /**
+     * \brief Drops the messages that timed out by \p now
+     */
+    void expire(uint64_t now)
+    {
+        for (slot& s : slots_) {
+            if (s.used && now >= s.started + config_.timeout) {
+                ++stats_.expired;
+                release(s);
+            }
+        }
+    }
+
+    /**
+     * \return When \c expire() has something to drop, zero if nothing is pending
+     */
+    uint64_t next_timeout() const
+    {
+        uint64_t deadline = 0;
+        for (const slot& s : slots_) {
+            if (s.used && (deadline == 0 || s.started + config_.timeout < deadline)) {
+                deadline = s.started + config_.timeout;
+            }
+        }
+        return deadline;
+    }
+
+    /**
+     * \return Messages being reassembled
+     */
+    size_t pending() const
+    {
+        size_t count = 0;
+        for (const slot& s : slots_) {
+            count += s.used ? 1 : 0;
+        }
+        return count;
+    }
+
+    /**
+     * \return Bytes of storage held, including the one kept for reuse
+     */
+    size_t reserved() const
+    {
+        return reserved_;
+    }
+
+    const statistics& stats() const
+    {
+        return stats_;
+    }
+
+private:
+
+    struct slot {
+        bool                  used;
+        endpoint_type         from;
+        uint32_t              message;
+        uint16_t              count;
+        uint16_t              arrived;
+        uint32_t              total;
+        uint64_t              started;
+        std::vector<uint64_t> received;  // one bit per fragment
+        std::vector<char>     storage;   // never shrinks, reused by later messages
+
+        slot()
+         : used(false)
+         , message(0)
+         , count(0)
+         , arrived(0)
+         , total(0)
+         , started(0)
+        { }
+    };
+
+    reassembly_config config_;
+    std::vector<slot> slots_;
+    size_t            reserved_;
+    statistics        stats_;
+    Deliver_Type      deliver_;
+
+    void deliver(const endpoint_type& from, boost::asio::const_buffer message)
+    {
+        ++stats_.messages;
+        if (deliver_) {
+            deliver_(from, message);
+        }
+    }
+
+    slot *find(const endpoint_type& from, uint32_t message)
+    {
+        for (slot& s : slots_) {
+            if (s.used && s.message == message && s.from == from) {
+                return &s;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Takes a slot for a new message, evicting the oldest ones if needed
+     */
+    slot *allocate(const fragment_header& header, uint64_t now)
+    {
+        if (header.total > config_.max_memory) {
+            ++stats_.oversized;
+            return nullptr;
+        }
+
+        expire(now);
+        for (;;) {
+            slot *free = nullptr;
+            slot *oldest = nullptr;
+            for (slot& s : slots_) {
+                if (!s.used) {
+                    // the smallest slot big enough, or else the biggest one
+                    if (free == nullptr ||
+                        (free->storage.size() < header.total ?
+                            s.storage.size() > free->storage.size() :
+                            s.storage.size() >= header.total && s.storage.size() < free->storage.size())) {
+                        free = &s;
+                    }
+                } else if (oldest == nullptr || s.started < oldest->started) {
+                    oldest = &s;
+                }
+            }
+
+            if (free != nullptr) {
+                size_t growth = header.total - std::min<size_t>(header.total, free->storage.size());
+                if (reserved_ + growth <= config_.max_memory) {
+                    free->storage.resize(free->storage.size() + growth);
+                    reserved_ += growth;
+                    free->used    = true;
+                    free->count   = header.count;
+                    free->arrived = 0;
+                    free->total   = header.total;
+                    free->started = now;
+                    free->received.assign((header.count + 63) / 64, 0);
+                    return free;
+                }
+
+                bool reclaimed = false;
+                for (slot& s : slots_) {
+                    if (!s.used && &s != free && !s.storage.empty()) {
+                        discard(s);
+                        reclaimed = true;
+                    }
+                }
+                if (reclaimed) {
+                    continue;
+                }
+            }
+
+            if (oldest == nullptr) {
+                // no slots at all
+                return nullptr;
+            }
+            ++stats_.evicted;
+            release(*oldest);
+            discard(*oldest);
+        }
+    }
+
+    void release(slot& s)
+    {
+        s.used = false;
+    }
+
+    /**
+     * Gives the storage of an idle slot back
+     */
+    void discard(slot& s)
+    {
+        reserved_ -= s.storage.size();
+        std::vector<char>().swap(s.storage);
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_fragmentation_hpp__
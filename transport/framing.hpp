@@ -0,0 +1,264 @@
+/**
+ * \file framing.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_framing_hpp__
+#define transport_framing_hpp__
+
+#include "transport/__buffer.hpp"
+#include "transport/buffer_cursor.hpp"
+#include "transport/checksum.hpp"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Parameters of a framed stream, the same on both ends
+ */
+struct framing_config
+{
+    size_t max_frame;  ///< Largest payload accepted
+    bool   checksum;   ///< Frames end with the CRC-32C of their payload
+
+    framing_config()
+     : max_frame(16 << 20)
+     , checksum(true)
+    { }
+};
+
+/**
+ * \brief Writes frames to a stream
+ *
+ * Each frame is its payload preceded by its length, and followed by the
+ * CRC-32C of the payload if so configured, integers in network byte order:
+ * \code
+ *  length(4) payload [crc32c(4)]
+ * \endcode
+ */
+template <
+    class T,
+    size_t Size = 1024>
+class frame_writer
+{
+public:
+    typedef buffer_writer<T, Size>                writer_type;
+    typedef typename buffer<T, Size>::slice_type slice_type;
+
+    static const size_t HEADER_SIZE  = 4;
+    static const size_t TRAILER_SIZE = 4;
+
+    explicit frame_writer(const framing_config& config = framing_config())
+     : config_(config)
+    { }
+
+    /**
+     * \brief Writes a frame carrying the \p size bytes at \p payload
+     */
+    void write(writer_type& out, const void *payload, size_t size) const
+    {
+        out.write_be(uint32_t(size));
+        out.write(payload, size);
+        if (config_.checksum) {
+            out.write_be(crc32c::compute(payload, size));
+        }
+    }
+
+    /**
+     * \brief Writes a frame carrying \p payload, linked to the stream
+     * without copying it
+     */
+    void write(writer_type& out, const slice_type& payload) const
+    {
+        out.write_be(uint32_t(payload.size()));
+        out.write(payload);
+        if (config_.checksum) {
+            out.write_be(crc32c::compute(payload));
+        }
+    }
+
+    /**
+     * \brief Writes a frame whose payload is the \p header_size bytes at
+     * \p header followed by the \p size bytes at \p payload
+     *
+     * For protocols with a header of their own, which need not be copied
+     * in front of the payload first.
+     */
+    void write(writer_type& out,
+               const void *header, size_t header_size,
+               const void *payload, size_t size) const
+    {
+        out.write_be(uint32_t(header_size + size));
+        out.write(header, header_size);
+        out.write(payload, size);
+        if (config_.checksum) {
+            out.write_be(crc32c().update(header, header_size).update(payload, size).value());
+        }
+    }
+
+    /**
+     * \brief Writes a frame whose payload is the \p header_size bytes at
+     * \p header followed by \p payload, linked to the stream
+     */
+    void write(writer_type& out,
+               const void *header, size_t header_size,
+               const slice_type& payload) const
+    {
+        out.write_be(uint32_t(header_size + payload.size()));
+        out.write(header, header_size);
+        out.write(payload);
+        if (config_.checksum) {
+            out.write_be(crc32c().update(header, header_size).update(payload).value());
+        }
+    }
+
+private:
+    framing_config config_;
+};
+
+/**
+ * \brief Cuts a stream written by \c frame_writer back into frames
+ *
+ * Fed the buffer the stream is read into after every read. Payload bytes
+ * are checksummed as soon as they arrive, while the read has just brought
+ * them to the cache, instead of once the whole frame is there; complete
+ * frames are handed out as slices of the buffer, not copied:
+ *
+ * \code
+ *  connection->read_some(65536, incoming, [&](const boost::system::error_code& error, size_t) {
+ *      boost::system::error_code bad = frames.parse(incoming, [&](const buffer_slice<char>& frame) {
+ *          handle(frame);
+ *      });
+ *      if (bad) {
+ *          connection->close();
+ *      }
+ *  });
+ * \endcode
+ *
+ * Not thread safe.
+ */
+template <
+    class T,
+    size_t Size = 1024>
+class frame_reader
+{
+public:
+    static_assert(sizeof(T) == 1, "frame_reader reads bytes");
+
+    typedef buffer<T, Size>                  buffer_type;
+    typedef typename buffer_type::slice_type slice_type;
+
+    static const size_t HEADER_SIZE  = frame_writer<T, Size>::HEADER_SIZE;
+    static const size_t TRAILER_SIZE = frame_writer<T, Size>::TRAILER_SIZE;
+
+    explicit frame_reader(const framing_config& config = framing_config())
+     : config_(config)
+     , in_frame_(false)
+     , length_(0)
+     , checked_(0)
+    { }
+
+    const framing_config& config() const
+    {
+        return config_;
+    }
+
+    /**
+     * \brief Takes every complete frame off the front of \p in
+     *
+     * \param deliver Called once per frame, in order:
+     * \code deliver(payload: const slice_type&) \endcode
+     *
+     * \return \c boost::asio::error::message_size if a frame is larger than
+     * \c max_frame, \c boost::system::errc::bad_message if one was corrupted.
+     * Either way the stream cannot be trusted any longer, frames before the
+     * bad one have been delivered and the bad one is left in \p in.
+     */
+    template <
+        typename Deliver>
+    boost::system::error_code parse(buffer_type& in, Deliver deliver)
+    {
+        for (;;) {
+            if (!in_frame_) {
+                buffer_reader<typename buffer_type::const_buffers_type> reader(in.data());
+                uint32_t length;
+                if (!reader.read_be(length)) {
+                    return boost::system::error_code();
+                }
+                if (length > config_.max_frame) {
+                    return boost::system::error_code(boost::asio::error::message_size);
+                }
+                in_frame_ = true;
+                length_   = length;
+                checked_  = 0;
+                crc_.reset();
+            }
+
+            size_t arrived = std::min(in.size() - HEADER_SIZE, length_);
+            if (config_.checksum && arrived > checked_) {
+                crc_.update(in.data(), HEADER_SIZE + checked_, arrived - checked_);
+                checked_ = arrived;
+            }
+
+            size_t total = HEADER_SIZE + length_ + (config_.checksum ? TRAILER_SIZE : 0);
+            if (in.size() < total) {
+                return boost::system::error_code();
+            }
+            if (config_.checksum) {
+                buffer_reader<typename buffer_type::const_buffers_type> reader(in.data());
+                uint32_t expected = 0;
+                reader.skip(HEADER_SIZE + length_);
+                reader.read_be(expected);
+                if (expected != crc_.value()) {
+                    return boost::system::errc::make_error_code(boost::system::errc::bad_message);
+                }
+            }
+
+            slice_type payload = in.slice(HEADER_SIZE, length_);
+            in.consume(total);
+            in_frame_ = false;
+            deliver(static_cast<const slice_type&>(payload));
+        }
+    }
+
+    /**
+     * \brief Forgets the frame in progress, for a new stream
+     */
+    void reset()
+    {
+        in_frame_ = false;
+    }
+
+private:
+    framing_config config_;
+    bool           in_frame_;  // the header of the frame at the front has been read
+    size_t         length_;
+    size_t         checked_;   // payload bytes in crc_
+    crc32c         crc_;
+};
+
+template <class T, size_t Size>
+const size_t frame_writer<T, Size>::HEADER_SIZE;
+
+template <class T, size_t Size>
+const size_t frame_writer<T, Size>::TRAILER_SIZE;
+
+template <class T, size_t Size>
+const size_t frame_reader<T, Size>::HEADER_SIZE;
+
+template <class T, size_t Size>
+const size_t frame_reader<T, Size>::TRAILER_SIZE;
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_framing_hpp__
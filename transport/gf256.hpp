@@ -0,0 +1,255 @@
+/**
+ * \file gf256.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_gf256_hpp__
+#define transport_gf256_hpp__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+ #define TRANSPORT_GF256_X86 1
+ #include <immintrin.h>
+#endif
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Arithmetic in GF(2^8) with the polynomial 0x11D, as used by Reed-Solomon codes
+ *
+ * Addition is XOR. Multiplying a whole region by a constant, the one
+ * operation that matters for coding, uses the split nibble tables trick
+ * with PSHUFB: 16 or 32 bytes are multiplied with two table lookups. The
+ * fastest implementation supported by the CPU is picked on first use.
+ */
+class gf256
+{
+public:
+    enum implementation {
+        scalar,
+        ssse3,
+        avx2
+    };
+
+    static uint8_t mul(uint8_t a, uint8_t b)
+    {
+        return tables().product[a][b];
+    }
+
+    /**
+     * \pre \p a is not zero
+     */
+    static uint8_t inv(uint8_t a)
+    {
+        const table_set& t = tables();
+        return t.exp[255 - t.log[a]];
+    }
+
+    static uint8_t div(uint8_t a, uint8_t b)
+    {
+        return mul(a, inv(b));
+    }
+
+    /**
+     * \brief <tt>dst[i] ^= src[i]</tt>
+     */
+    static void add_region(uint8_t *dst, const uint8_t *src, size_t size)
+    {
+        size_t i = 0;
+        for ( ; i + 8 <= size; i += 8) {
+            uint64_t a, b;
+            std::memcpy(&a, dst + i, 8);
+            std::memcpy(&b, src + i, 8);
+            a ^= b;
+            std::memcpy(dst + i, &a, 8);
+        }
+        for ( ; i < size; ++i) {
+            dst[i] ^= src[i];
+        }
+    }
+
+    /**
+     * \brief <tt>dst[i] ^= c * src[i]</tt>, with the best implementation available
+     */
+    static void mul_add_region(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size)
+    {
+        if (c == 0) {
+            return;
+        }
+        if (c == 1) {
+            add_region(dst, src, size);
+            return;
+        }
+        mul_add_region(dst, src, c, size, best());
+    }
+
+    /**
+     * \brief <tt>dst[i] ^= c * src[i]</tt> with implementation \p impl, which
+     * must be \c supported()
+     */
+    static void mul_add_region(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size, implementation impl)
+    {
+        switch (impl) {
+#if defined(TRANSPORT_GF256_X86)
+            case avx2:
+                mul_add_avx2(dst, src, c, size);
+                break;
+            case ssse3:
+                mul_add_ssse3(dst, src, c, size);
+                break;
+#endif
+            default:
+                mul_add_scalar(dst, src, c, size);
+                break;
+        }
+    }
+
+    static bool supported(implementation impl)
+    {
+#if defined(TRANSPORT_GF256_X86)
+        switch (impl) {
+            case avx2:
+                return __builtin_cpu_supports("avx2");
+            case ssse3:
+                return __builtin_cpu_supports("ssse3");
+            default:
+                return true;
+        }
+#else
+        return impl == scalar;
+#endif
+    }
+
+    /**
+     * \return The implementation used by \c mul_add_region(), the fastest
+     * one unless another was \c select()ed
+     */
+    static implementation best()
+    {
+        return selected();
+    }
+
+    /**
+     * \brief Makes \c mul_add_region() use \p impl, for benchmarks and tests
+     *
+     * \return \c false if \p impl is not supported by this CPU
+     */
+    static bool select(implementation impl)
+    {
+        if (!supported(impl)) {
+            return false;
+        }
+        selected() = impl;
+        return true;
+    }
+
+    static const char *name(implementation impl)
+    {
+        return impl == avx2 ? "avx2" : impl == ssse3 ? "ssse3" : "scalar";
+    }
+
+private:
+
+    struct table_set {
+        uint8_t exp[512];
+        uint8_t log[256];
+        uint8_t product[256][256];
+        uint8_t low[256][16];   // c * i for every nibble i
+        uint8_t high[256][16];  // c * (i << 4)
+
+        table_set()
+        {
+            unsigned x = 1;
+            for (unsigned i = 0; i < 255; ++i) {
+                exp[i] = exp[i + 255] = uint8_t(x);
+                log[x] = uint8_t(i);
+                x <<= 1;
+                if (x & 0x100) {
+                    x ^= 0x11D;
+                }
+            }
+            exp[510] = exp[511] = exp[0];
+            log[0] = 0;
+
+            for (unsigned a = 0; a < 256; ++a) {
+                for (unsigned b = 0; b < 256; ++b) {
+                    product[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+                }
+                for (unsigned i = 0; i < 16; ++i) {
+                    low[a][i]  = product[a][i];
+                    high[a][i] = product[a][i << 4];
+                }
+            }
+        }
+    };
+
+    static implementation& selected()
+    {
+        static implementation impl = supported(avx2) ? avx2 : supported(ssse3) ? ssse3 : scalar;
+        return impl;
+    }
+
+    static const table_set& tables()
+    {
+        static const table_set t;
+        return t;
+    }
+
+    static void mul_add_scalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size)
+    {
+        const uint8_t *row = tables().product[c];
+        for (size_t i = 0; i < size; ++i) {
+            dst[i] ^= row[src[i]];
+        }
+    }
+
+#if defined(TRANSPORT_GF256_X86)
+    __attribute__((target("ssse3")))
+    static void mul_add_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size)
+    {
+        const table_set& t = tables();
+        const __m128i low  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t.low[c]));
+        const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t.high[c]));
+        const __m128i mask = _mm_set1_epi8(0x0F);
+
+        size_t i = 0;
+        for ( ; i + 16 <= size; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i l = _mm_shuffle_epi8(low, _mm_and_si128(x, mask));
+            __m128i h = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+        }
+        mul_add_scalar(dst + i, src + i, c, size - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void mul_add_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t size)
+    {
+        const table_set& t = tables();
+        const __m256i low  = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t.low[c])));
+        const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t.high[c])));
+        const __m256i mask = _mm256_set1_epi8(0x0F);
+
+        size_t i = 0;
+        for ( ; i + 32 <= size; i += 32) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i l = _mm256_shuffle_epi8(low, _mm256_and_si256(x, mask));
+            __m256i h = _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+        }
+        mul_add_scalar(dst + i, src + i, c, size - i);
+    }
+#endif
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_gf256_hpp__
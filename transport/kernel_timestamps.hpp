@@ -0,0 +1,203 @@
+/**
+ * \file kernel_timestamps.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_kernel_timestamps_hpp__
+#define transport_kernel_timestamps_hpp__
+
+#include <boost/asio/error.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+#if defined(__linux__)
+ #include <sys/socket.h>
+ #include <netinet/in.h>
+ #include <linux/errqueue.h>
+ #include <linux/net_tstamp.h>
+#endif
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Software timestamps taken by the kernel as packets cross the stack
+ *
+ * Receive timestamps are taken when a packet reaches the socket layer, so
+ * comparing them with the time the application sees the data tells the time
+ * spent queued in the socket from the time spent in our own code. Transmit
+ * timestamps are taken when a packet is handed to the driver and come back
+ * through the socket error queue, tagged with a per-socket counter.
+ *
+ * All timestamps are nanoseconds of \c CLOCK_REALTIME, use \c now() to
+ * compare against them. Only Linux is supported, elsewhere nothing is
+ * ever enabled.
+ */
+class kernel_timestamps
+{
+public:
+    enum flags {
+        rx = 1 << 0, ///< Stamp received packets
+        tx = 1 << 1  ///< Report when sent packets leave the stack
+    };
+
+    /**
+     * \return Current time on the clock used by the kernel timestamps
+     */
+    static uint64_t now()
+    {
+        timespec ts;
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+    }
+
+    /**
+     * \brief Enables timestamps on socket \p fd
+     *
+     * SO_TIMESTAMPING is used when available, receive timestamps fall back
+     * to SO_TIMESTAMPNS. Transmit timestamps carry no payload
+     * (\c OPT_TSONLY) and are numbered from zero, one per datagram on UDP
+     * sockets and by byte offset on TCP ones (\c OPT_ID).
+     *
+     * \return The flags actually enabled
+     */
+    static unsigned enable(int fd, unsigned flags)
+    {
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+        int options = SOF_TIMESTAMPING_SOFTWARE;
+        if (flags & rx) {
+            options |= SOF_TIMESTAMPING_RX_SOFTWARE;
+        }
+        if (flags & tx) {
+            options |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        }
+        if (::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &options, sizeof(options)) == 0) {
+            return flags & (rx | tx);
+        }
+        if (flags & rx) {
+            int on = 1;
+            if (::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0) {
+                return rx;
+            }
+        }
+#else
+        (void)fd;
+        (void)flags;
+#endif
+        return 0;
+    }
+
+#if defined(__linux__)
+    /**
+     * \brief Extracts the software timestamp carried by \p cmsg, if any
+     *
+     * \return \c false if \p cmsg is not a timestamp
+     */
+    static bool parse(const cmsghdr *cmsg, uint64_t& timestamp)
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            return false;
+        }
+#if defined(SO_TIMESTAMPING)
+        if (cmsg->cmsg_type == SO_TIMESTAMPING) {
+            timespec stamps[3]; // software, deprecated, hardware
+            std::memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            timestamp = to_nanoseconds(stamps[0]);
+            return timestamp != 0;
+        }
+#endif
+        if (cmsg->cmsg_type == SO_TIMESTAMPNS) {
+            timespec stamp;
+            std::memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            timestamp = to_nanoseconds(stamp);
+            return true;
+        }
+        return false;
+    }
+#endif
+
+    /**
+     * \brief Reads every transmit timestamp queued on \p fd without blocking
+     *
+     * \param handler Called for each one:
+     * \code handler(id: uint32_t, timestamp: uint64_t) \endcode
+     *
+     * \return Number of timestamps read, \p error is \c would_block when
+     * the queue is empty
+     */
+    template <
+        typename Timestamp_Handler>
+    static size_t receive_tx(int fd, Timestamp_Handler handler, boost::system::error_code& error)
+    {
+        size_t count = 0;
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+        for (;;) {
+            union {
+                char    buffer[CONTROL_LENGTH];
+                cmsghdr align;
+            } control;
+
+            msghdr header;
+            std::memset(&header, 0, sizeof(header));
+            header.msg_control    = control.buffer;
+            header.msg_controllen = sizeof(control.buffer);
+
+            if (::recvmsg(fd, &header, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    error = boost::asio::error::would_block;
+                } else {
+                    error = boost::system::error_code(errno, boost::system::system_category());
+                }
+                return count;
+            }
+
+            uint64_t timestamp = 0;
+            const sock_extended_err *extended = nullptr;
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+                if (parse(cmsg, timestamp)) {
+                    continue;
+                }
+                if ((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                    (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                    extended = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+                }
+            }
+
+            if (extended != nullptr &&
+                extended->ee_origin == SO_EE_ORIGIN_TIMESTAMPING &&
+                extended->ee_info == SCM_TSTAMP_SND &&
+                timestamp != 0) {
+                handler(extended->ee_data, timestamp);
+                ++count;
+            }
+        }
+#else
+        (void)fd;
+        (void)handler;
+        error = boost::asio::error::operation_not_supported;
+        return count;
+#endif
+    }
+
+private:
+
+    static const size_t CONTROL_LENGTH = 256;
+
+    static uint64_t to_nanoseconds(const timespec& ts)
+    {
+        return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_kernel_timestamps_hpp__
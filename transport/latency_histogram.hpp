@@ -0,0 +1,165 @@
+/**
+ * \file latency_histogram.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_latency_histogram_hpp__
+#define transport_latency_histogram_hpp__
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Log-linear histogram of latencies, or any other unsigned values
+ *
+ * Values are grouped by their highest set bit and each group is split in
+ * \c 2^SUB_BITS equal buckets, so every value is kept with a relative error
+ * below \c 2^-SUB_BITS (about 3%) whatever its magnitude. Recording is a
+ * couple of shifts and an increment, cheap enough for every datagram.
+ *
+ * Not thread safe: keep one per thread and \c merge() them to report.
+ */
+class latency_histogram
+{
+public:
+    static const unsigned SUB_BITS = 5;
+    static const unsigned SUB_BUCKETS = 1u << SUB_BITS;
+    static const size_t   BUCKETS = (65 - SUB_BITS) * SUB_BUCKETS;
+
+    latency_histogram()
+    {
+        reset();
+    }
+
+    void record(uint64_t value)
+    {
+        ++counts_[index(value)];
+        ++count_;
+        sum_ += value;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const latency_histogram& other)
+    {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_   += other.sum_;
+        min_    = std::min(min_, other.min_);
+        max_    = std::max(max_, other.max_);
+    }
+
+    void reset()
+    {
+        counts_.fill(0);
+        count_ = 0;
+        sum_   = 0;
+        min_   = std::numeric_limits<uint64_t>::max();
+        max_   = 0;
+    }
+
+    uint64_t count() const
+    {
+        return count_;
+    }
+
+    uint64_t min() const
+    {
+        return count_ == 0 ? 0 : min_;
+    }
+
+    uint64_t max() const
+    {
+        return max_;
+    }
+
+    double mean() const
+    {
+        return count_ == 0 ? 0 : double(sum_) / double(count_);
+    }
+
+    /**
+     * \return The value below which \p percentile percent of the samples
+     * fall, rounded up to the end of its bucket but never above \c max()
+     */
+    uint64_t percentile(double percentile) const
+    {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = uint64_t(percentile / 100.0 * double(count_) + 0.5);
+        rank = std::max<uint64_t>(rank, 1);
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(highest(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    /**
+     * \brief Prints count, mean and the usual percentiles of the values
+     * divided by \p scale, e.g. 1000 to print nanoseconds as microseconds
+     */
+    void print(FILE *out, const char *title, double scale = 1) const
+    {
+        fprintf(out, "%-24s n=%-10llu mean=%-10.2f p50=%-10.2f p90=%-10.2f p99=%-10.2f p99.9=%-10.2f max=%.2f\n",
+                title, (unsigned long long)count_, mean() / scale,
+                percentile(50) / scale, percentile(90) / scale,
+                percentile(99) / scale, percentile(99.9) / scale, max() / scale);
+    }
+
+private:
+
+    std::array<uint64_t, BUCKETS> counts_;
+    uint64_t                      count_;
+    uint64_t                      sum_;
+    uint64_t                      min_;
+    uint64_t                      max_;
+
+    static unsigned msb(uint64_t value)
+    {
+        return 63 - unsigned(__builtin_clzll(value));
+    }
+
+    static size_t index(uint64_t value)
+    {
+        if (value < SUB_BUCKETS) {
+            return size_t(value);
+        }
+        unsigned shift = msb(value) - SUB_BITS;
+        return size_t(shift + 1) * SUB_BUCKETS + size_t((value >> shift) - SUB_BUCKETS);
+    }
+
+    /**
+     * Largest value falling in bucket \p i
+     */
+    static uint64_t highest(size_t i)
+    {
+        size_t group = i / SUB_BUCKETS;
+        uint64_t sub = i % SUB_BUCKETS;
+        if (group == 0) {
+            return sub;
+        }
+        unsigned shift = unsigned(group - 1);
+        uint64_t low = (SUB_BUCKETS + sub) << shift;
+        return low + ((uint64_t(1) << shift) - 1);
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_latency_histogram_hpp__
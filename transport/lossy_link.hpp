@@ -0,0 +1,167 @@
+/**
+ * \file lossy_link.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_lossy_link_hpp__
+#define transport_lossy_link_hpp__
+
+#include <boost/asio/buffer.hpp>
+
+#include <cstdint>
+#include <queue>
+#include <random>
+#include <vector>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief In-process datagram link between two sides that drops, delays,
+ * reorders and duplicates packets
+ *
+ * Meant to exercise protocols such as \c reliable_session without a
+ * network: packets handed to \c send() come out of \c deliver() once their
+ * (simulated) time has come. Everything is driven by the caller's clock and
+ * a seeded generator, so a run can be replayed exactly.
+ */
+class lossy_link
+{
+public:
+
+    struct config {
+        double   loss;       ///< Probability of dropping a packet
+        double   duplicate;  ///< Probability of delivering a packet twice
+        uint64_t delay;      ///< One way delay, in the caller's time unit
+        uint64_t jitter;     ///< Extra random delay up to this, reorders packets
+        uint32_t seed;
+
+        config()
+         : loss(0)
+         , duplicate(0)
+         , delay(0)
+         , jitter(0)
+         , seed(1)
+        { }
+    };
+
+    struct statistics {
+        uint64_t sent;
+        uint64_t dropped;
+        uint64_t duplicated;
+        uint64_t delivered;
+    };
+
+    explicit lossy_link(const config& conf = config())
+     : config_(conf)
+     , random_(conf.seed)
+     , order_(0)
+    {
+        stats_ = statistics{ 0, 0, 0, 0 };
+    }
+
+    /**
+     * \brief Sends \p packet at \p now towards side \p to (0 or 1)
+     */
+    void send(int to, boost::asio::const_buffer packet, uint64_t now)
+    {
+        ++stats_.sent;
+        if (chance(config_.loss)) {
+            ++stats_.dropped;
+            return;
+        }
+        enqueue(to, packet, now);
+        if (chance(config_.duplicate)) {
+            ++stats_.duplicated;
+            enqueue(to, packet, now);
+        }
+    }
+
+    /**
+     * \brief Delivers every packet due at or before \p now
+     *
+     * \param handler Called for each one, the packet is only valid during the call:
+     * \code handler(to: int, packet: boost::asio::const_buffer) \endcode
+     * it may send more packets
+     *
+     * \return Number of packets delivered
+     */
+    template <
+        typename Deliver_Handler>
+    size_t deliver(uint64_t now, Deliver_Handler handler)
+    {
+        size_t count = 0;
+        while (!queue_.empty() && queue_.top().time <= now) {
+            in_transit packet = queue_.top();
+            queue_.pop();
+            ++count;
+            ++stats_.delivered;
+            handler(packet.to, boost::asio::const_buffer(packet.data.data(), packet.data.size()));
+        }
+        return count;
+    }
+
+    /**
+     * \return When the next packet is due, zero if there is none in transit
+     */
+    uint64_t next_delivery() const
+    {
+        return queue_.empty() ? 0 : queue_.top().time;
+    }
+
+    size_t in_transit_count() const
+    {
+        return queue_.size();
+    }
+
+    const statistics& stats() const
+    {
+        return stats_;
+    }
+
+private:
+
+    struct in_transit {
+        uint64_t          time;
+        uint64_t          order; // keeps packets due at the same time in send order
+        int               to;
+        std::vector<char> data;
+
+        bool operator>(const in_transit& other) const
+        {
+            return time != other.time ? time > other.time : order > other.order;
+        }
+    };
+
+    config       config_;
+    statistics   stats_;
+    std::mt19937 random_;
+    uint64_t     order_;
+
+    std::priority_queue<in_transit, std::vector<in_transit>, std::greater<in_transit>> queue_;
+
+    bool chance(double probability)
+    {
+        return probability > 0 && std::uniform_real_distribution<double>(0, 1)(random_) < probability;
+    }
+
+    void enqueue(int to, boost::asio::const_buffer packet, uint64_t now)
+    {
+        in_transit t;
+        t.time  = now + config_.delay;
+        t.order = order_++;
+        t.to    = to;
+        if (config_.jitter > 0) {
+            t.time += std::uniform_int_distribution<uint64_t>(0, config_.jitter)(random_);
+        }
+        const char *data = boost::asio::buffer_cast<const char*>(packet);
+        t.data.assign(data, data + boost::asio::buffer_size(packet));
+        queue_.push(std::move(t));
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_lossy_link_hpp__
@@ -0,0 +1,226 @@
+/**
+ * \file magic_ring.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_magic_ring_hpp__
+#define transport_magic_ring_hpp__
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(__linux__)
+ #include <sys/mman.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+#endif
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief A byte ring whose content is always contiguous in memory
+ *
+ * The storage, a memfd, is mapped twice back to back: whatever wraps around
+ * the end of the first mapping continues in the second one, which is the
+ * same memory. \c data() and \c prepare() are therefore single spans at all
+ * times, a parser gets whole frames without copying the ones straddling the
+ * end of the ring.
+ *
+ * Same interface as asio's dynamic buffers, reads go to \c prepare() and
+ * \c commit(), the content is at \c data() until \c consume()d:
+ *
+ * \code
+ *  magic_ring ring(1 << 20);
+ *  size_t n = socket.read_some(ring.prepare(ring.available()));
+ *  ring.commit(n);
+ *  size_t used = parse(ring.begin(), ring.size());
+ *  ring.consume(used);
+ * \endcode
+ *
+ * Linux only.
+ *
+ * Not thread safe.
+ */
+class magic_ring
+{
+public:
+    typedef boost::asio::const_buffer   const_buffers_type;
+    typedef boost::asio::mutable_buffer mutable_buffers_type;
+
+    /**
+     * \brief Maps a ring of at least \p capacity bytes, rounded up to a
+     * power of two multiple of the page size
+     *
+     * \throws boost::system::system_error if the memory cannot be mapped
+     */
+    explicit magic_ring(size_t capacity)
+     : memory_(nullptr)
+     , capacity_(round_capacity(capacity))
+     , head_(0)
+     , tail_(0)
+    {
+        map();
+    }
+
+    ~magic_ring()
+    {
+#if defined(__linux__)
+        ::munmap(memory_, capacity_ * 2);
+#endif
+    }
+
+    /**
+     * \return Bytes in the ring
+     */
+    size_t size() const
+    {
+        return size_t(tail_ - head_);
+    }
+
+    bool empty() const
+    {
+        return head_ == tail_;
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    size_t max_size() const
+    {
+        return capacity_;
+    }
+
+    /**
+     * \return Bytes that can be written before the ring is full
+     */
+    size_t available() const
+    {
+        return capacity_ - size();
+    }
+
+    /**
+     * \return The first byte of the content, \c size() bytes follow it
+     */
+    const char *begin() const
+    {
+        return memory_ + (head_ & (capacity_ - 1));
+    }
+
+    const char *end() const
+    {
+        return begin() + size();
+    }
+
+    const_buffers_type data() const
+    {
+        return const_buffers_type(begin(), size());
+    }
+
+    /**
+     * \return Room for \p count more bytes, made part of the content by
+     * \c commit()
+     *
+     * \throws std::length_error if \p count is more than \c available()
+     */
+    mutable_buffers_type prepare(size_t count)
+    {
+        if (count > available()) {
+            throw std::length_error("magic_ring: prepare beyond capacity");
+        }
+        return mutable_buffers_type(memory_ + (tail_ & (capacity_ - 1)), count);
+    }
+
+    void commit(size_t count)
+    {
+        tail_ += std::min(count, available());
+    }
+
+    void consume(size_t count)
+    {
+        head_ += std::min(count, size());
+    }
+
+    void clear()
+    {
+        head_ = tail_ = 0;
+    }
+
+private:
+    magic_ring(const magic_ring&) = delete;
+    magic_ring& operator=(const magic_ring&) = delete;
+
+    char     *memory_;
+    size_t    capacity_;
+    uint64_t  head_;      // stream positions, masked when used
+    uint64_t  tail_;
+
+    static size_t round_capacity(size_t capacity)
+    {
+#if defined(__linux__)
+        size_t page = size_t(::sysconf(_SC_PAGESIZE));
+#else
+        size_t page = 4096;
+#endif
+        size_t rounded = page;
+        while (rounded < capacity) {
+            rounded *= 2;
+        }
+        return rounded;
+    }
+
+    void map()
+    {
+#if defined(__linux__)
+        int fd = int(::syscall(SYS_memfd_create, "transport_magic_ring", 1 /* MFD_CLOEXEC */));
+        if (fd < 0) {
+            throw boost::system::system_error(errno, boost::system::system_category(), "memfd_create");
+        }
+        if (::ftruncate(fd, off_t(capacity_)) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw boost::system::system_error(error, boost::system::system_category(), "ftruncate");
+        }
+
+        // reserve the address range, then put the two views in it
+        void *reserved = ::mmap(nullptr, capacity_ * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved == MAP_FAILED) {
+            int error = errno;
+            ::close(fd);
+            throw boost::system::system_error(error, boost::system::system_category(), "mmap");
+        }
+        char *base = static_cast<char*>(reserved);
+        for (size_t i = 0; i < 2; ++i) {
+            void *view = ::mmap(base + i * capacity_, capacity_, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_FIXED, fd, 0);
+            if (view == MAP_FAILED) {
+                int error = errno;
+                ::munmap(reserved, capacity_ * 2);
+                ::close(fd);
+                throw boost::system::system_error(error, boost::system::system_category(), "mmap");
+            }
+        }
+        // the mappings keep the memory alive
+        ::close(fd);
+        memory_ = base;
+#else
+        throw boost::system::system_error(boost::asio::error::operation_not_supported,
+                                          "magic_ring needs memfd and mmap");
+#endif
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_magic_ring_hpp__
@@ -0,0 +1,287 @@
+/**
+ * \file mapped_file.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_mapped_file_hpp__
+#define transport_mapped_file_hpp__
+
+#include "transport/__buffer.hpp"
+
+#include <boost/asio/error.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__linux__)
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief A file, or a range of one, mapped read only and handed out as
+ * \c buffer_slice objects
+ *
+ * Slices of the mapping are linked to buffers and written to sockets like
+ * any other, with gathered writes straight from the page cache: nothing is
+ * read into the heap first. The mapping goes away with the file object and
+ * the last slice of it, whichever comes last.
+ *
+ * A write at a time, the next one issued when the previous completes:
+ *
+ * \code
+ *  mapped_file<char> file("capture.bin", mapped_file<char>::sequential);
+ *  std::function<void(size_t)> send = [&](size_t offset) {
+ *      if (offset >= file.size()) {
+ *          return;
+ *      }
+ *      file.prefetch(offset + CHUNK, CHUNK);
+ *      connection->write(file.slice(offset, CHUNK), [&, offset](const boost::system::error_code& error) {
+ *          if (!error) {
+ *              send(offset + CHUNK);
+ *          }
+ *      });
+ *  };
+ *  send(0);
+ * \endcode
+ *
+ * Pages are read in when first touched, by the kernel copying them to the
+ * socket; \c advise() and \c prefetch() tell it what to read ahead of
+ * time. Truncating the file while mapped makes touching the pages beyond
+ * its new end fail with SIGBUS.
+ *
+ * Linux only.
+ */
+template <
+    class T,
+    size_t Size = 1024>
+class mapped_file
+{
+public:
+    static_assert(sizeof(T) == 1, "mapped_file maps bytes");
+
+    typedef buffer_slice<T, Size> slice_type;
+
+    /**
+     * Expected access to the pages, see \c madvise(2)
+     */
+    enum access_pattern {
+        normal,       ///< Some read ahead
+        sequential,   ///< Aggressive read ahead, pages behind may be dropped early
+        random,       ///< No read ahead
+        will_need     ///< Read it all in now
+    };
+
+    /**
+     * \brief Maps the whole file at \p path
+     *
+     * \throws boost::system::system_error if the file cannot be opened or mapped
+     */
+    explicit mapped_file(const std::string& path, access_pattern pattern = sequential)
+     : bucket_(nullptr)
+     , data_(nullptr)
+     , size_(0)
+     , skip_(0)
+    {
+#if defined(__linux__)
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw boost::system::system_error(errno, boost::system::system_category(), "open");
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw boost::system::system_error(error, boost::system::system_category(), "fstat");
+        }
+        try {
+            map(fd, 0, size_t(info.st_size), pattern);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+#else
+        (void)path;
+        (void)pattern;
+        unsupported();
+#endif
+    }
+
+    /**
+     * \brief Maps \p length bytes of the open file \p fd, from \p offset
+     *
+     * The descriptor may be closed afterwards, the mapping stays.
+     *
+     * \throws boost::system::system_error if the range cannot be mapped
+     */
+    mapped_file(int fd, uint64_t offset, size_t length, access_pattern pattern = sequential)
+     : bucket_(nullptr)
+     , data_(nullptr)
+     , size_(0)
+     , skip_(0)
+    {
+#if defined(__linux__)
+        map(fd, offset, length, pattern);
+#else
+        (void)fd;
+        (void)offset;
+        (void)length;
+        (void)pattern;
+        unsupported();
+#endif
+    }
+
+    ~mapped_file()
+    {
+        if (bucket_ != nullptr && bucket_->release()) {
+            bucket::destroy(bucket_);
+        }
+    }
+
+    /**
+     * \return Bytes mapped
+     */
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    /**
+     * \return The mapped bytes, read only
+     */
+    const T *data() const
+    {
+        return data_;
+    }
+
+    /**
+     * \return The \p length bytes starting at \p offset, or as many as there
+     * are, sharing the mapping
+     */
+    slice_type slice(size_t offset = 0, size_t length = size_t(-1)) const
+    {
+        slice_type result;
+        if (offset < size_ && length > 0) {
+            length = std::min(length, size_ - offset);
+            result.add(bucket_, skip_ + offset, skip_ + offset + length);
+        }
+        return result;
+    }
+
+    /**
+     * \brief Tells the kernel how the \p length bytes at \p offset will be
+     * read, all of them by default
+     */
+    void advise(access_pattern pattern, size_t offset = 0, size_t length = size_t(-1))
+    {
+#if defined(__linux__)
+        if (offset >= size_) {
+            return;
+        }
+        length = std::min(length, size_ - offset);
+
+        // madvise() wants whole pages
+        size_t page  = size_t(::sysconf(_SC_PAGESIZE));
+        size_t begin = (skip_ + offset) & ~(page - 1);
+        size_t end   = skip_ + offset + length;
+        ::madvise(const_cast<T*>(data_ - skip_) + begin, end - begin, advice(pattern));
+#else
+        (void)pattern;
+        (void)offset;
+        (void)length;
+#endif
+    }
+
+    /**
+     * \brief Starts reading in the \p length bytes at \p offset, for the
+     * slice about to be written after the current one
+     */
+    void prefetch(size_t offset, size_t length)
+    {
+        advise(will_need, offset, length);
+    }
+
+private:
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    typedef buffer_bucket<T, Size> bucket;
+
+    bucket  *bucket_;  // the mapping, page aligned, referenced by slices too
+    const T *data_;    // the range asked for
+    size_t   size_;
+    size_t   skip_;    // bytes mapped before it, to align the offset
+
+#if defined(__linux__)
+    void map(int fd, uint64_t offset, size_t length, access_pattern pattern)
+    {
+        size_t page    = size_t(::sysconf(_SC_PAGESIZE));
+        uint64_t start = offset & ~uint64_t(page - 1);
+        skip_ = size_t(offset - start);
+        size_ = length;
+        if (length == 0) {
+            // nothing to map, mmap() refuses empty ranges
+            return;
+        }
+
+        void *p = ::mmap(nullptr, skip_ + length, PROT_READ, MAP_SHARED, fd, off_t(start));
+        if (p == MAP_FAILED) {
+            throw boost::system::system_error(errno, boost::system::system_category(), "mmap");
+        }
+        try {
+            bucket_ = bucket::external(static_cast<const T*>(p), skip_ + length, &unmap);
+        } catch (...) {
+            ::munmap(p, skip_ + length);
+            throw;
+        }
+        data_ = static_cast<const T*>(p) + skip_;
+        advise(pattern);
+    }
+
+    static void unmap(const T *p, size_t size)
+    {
+        ::munmap(const_cast<T*>(p), size);
+    }
+
+    static int advice(access_pattern pattern)
+    {
+        switch (pattern) {
+            case sequential:
+                return MADV_SEQUENTIAL;
+            case random:
+                return MADV_RANDOM;
+            case will_need:
+                return MADV_WILLNEED;
+            default:
+                return MADV_NORMAL;
+        }
+    }
+#else
+    static void unsupported()
+    {
+        throw boost::system::system_error(boost::asio::error::operation_not_supported,
+                                          "mapped_file needs mmap");
+    }
+#endif
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_mapped_file_hpp__
@@ -0,0 +1,1005 @@
+/**
+ * \file reliable_session.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_reliable_session_hpp__
+#define transport_reliable_session_hpp__
+
+#include <boost/asio/buffer.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Tunables of a \c reliable_session, both peers must agree on them
+ *
+ * Times are in microseconds, sizes in bytes.
+ */
+struct reliable_config
+{
+    size_t   max_packet;      ///< Largest datagram sent, messages must fit in one
+    size_t   stream_window;   ///< Unacknowledged messages per stream, a power of two
+    size_t   max_streams;     ///< Stream ids go from zero to this, excluded
+    size_t   initial_window;  ///< Congestion window to start with, in packets
+    size_t   minimum_window;  ///< Congestion window never goes below this, in packets
+    uint64_t ack_delay;       ///< Longest an acknowledgement may be held back
+    uint64_t initial_rtt;     ///< Round trip time assumed until measured
+    uint64_t minimum_rto;
+    uint64_t maximum_rto;
+
+    reliable_config()
+     : max_packet(1200)
+     , stream_window(1024)
+     , max_streams(256)
+     , initial_window(10)
+     , minimum_window(2)
+     , ack_delay(1000)
+     , initial_rtt(100000)
+     , minimum_rto(10000)
+     , maximum_rto(2000000)
+    { }
+};
+
+/**
+ * \brief Reliable, ordered delivery of messages over an unreliable datagram link
+ *
+ * A session multiplexes independent streams of messages, each one delivered
+ * in order; a lost packet only holds back the streams it was carrying.
+ *
+ * Every packet gets a new packet number, retransmissions included, and the
+ * receiver acknowledges them with ranges (SACK). A gap of three packets, or
+ * of 9/8 of a round trip, below the highest acknowledged packet counts as a
+ * negative acknowledgement and its messages are sent again in a new packet.
+ * Both thresholds grow whenever a packet declared lost shows up later, so
+ * links that reorder stop triggering needless retransmissions.
+ * Since packet numbers are never reused every acknowledgement yields an
+ * unambiguous RTT sample, which drives the retransmission timeout
+ * (RFC 6298). What is in flight is bounded by a NewReno style congestion
+ * window and by \c reliable_config::stream_window on each stream.
+ *
+ * The session does no I/O and reads no clock: datagrams are fed to
+ * \c receive(), packets to send come out of \c poll(), and the owner calls
+ * \c poll() again at \c next_timeout(). See \c reliable_udp_session for one
+ * driven by a \c udp_connection.
+ *
+ * Wire format, integers in network byte order:
+ * \code
+ *  packet: version(1) number(4) frame...
+ *  ack:    0x01 largest(4) delay_us(2) ranges(1) first_length(2) [gap(2) length(2)]...
+ *  stream: 0x02 stream(2) sequence(4) length(2) payload
+ * \endcode
+ *
+ * Not thread safe.
+ */
+class reliable_session
+{
+public:
+    typedef std::function<void(uint16_t, boost::asio::const_buffer)> Deliver_Type;
+
+    static const uint8_t VERSION = 1;
+
+    /**
+     * Most acknowledgement ranges kept and sent back to the peer
+     */
+    static const size_t MAX_ACK_RANGES = 32;
+
+    struct statistics {
+        uint64_t packets_sent;
+        uint64_t packets_received;
+        uint64_t messages_sent;
+        uint64_t messages_delivered;
+        uint64_t retransmissions;  ///< Messages sent again
+        uint64_t lost;             ///< Packets declared lost
+        uint64_t spurious;         ///< Packets declared lost and then acknowledged
+        uint64_t timeouts;         ///< Retransmission timeouts
+        uint64_t duplicates;       ///< Messages received more than once
+        uint64_t malformed;        ///< Packets dropped because they could not be parsed or named a stream beyond the limit
+    };
+
+    /**
+     * \throw std::invalid_argument If the stream window is not a power of two
+     * or \p config allows no streams
+     */
+    explicit reliable_session(const reliable_config& config = reliable_config())
+     : config_(config)
+     , mask_(config.stream_window - 1)
+     , next_packet_(0)
+     , largest_acked_(0)
+     , acked_any_(false)
+     , in_flight_(0)
+     , window_(config.initial_window * config.max_packet)
+     , threshold_(std::numeric_limits<size_t>::max())
+     , recovery_(0)
+     , srtt_(0)
+     , rttvar_(0)
+     , latest_rtt_(0)
+     , min_rtt_(0)
+     , backoff_(0)
+     , timer_start_(0)
+     , probe_(false)
+     , loss_time_(0)
+     , reordering_(3)
+     , time_eighths_(9)
+     , largest_received_(0)
+     , largest_received_time_(0)
+     , received_any_(false)
+     , unacked_(0)
+     , ack_deadline_(0)
+     , ack_now_(false)
+    {
+        if (config.stream_window == 0 || (config.stream_window & (config.stream_window - 1)) != 0) {
+            throw std::invalid_argument("reliable_config: stream_window must be a power of two");
+        }
+        if (config.max_streams == 0 || config.max_streams > 65536) {
+            throw std::invalid_argument("reliable_config: max_streams must be 1 to 65536");
+        }
+        std::memset(&stats_, 0, sizeof(stats_));
+        packet_.reserve(config_.max_packet);
+    }
+
+    /**
+     * \brief Sets the function receiving messages, in order within each stream
+     *
+     * \code deliver(stream: uint16_t, message: boost::asio::const_buffer) \endcode
+     * The message is only valid during the call.
+     */
+    void on_deliver(Deliver_Type deliver)
+    {
+        deliver_ = std::move(deliver);
+    }
+
+    /**
+     * \brief Largest message \c send() accepts
+     */
+    size_t max_message() const
+    {
+        return config_.max_packet - PACKET_HEADER - STREAM_HEADER;
+    }
+
+    /**
+     * \brief Queues \p message on \p stream, it goes out on the next \c poll()
+     *
+     * \return \c false if the message is larger than \c max_message(), the
+     * stream id is not below \c reliable_config::max_streams or the stream
+     * window is full, try again once \c writable()
+     */
+    bool send(uint16_t stream_id, boost::asio::const_buffer message)
+    {
+        size_t size = boost::asio::buffer_size(message);
+        if (size > max_message() || stream_id >= config_.max_streams) {
+            return false;
+        }
+        stream& s = get_stream(stream_id);
+        if (!writable(s)) {
+            return false;
+        }
+        if (s.outgoing_ring.empty()) {
+            s.outgoing_ring.resize(config_.stream_window);
+        }
+
+        outgoing& o = s.outgoing_ring[s.send_next & mask_];
+        const char *data = boost::asio::buffer_cast<const char*>(message);
+        o.data.assign(data, data + size);
+        o.acked = false;
+        ++s.send_next;
+
+        if (!s.ready) {
+            s.ready = true;
+            ready_.push_back(&s);
+        }
+        return true;
+    }
+
+    /**
+     * \return \c true if \c send() would accept a message for \p stream
+     */
+    bool writable(uint16_t stream_id)
+    {
+        return stream_id < config_.max_streams && writable(get_stream(stream_id));
+    }
+
+    /**
+     * \brief Processes a datagram from the peer received at \p now
+     */
+    void receive(boost::asio::const_buffer datagram, uint64_t now)
+    {
+        const uint8_t *p   = boost::asio::buffer_cast<const uint8_t*>(datagram);
+        const uint8_t *end = p + boost::asio::buffer_size(datagram);
+
+        if (end - p < int(PACKET_HEADER) || p[0] != VERSION) {
+            ++stats_.malformed;
+            return;
+        }
+        uint64_t number = expand(read32(p + 1), received_any_ ? largest_received_ + 1 : 0);
+        p += PACKET_HEADER;
+
+        bool eliciting = false;
+        bool accepted  = true;
+        while (p < end) {
+            if (p[0] == ACK_FRAME) {
+                p = receive_ack(p, end, now);
+            } else if (p[0] == STREAM_FRAME) {
+                p = receive_stream(p, end, accepted);
+                eliciting = true;
+            } else {
+                p = nullptr;
+            }
+            if (p == nullptr) {
+                ++stats_.malformed;
+                return;
+            }
+        }
+
+        ++stats_.packets_received;
+        if (accepted) {
+            record(number, eliciting, now);
+        }
+    }
+
+    /**
+     * \brief Runs timers due at \p now and hands packets ready to go to \p out
+     *
+     * \param out Called for every packet, which is only valid during the call:
+     * \code out(packet: boost::asio::const_buffer) \endcode
+     *
+     * \return Number of packets sent
+     */
+    template <
+        typename Output>
+    size_t poll(uint64_t now, Output out)
+    {
+        if (loss_time_ != 0 && now >= loss_time_) {
+            detect_losses(now);
+        }
+        sent_packet *oldest = oldest_in_flight();
+        if (oldest != nullptr && now >= rto_deadline(*oldest)) {
+            retransmission_timeout(*oldest, now);
+        }
+        pop_settled(now);
+
+        size_t packets = 0;
+        for (;;) {
+            packet_.clear();
+            put8(VERSION);
+            put32(uint32_t(next_packet_));
+
+            if (ack_now_ || (unacked_ > 0 && now >= ack_deadline_)) {
+                write_ack(now);
+            }
+
+            sent_packet record;
+            if (in_flight_ + config_.max_packet <= window_ || in_flight_ == 0 || probe_) {
+                record.frames = take_spare();
+                write_frames(record.frames);
+            }
+
+            if (record.frames.empty() && unacked_ > 0 && !(retransmit_.empty() && ready_.empty())) {
+                // the ack left no room, send it alone and the data right after
+                write_ack(now);
+            }
+
+            if (packet_.size() == PACKET_HEADER) {
+                give_spare(std::move(record.frames));
+                break;
+            }
+
+            bool eliciting = !record.frames.empty();
+            if (eliciting && unacked_ > 0) {
+                // piggyback whatever is pending, the frame fits since
+                // write_frames() leaves room for it
+                write_ack(now);
+            }
+
+            // acks only are recorded too, the deque is indexed by number
+            record.number    = next_packet_;
+            record.time      = now;
+            record.bytes     = uint32_t(packet_.size());
+            record.in_flight = eliciting;
+            record.lost      = false;
+            if (eliciting) {
+                in_flight_ += record.bytes;
+                probe_ = false;
+            }
+            sent_.push_back(std::move(record));
+            pop_settled(now);
+
+            ++next_packet_;
+            ++packets;
+            ++stats_.packets_sent;
+            out(boost::asio::const_buffer(packet_.data(), packet_.size()));
+        }
+        return packets;
+    }
+
+    /**
+     * \return The time at which \c poll() must be called again, zero if
+     * there is nothing to wait for
+     */
+    uint64_t next_timeout() const
+    {
+        uint64_t deadline = 0;
+        if (unacked_ > 0) {
+            deadline = ack_deadline_;
+        }
+        if (loss_time_ != 0) {
+            deadline = deadline == 0 ? loss_time_ : std::min(deadline, loss_time_);
+        }
+        if (const sent_packet *oldest = oldest_in_flight()) {
+            uint64_t rto = rto_deadline(*oldest);
+            deadline = deadline == 0 ? rto : std::min(deadline, rto);
+        }
+        return deadline;
+    }
+
+    /**
+     * \return \c true when every message sent has been acknowledged
+     */
+    bool idle() const
+    {
+        return oldest_in_flight() == nullptr && retransmit_.empty() && ready_.empty();
+    }
+
+    const statistics& stats() const
+    {
+        return stats_;
+    }
+
+    /**
+     * \return Smoothed round trip time, in microseconds
+     */
+    uint64_t rtt() const
+    {
+        return srtt_ == 0 ? config_.initial_rtt : srtt_;
+    }
+
+    /**
+     * \return Congestion window, in bytes
+     */
+    size_t window() const
+    {
+        return window_;
+    }
+
+    /**
+     * \return Bytes sent and neither acknowledged nor lost
+     */
+    size_t in_flight() const
+    {
+        return in_flight_;
+    }
+
+private:
+
+    static const uint8_t ACK_FRAME     = 0x01;
+    static const uint8_t STREAM_FRAME  = 0x02;
+    static const size_t  PACKET_HEADER = 5;
+    static const size_t  STREAM_HEADER = 9;
+    static const size_t  ACK_HEADER    = 10;
+    static const size_t  ACK_RANGE     = 4;
+    static const uint64_t MAX_REORDERING  = 64;
+    static const unsigned MAX_TIME_EIGHTHS = 16;
+
+    struct outgoing {
+        std::vector<char> data;
+        bool              acked;
+    };
+
+    struct incoming {
+        std::vector<char> data;
+        bool              present;
+    };
+
+    struct stream {
+        uint16_t              id;
+        bool                  ready;         // in ready_
+        uint32_t              send_base;     // oldest unacknowledged
+        uint32_t              send_unsent;   // oldest never sent
+        uint32_t              send_next;     // next to be queued
+        uint32_t              receive_next;  // next to be delivered
+        std::vector<outgoing> outgoing_ring;
+        std::vector<incoming> incoming_ring;
+    };
+
+    struct frame_ref {
+        stream  *s;
+        uint32_t sequence;
+    };
+
+    struct sent_packet {
+        uint64_t               number;
+        uint64_t               time;
+        uint32_t               bytes;
+        bool                   in_flight; // neither acknowledged nor lost
+        bool                   lost;      // may still be acknowledged if it was only late
+        std::vector<frame_ref> frames;
+    };
+
+    struct range {
+        uint64_t low;
+        uint64_t high;
+    };
+
+    reliable_config config_;
+    uint32_t        mask_;
+    statistics      stats_;
+    Deliver_Type    deliver_;
+
+    std::unordered_map<uint16_t, stream> streams_; // nodes never move
+    std::deque<stream*>                  ready_;   // streams with unsent messages
+    std::deque<frame_ref>                retransmit_;
+
+    // sender
+    std::deque<sent_packet>             sent_;    // ordered by number, front is in flight
+    std::vector<std::vector<frame_ref>> spare_;   // recycled frame lists
+    uint64_t next_packet_;
+    uint64_t largest_acked_;
+    bool     acked_any_;
+    size_t   in_flight_;
+    size_t   window_;
+    size_t   threshold_;   // slow start threshold
+    uint64_t recovery_;    // packets up to this one do not shrink the window again
+    uint64_t srtt_;
+    uint64_t rttvar_;
+    uint64_t latest_rtt_;
+    uint64_t min_rtt_;
+    unsigned backoff_;
+    uint64_t timer_start_; // the timeout counts from here or the oldest packet, whichever is later
+    bool     probe_;
+    uint64_t loss_time_;
+    uint64_t reordering_;   // packets below the largest acknowledged one before declaring loss
+    unsigned time_eighths_; // same in eighths of a round trip
+
+    // receiver
+    std::vector<range> ranges_;   // received packets, highest first
+    uint64_t largest_received_;
+    uint64_t largest_received_time_;
+    bool     received_any_;
+    size_t   unacked_;            // eliciting packets not acknowledged yet
+    uint64_t ack_deadline_;
+    bool     ack_now_;
+
+    std::vector<char> packet_;
+
+    stream& get_stream(uint16_t id)
+    {
+        auto it = streams_.find(id);
+        if (it == streams_.end()) {
+            stream& s = streams_[id];
+            s.id           = id;
+            s.ready        = false;
+            s.send_base    = 0;
+            s.send_unsent  = 0;
+            s.send_next    = 0;
+            s.receive_next = 0;
+            // the rings are allocated on first use, by send() and receive_stream()
+            return s;
+        }
+        return it->second;
+    }
+
+    bool writable(const stream& s) const
+    {
+        return s.send_next - s.send_base < config_.stream_window;
+    }
+
+    static bool acked(const stream& s, uint32_t sequence, uint32_t mask)
+    {
+        return int32_t(sequence - s.send_base) < 0 || s.outgoing_ring[sequence & mask].acked;
+    }
+
+    /*
+     * Sending
+     */
+
+    void put8(uint8_t value)
+    {
+        packet_.push_back(char(value));
+    }
+
+    void put16(uint16_t value)
+    {
+        put8(uint8_t(value >> 8));
+        put8(uint8_t(value));
+    }
+
+    void put32(uint32_t value)
+    {
+        put16(uint16_t(value >> 16));
+        put16(uint16_t(value));
+    }
+
+    size_t ack_size() const
+    {
+        return ACK_HEADER + ACK_RANGE * (std::min(ranges_.size(), size_t(MAX_ACK_RANGES)) - 1);
+    }
+
+    void write_ack(uint64_t now)
+    {
+        uint64_t delay = now > largest_received_time_ ? now - largest_received_time_ : 0;
+        const range& first = ranges_.front();
+
+        put8(ACK_FRAME);
+        put32(uint32_t(first.high));
+        put16(uint16_t(std::min<uint64_t>(delay, 0xFFFF)));
+        size_t count_at = packet_.size();
+        put8(1);
+        put16(uint16_t(std::min<uint64_t>(first.high - first.low, 0xFFFF)));
+
+        uint8_t count = 1;
+        uint64_t smallest = first.low;
+        for (size_t i = 1; i < ranges_.size() && i < MAX_ACK_RANGES; ++i) {
+            uint64_t gap    = smallest - ranges_[i].high - 2;
+            uint64_t length = ranges_[i].high - ranges_[i].low;
+            if (first.high - first.low > 0xFFFF || gap > 0xFFFF || length > 0xFFFF) {
+                break;
+            }
+            put16(uint16_t(gap));
+            put16(uint16_t(length));
+            smallest = ranges_[i].low;
+            ++count;
+        }
+        packet_[count_at] = char(count);
+
+        unacked_ = 0;
+        ack_now_ = false;
+    }
+
+    /**
+     * Fills the packet with retransmissions first, then new messages taken
+     * round robin from the ready streams
+     */
+    void write_frames(std::vector<frame_ref>& frames)
+    {
+        size_t limit = config_.max_packet - (unacked_ > 0 ? ack_size() : 0);
+
+        while (!retransmit_.empty()) {
+            frame_ref f = retransmit_.front();
+            if (acked(*f.s, f.sequence, mask_)) {
+                retransmit_.pop_front();
+                continue;
+            }
+            if (!write_stream(*f.s, f.sequence, limit)) {
+                return;
+            }
+            retransmit_.pop_front();
+            frames.push_back(f);
+            ++stats_.retransmissions;
+        }
+
+        while (!ready_.empty()) {
+            stream& s = *ready_.front();
+            if (!write_stream(s, s.send_unsent, limit)) {
+                return;
+            }
+            frames.push_back(frame_ref{&s, s.send_unsent});
+            ++s.send_unsent;
+            ++stats_.messages_sent;
+
+            ready_.pop_front();
+            if (s.send_unsent != s.send_next) {
+                ready_.push_back(&s);
+            } else {
+                s.ready = false;
+            }
+        }
+    }
+
+    bool write_stream(const stream& s, uint32_t sequence, size_t limit)
+    {
+        const std::vector<char>& data = s.outgoing_ring[sequence & mask_].data;
+        if (packet_.size() + STREAM_HEADER + data.size() > limit) {
+            return false;
+        }
+        put8(STREAM_FRAME);
+        put16(s.id);
+        put32(sequence);
+        put16(uint16_t(data.size()));
+        packet_.insert(packet_.end(), data.begin(), data.end());
+        return true;
+    }
+
+    std::vector<frame_ref> take_spare()
+    {
+        if (spare_.empty()) {
+            return std::vector<frame_ref>();
+        }
+        std::vector<frame_ref> frames = std::move(spare_.back());
+        spare_.pop_back();
+        return frames;
+    }
+
+    void give_spare(std::vector<frame_ref> frames)
+    {
+        if (frames.capacity() == 0) {
+            return;
+        }
+        frames.clear();
+        spare_.push_back(std::move(frames));
+    }
+
+    /*
+     * Receiving
+     */
+
+    static uint16_t read16(const uint8_t *p)
+    {
+        return uint16_t((p[0] << 8) | p[1]);
+    }
+
+    static uint32_t read32(const uint8_t *p)
+    {
+        return (uint32_t(read16(p)) << 16) | read16(p + 2);
+    }
+
+    /**
+     * Recovers a full packet number from its low 32 bits, taking the one
+     * closest to \p expected
+     */
+    static uint64_t expand(uint32_t truncated, uint64_t expected)
+    {
+        const uint64_t window = uint64_t(1) << 32;
+        uint64_t candidate = (expected & ~(window - 1)) | truncated;
+        if (candidate + window / 2 <= expected) {
+            candidate += window;
+        } else if (candidate > expected + window / 2 && candidate >= window) {
+            candidate -= window;
+        }
+        return candidate;
+    }
+
+    const uint8_t* receive_stream(const uint8_t *p, const uint8_t *end, bool& accepted)
+    {
+        if (end - p < int(STREAM_HEADER)) {
+            return nullptr;
+        }
+        uint16_t id       = read16(p + 1);
+        uint32_t sequence = read32(p + 3);
+        size_t   length   = read16(p + 7);
+        p += STREAM_HEADER;
+        if (size_t(end - p) < length || id >= config_.max_streams) {
+            // a stream beyond the limit is as bad as a truncated frame, it
+            // would cost the memory of its ring
+            return nullptr;
+        }
+
+        stream& s = get_stream(id);
+        if (s.incoming_ring.empty()) {
+            s.incoming_ring.resize(config_.stream_window);
+        }
+        int32_t ahead = int32_t(sequence - s.receive_next);
+        if (ahead < 0) {
+            ++stats_.duplicates;
+        } else if (uint32_t(ahead) >= config_.stream_window) {
+            // the peer overran the window, do not acknowledge the packet
+            accepted = false;
+        } else if (ahead > 0 && s.incoming_ring[sequence & mask_].present) {
+            ++stats_.duplicates;
+        } else if (ahead == 0) {
+            ++s.receive_next;
+            deliver(s.id, boost::asio::const_buffer(p, length));
+            for (incoming *next = &s.incoming_ring[s.receive_next & mask_];
+                 next->present;
+                 next = &s.incoming_ring[s.receive_next & mask_]) {
+                next->present = false;
+                ++s.receive_next;
+                deliver(s.id, boost::asio::const_buffer(next->data.data(), next->data.size()));
+            }
+        } else {
+            incoming& in = s.incoming_ring[sequence & mask_];
+            in.data.assign(p, p + length);
+            in.present = true;
+        }
+        return p + length;
+    }
+
+    void deliver(uint16_t id, boost::asio::const_buffer message)
+    {
+        ++stats_.messages_delivered;
+        if (deliver_) {
+            deliver_(id, message);
+        }
+    }
+
+    /**
+     * Adds \p number to the received ranges and decides when to acknowledge
+     */
+    void record(uint64_t number, bool eliciting, uint64_t now)
+    {
+        bool in_order = !received_any_ || number == largest_received_ + 1;
+        if (!received_any_ || number > largest_received_) {
+            largest_received_      = number;
+            largest_received_time_ = now;
+            received_any_          = true;
+        }
+
+        size_t i = 0;
+        while (i < ranges_.size() && ranges_[i].low > number + 1) {
+            ++i;
+        }
+        if (i < ranges_.size() && ranges_[i].low <= number + 1 && ranges_[i].high + 1 >= number) {
+            if (number >= ranges_[i].low && number <= ranges_[i].high) {
+                return; // duplicate packet
+            }
+            ranges_[i].low  = std::min(ranges_[i].low, number);
+            ranges_[i].high = std::max(ranges_[i].high, number);
+            if (i + 1 < ranges_.size() && ranges_[i + 1].high + 1 >= ranges_[i].low) {
+                ranges_[i].low = ranges_[i + 1].low;
+                ranges_.erase(ranges_.begin() + i + 1);
+            }
+        } else {
+            ranges_.insert(ranges_.begin() + i, range{number, number});
+            if (ranges_.size() > MAX_ACK_RANGES) {
+                ranges_.pop_back();
+            }
+        }
+
+        if (!eliciting) {
+            return;
+        }
+        if (unacked_++ == 0) {
+            ack_deadline_ = now + config_.ack_delay;
+        }
+        if (!in_order || unacked_ >= 2) {
+            ack_now_ = true;
+        }
+    }
+
+    const uint8_t* receive_ack(const uint8_t *p, const uint8_t *end, uint64_t now)
+    {
+        if (end - p < int(ACK_HEADER)) {
+            return nullptr;
+        }
+        uint64_t largest = expand(read32(p + 1), next_packet_ == 0 ? 0 : next_packet_ - 1);
+        uint64_t delay   = read16(p + 5);
+        size_t   count   = p[7];
+        uint64_t length  = read16(p + 8);
+        p += ACK_HEADER;
+        if (count == 0 || size_t(end - p) < ACK_RANGE * (count - 1) || largest >= next_packet_ || length > largest) {
+            return nullptr;
+        }
+
+        bool newly_acked = false;
+        uint64_t high = largest;
+        uint64_t low  = largest - length;
+        for (size_t i = 0; ; ) {
+            newly_acked |= acknowledge(low, high, largest, delay, now);
+            if (++i == count) {
+                break;
+            }
+            uint64_t gap = read16(p);
+            length       = read16(p + 2);
+            p += ACK_RANGE;
+            if (low < gap + 2 + length) {
+                return nullptr;
+            }
+            high = low - gap - 2;
+            low  = high - length;
+        }
+
+        if (!acked_any_ || largest > largest_acked_) {
+            largest_acked_ = largest;
+            acked_any_     = true;
+        }
+        if (newly_acked) {
+            backoff_     = 0;
+            timer_start_ = now;
+            detect_losses(now);
+            pop_settled(now);
+        }
+        return p;
+    }
+
+    /**
+     * Marks the packets in [low, high] as received by the peer
+     */
+    bool acknowledge(uint64_t low, uint64_t high, uint64_t largest, uint64_t delay, uint64_t now)
+    {
+        if (sent_.empty() || high < sent_.front().number) {
+            return false;
+        }
+        uint64_t base  = sent_.front().number;
+        uint64_t first = std::max(low, base);
+        uint64_t last  = std::min(high, base + sent_.size() - 1);
+
+        bool newly_acked = false;
+        for (uint64_t number = first; number <= last; ++number) {
+            sent_packet& packet = sent_[size_t(number - base)];
+            if (packet.lost) {
+                // it was just reordered, be more patient from now on
+                packet.lost = false;
+                ++stats_.spurious;
+                reordering_   = std::min(std::max(reordering_, largest - number + 1), uint64_t(MAX_REORDERING));
+                time_eighths_ = std::min(time_eighths_ + 2, unsigned(MAX_TIME_EIGHTHS));
+
+                // its messages got through, their retransmissions need not go out
+                for (const frame_ref& f : packet.frames) {
+                    acknowledge(*f.s, f.sequence);
+                }
+            }
+            if (!packet.in_flight) {
+                continue;
+            }
+            packet.in_flight = false;
+            in_flight_ -= packet.bytes;
+            newly_acked = true;
+
+            if (number == largest) {
+                sample_rtt(now - packet.time, delay);
+            }
+            for (const frame_ref& f : packet.frames) {
+                acknowledge(*f.s, f.sequence);
+            }
+            grow_window(packet);
+        }
+        return newly_acked;
+    }
+
+    void acknowledge(stream& s, uint32_t sequence)
+    {
+        if (acked(s, sequence, mask_)) {
+            return;
+        }
+        s.outgoing_ring[sequence & mask_].acked = true;
+        while (s.send_base != s.send_unsent && s.outgoing_ring[s.send_base & mask_].acked) {
+            s.outgoing_ring[s.send_base & mask_].data.clear();
+            ++s.send_base;
+        }
+    }
+
+    void sample_rtt(uint64_t sample, uint64_t delay)
+    {
+        latest_rtt_ = sample;
+        if (min_rtt_ == 0 || sample < min_rtt_) {
+            min_rtt_ = sample;
+        }
+        if (sample >= min_rtt_ + delay) {
+            sample -= delay; // time the peer held the ack back
+        }
+        if (srtt_ == 0) {
+            srtt_   = std::max<uint64_t>(sample, 1);
+            rttvar_ = sample / 2;
+        } else {
+            uint64_t deviation = srtt_ > sample ? srtt_ - sample : sample - srtt_;
+            rttvar_ = (3 * rttvar_ + deviation) / 4;
+            srtt_   = std::max<uint64_t>((7 * srtt_ + sample) / 8, 1);
+        }
+    }
+
+    uint64_t rto() const
+    {
+        uint64_t base = srtt_ == 0 ? 2 * config_.initial_rtt : srtt_ + std::max<uint64_t>(4 * rttvar_, 1000);
+        base = std::max(base + config_.ack_delay, config_.minimum_rto);
+        return std::min(base << std::min(backoff_, 16u), config_.maximum_rto);
+    }
+
+    uint64_t rto_deadline(const sent_packet& oldest) const
+    {
+        return std::max(oldest.time, timer_start_) + rto();
+    }
+
+    void grow_window(const sent_packet& packet)
+    {
+        if (packet.number <= recovery_ && recovery_ != 0) {
+            return;
+        }
+        if (window_ < threshold_) {
+            window_ += packet.bytes;
+        } else {
+            window_ += std::max<size_t>(config_.max_packet * packet.bytes / window_, 1);
+        }
+    }
+
+    /**
+     * Declares lost what is too far below the largest acknowledged packet
+     * and schedules the timer for what may soon be
+     */
+    void detect_losses(uint64_t now)
+    {
+        loss_time_ = 0;
+        if (!acked_any_) {
+            return;
+        }
+
+        uint64_t delay = std::max<uint64_t>(time_eighths_ * std::max(srtt_, latest_rtt_) / 8, 1000);
+        for (sent_packet& packet : sent_) {
+            if (packet.number >= largest_acked_) {
+                break;
+            }
+            if (!packet.in_flight) {
+                continue;
+            }
+            if (largest_acked_ - packet.number >= reordering_ || packet.time + delay <= now) {
+                lose(packet);
+            } else if (loss_time_ == 0 || packet.time + delay < loss_time_) {
+                loss_time_ = packet.time + delay;
+            }
+        }
+    }
+
+    /**
+     * Only the oldest packet is sent again, the rest are most likely fine
+     * and just waiting on an ack that got lost, which the new packet elicits
+     */
+    void retransmission_timeout(sent_packet& oldest, uint64_t now)
+    {
+        ++stats_.timeouts;
+        lose(oldest);
+        timer_start_ = now;
+        probe_       = true; // goes out even if the window is full
+
+        if (backoff_ > 0) {
+            // nothing got through for two timeouts in a row, start over;
+            // a single one is usually a lost tail and lose() already halved
+            threshold_ = std::max(window_ / 2, config_.minimum_window * config_.max_packet);
+            window_    = config_.minimum_window * config_.max_packet;
+            recovery_  = next_packet_;
+        }
+        ++backoff_;
+    }
+
+    void lose(sent_packet& packet)
+    {
+        packet.in_flight = false;
+        packet.lost      = true;
+        in_flight_ -= packet.bytes;
+        ++stats_.lost;
+
+        for (const frame_ref& f : packet.frames) {
+            if (!acked(*f.s, f.sequence, mask_)) {
+                retransmit_.push_back(f);
+            }
+        }
+
+        if (packet.number > recovery_ || recovery_ == 0) {
+            // one reduction per round trip
+            window_    = std::max(window_ / 2, config_.minimum_window * config_.max_packet);
+            threshold_ = window_;
+            recovery_  = next_packet_;
+        }
+    }
+
+    sent_packet* oldest_in_flight()
+    {
+        for (sent_packet& packet : sent_) {
+            if (packet.in_flight) {
+                return &packet;
+            }
+        }
+        return nullptr;
+    }
+
+    const sent_packet* oldest_in_flight() const
+    {
+        return const_cast<reliable_session*>(this)->oldest_in_flight();
+    }
+
+    /**
+     * Forgets settled packets, the lost ones a bit later in case they were
+     * only reordered and get acknowledged after all
+     */
+    void pop_settled(uint64_t now)
+    {
+        while (!sent_.empty() && !sent_.front().in_flight &&
+               (!sent_.front().lost || sent_.front().time + 2 * rtt() <= now)) {
+            give_spare(std::move(sent_.front().frames));
+            sent_.pop_front();
+        }
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_reliable_session_hpp__
@@ -0,0 +1,193 @@
+/**
+ * \file reliable_udp.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_reliable_udp_hpp__
+#define transport_reliable_udp_hpp__
+
+#include "transport/reliable_session.hpp"
+#include "transport/udp_connection.hpp"
+
+#include <boost/asio/steady_timer.hpp>
+
+#include <chrono>
+#include <memory>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief A \c reliable_session talking to one peer through a \c udp_connection
+ *
+ * Sends, receives and timers all run on the connection's io_service and
+ * every method must be called from it. Messages passed to \c send() within
+ * the same handler are coalesced into as few packets as possible.
+ *
+ * The connection may be shared with other peers: datagrams from this one
+ * are fed to \c receive(), which also makes this class usable as the
+ * \c Session of a \c udp_session_server (derive to set the deliver handler).
+ * When the connection only talks to this peer \c start() runs the receive
+ * loop instead.
+ */
+class reliable_udp_session
+{
+public:
+    typedef udp_connection::endpoint_type  endpoint_type;
+    typedef reliable_session::Deliver_Type Deliver_Type;
+    typedef std::chrono::steady_clock      clock;
+
+    reliable_udp_session(udp_connection& connection,
+                         const endpoint_type& peer,
+                         const reliable_config& config = reliable_config())
+     : connection_(connection)
+     , peer_(peer)
+     , session_(config)
+     , timer_(connection.get_io_service())
+     , epoch_(clock::now())
+     , deadline_(0)
+     , flush_posted_(false)
+     , alive_(std::make_shared<char>(0))
+    { }
+
+    ~reliable_udp_session()
+    {
+        boost::system::error_code ignored;
+        timer_.cancel(ignored);
+    }
+
+    /**
+     * \see reliable_session::on_deliver
+     */
+    void on_deliver(Deliver_Type deliver)
+    {
+        session_.on_deliver(std::move(deliver));
+    }
+
+    /**
+     * \brief Queues \p message on \p stream
+     *
+     * \return \c false if the message is too large or the stream window is full
+     *
+     * \see reliable_session::send
+     */
+    bool send(uint16_t stream, boost::asio::const_buffer message)
+    {
+        if (!session_.send(stream, message)) {
+            return false;
+        }
+        if (!flush_posted_) {
+            flush_posted_ = true;
+            std::weak_ptr<char> alive = alive_;
+            connection_.get_io_service().post([this, alive] {
+                if (!alive.expired()) {
+                    flush_posted_ = false;
+                    flush();
+                }
+            });
+        }
+        return true;
+    }
+
+    bool writable(uint16_t stream)
+    {
+        return session_.writable(stream);
+    }
+
+    /**
+     * \brief Processes a datagram received from the peer
+     */
+    void receive(boost::asio::const_buffer datagram)
+    {
+        session_.receive(datagram, now());
+        flush();
+    }
+
+    /**
+     * \brief Receives from the connection, which must be dedicated to this
+     * peer, until it is closed
+     */
+    void start()
+    {
+        std::weak_ptr<char> alive = alive_;
+        connection_.receive([this, alive](const udp_connection::error_code& error,
+                                          const udp_connection::received_batch& batch) {
+            if (error || alive.expired()) {
+                return;
+            }
+            for (const udp_connection::received_datagram& datagram : batch) {
+                if (datagram.endpoint == peer_) {
+                    session_.receive(datagram.data, now());
+                }
+            }
+            flush();
+        });
+    }
+
+    const endpoint_type& peer() const
+    {
+        return peer_;
+    }
+
+    reliable_session& session()
+    {
+        return session_;
+    }
+
+private:
+
+    udp_connection&           connection_;
+    endpoint_type             peer_;
+    reliable_session          session_;
+    boost::asio::steady_timer timer_;
+    clock::time_point         epoch_;
+    uint64_t                  deadline_;     // when the timer fires, zero if it is idle
+    bool                      flush_posted_;
+    std::shared_ptr<char>     alive_;        // handlers outliving the session see it expired
+
+    /**
+     * Microseconds since the session was created, its clock
+     */
+    uint64_t now() const
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - epoch_).count());
+    }
+
+    /**
+     * Sends whatever the session has ready and rearms the timer
+     */
+    void flush()
+    {
+        session_.poll(now(), [this](boost::asio::const_buffer packet) {
+            // a datagram the kernel would not take is just one more loss
+            udp_connection::error_code ignored;
+            connection_.socket().send_to(boost::asio::buffer(packet), peer_, 0, ignored);
+        });
+
+        uint64_t deadline = session_.next_timeout();
+        if (deadline == deadline_) {
+            return;
+        }
+        deadline_ = deadline;
+        if (deadline == 0) {
+            boost::system::error_code ignored;
+            timer_.cancel(ignored);
+            return;
+        }
+
+        std::weak_ptr<char> alive = alive_;
+        timer_.expires_at(epoch_ + std::chrono::microseconds(deadline));
+        timer_.async_wait([this, alive](const boost::system::error_code& error) {
+            if (!error && !alive.expired()) {
+                deadline_ = 0;
+                flush();
+            }
+        });
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_reliable_udp_hpp__
@@ -0,0 +1,610 @@
+/**
+ * \file rpc_channel.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_rpc_channel_hpp__
+#define transport_rpc_channel_hpp__
+
+#include "transport/__buffer.hpp"
+#include "transport/buffer_cursor.hpp"
+#include "transport/framing.hpp"
+#include "transport/tcp_connection.hpp"
+#include "transport/timing_wheel.hpp"
+
+#include <boost/asio/error.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Tunables of an \c rpc_channel, \c framing must match the peer's
+ */
+struct rpc_config
+{
+    framing_config framing;      ///< Frames carrying the messages
+    size_t         max_pending;  ///< Calls awaiting a response, more are refused
+    size_t         read_size;    ///< Largest single read from the socket
+
+    rpc_config()
+     : max_pending(65536)
+     , read_size(65536)
+    { }
+};
+
+/**
+ * \brief Request/response calls multiplexed over a \c tcp_connection
+ *
+ * Every call gets an id the response carries back, so a call never waits
+ * for the ones before it: calls are pipelined, as many as
+ * \c rpc_config::max_pending at a time, and responses are matched to them
+ * in whatever order the peer sends them. Both ends may call and serve at
+ * the same time.
+ *
+ * Messages are not written one by one. Those queued while a write is in
+ * progress, or within the same handler, go out together in a single
+ * gathered write once the socket is free, so the number of system calls
+ * drops as the load grows instead of capping it.
+ *
+ * Calls may have a deadline, kept with the coarse ticks of a
+ * \c timing_wheel: a call without a response by then completes with
+ * \c boost::asio::error::timed_out, and its response is dropped if it
+ * comes later.
+ *
+ * \code
+ *  rpc_channel::ptr channel = rpc_channel::create(connection, rpc_config(), wheel);
+ *  channel->on_request(ECHO, [](const rpc_channel::slice_type& request,
+ *                               const rpc_channel::responder& reply) {
+ *      reply.respond(request);
+ *  });
+ *  channel->start();
+ *  channel->call(ECHO, "ping", 4, [](const boost::system::error_code& error,
+ *                                     const rpc_channel::slice_type& response) {
+ *      ...
+ *  }, std::chrono::seconds(5));
+ * \endcode
+ *
+ * Each message is a frame, see \c frame_writer, integers in the header are
+ * varints:
+ * \code
+ *  request:        0x00 id method body
+ *  response:       0x01 id body
+ *  unknown method: 0x02 id
+ * \endcode
+ *
+ * The channel lives as long as its connection is open, \c close() ends it.
+ * Not thread safe: every method, responders included, must be called from
+ * the connection's io_service, run by a single thread.
+ */
+class rpc_channel
+    : public std::enable_shared_from_this<rpc_channel>
+{
+public:
+    typedef std::shared_ptr<rpc_channel> ptr;
+    typedef boost::system::error_code    error_code;
+    typedef buffer<char>                 buffer_type;
+    typedef buffer_type::slice_type      slice_type;
+    typedef timing_wheel::clock          clock;
+
+    /**
+     * \brief Sends the response to one request, possibly long after the
+     * request handler returned
+     */
+    class responder
+    {
+    public:
+        /**
+         * \brief Responds with a copy of the \p size bytes at \p data
+         *
+         * \return \c false if the channel is closed or the response does not
+         * fit in a frame
+         */
+        bool respond(const void *data, size_t size) const
+        {
+            ptr channel = channel_.lock();
+            return channel && channel->send(response, id_, 0, data, size);
+        }
+
+        /**
+         * \brief Responds with \p body, without copying it
+         */
+        bool respond(const slice_type& body) const
+        {
+            ptr channel = channel_.lock();
+            return channel && channel->send(response, id_, 0, body);
+        }
+
+        uint64_t id() const
+        {
+            return id_;
+        }
+
+    private:
+        friend class rpc_channel;
+
+        std::weak_ptr<rpc_channel> channel_;
+        uint64_t                   id_;
+
+        responder(const std::weak_ptr<rpc_channel>& channel, uint64_t id)
+         : channel_(channel)
+         , id_(id)
+        { }
+    };
+
+    typedef std::function<void(const error_code&, const slice_type&)> Response_Handler;
+    typedef std::function<void(const slice_type&, const responder&)>  Request_Handler;
+
+    /**
+     * Longest message header, kind and two varints
+     */
+    static const size_t MAX_HEADER = 1 + 2 * byte_codec::MAX_VARINT;
+
+    struct statistics {
+        uint64_t calls;      ///< Calls sent
+        uint64_t responses;  ///< Responses matched to a pending call
+        uint64_t timeouts;   ///< Calls that missed their deadline
+        uint64_t late;       ///< Responses to calls no longer pending
+        uint64_t served;     ///< Requests handed to a handler
+        uint64_t messages;   ///< Messages written, of any kind
+        uint64_t writes;     ///< Writes to the socket, each a batch of messages
+    };
+
+    /**
+     * \brief Creates a channel talking over \p connection, which must be
+     * open already
+     *
+     * \param wheel Keeps the deadlines of calls, which are ignored without it
+     */
+    static ptr create(tcp_connection::ptr connection,
+                      const rpc_config& config = rpc_config(),
+                      timing_wheel::ptr wheel = timing_wheel::ptr())
+    {
+        ptr channel(new rpc_channel(std::move(connection), config, std::move(wheel)));
+        channel->self_ = channel;
+        return channel;
+    }
+
+    ~rpc_channel()
+    {
+        if (wheel_) {
+            for (auto& entry : pending_) {
+                wheel_->cancel(entry.second);
+            }
+        }
+    }
+
+    /**
+     * \brief Sets the function serving requests for \p method
+     *
+     * Requests for methods without a handler are answered at once, their
+     * calls fail with \c boost::asio::error::operation_not_supported.
+     *
+     * \param handler Called once per request:
+     * \code handler(request: const slice_type&, reply: const responder&) \endcode
+     */
+    void on_request(uint32_t method, Request_Handler handler)
+    {
+        handlers_[method] = std::move(handler);
+    }
+
+    /**
+     * \brief Starts reading from the connection, until it is closed
+     */
+    void start()
+    {
+        read();
+    }
+
+    /**
+     * \brief Calls \p method with a copy of the \p size bytes at \p data
+     *
+     * \param callback Called once, with the response or what went wrong:
+     * \code callback(error_code: boost::system::error_code, response: const slice_type&) \endcode
+     * \param timeout How long to wait for the response, forever if zero
+     *
+     * \return \c false, and \p callback is not called, if the channel is
+     * closed, \c max_pending calls are in flight or the request does not fit
+     * in a frame
+     */
+    bool call(uint32_t method,
+              const void *data,
+              size_t size,
+              Response_Handler callback,
+              clock::duration timeout = clock::duration::zero())
+    {
+        if (!callable(size)) {
+            return false;
+        }
+        uint64_t id = next_id_++;
+        send(request, id, method, data, size);
+        add_pending(id, std::move(callback), timeout);
+        return true;
+    }
+
+    /**
+     * \brief Calls \p method with \p body, without copying it
+     *
+     * \see call
+     */
+    bool call(uint32_t method,
+              const slice_type& body,
+              Response_Handler callback,
+              clock::duration timeout = clock::duration::zero())
+    {
+        if (!callable(body.size())) {
+            return false;
+        }
+        uint64_t id = next_id_++;
+        send(request, id, method, body);
+        add_pending(id, std::move(callback), timeout);
+        return true;
+    }
+
+    /**
+     * \brief Closes the connection, pending calls fail with
+     * \c boost::asio::error::operation_aborted
+     */
+    void close()
+    {
+        fail(boost::asio::error::operation_aborted);
+    }
+
+    bool closed() const
+    {
+        return closed_;
+    }
+
+    /**
+     * \return Calls awaiting a response
+     */
+    size_t pending() const
+    {
+        return pending_.size();
+    }
+
+    const statistics& stats() const
+    {
+        return stats_;
+    }
+
+    const tcp_connection::ptr& connection() const
+    {
+        return connection_;
+    }
+
+private:
+    rpc_channel(const rpc_channel&) = delete;
+    rpc_channel& operator=(const rpc_channel&) = delete;
+
+    enum message_kind {
+        request        = 0,
+        response       = 1,
+        unknown_method = 2
+    };
+
+    struct pending_call
+        : public timing_wheel::timer
+    {
+        rpc_channel&     owner;
+        uint64_t         id;
+        Response_Handler callback;
+
+        pending_call(rpc_channel& owner, uint64_t id, Response_Handler&& callback)
+         : owner(owner)
+         , id(id)
+         , callback(std::move(callback))
+        { }
+
+        uint64_t expired(uint64_t)
+        {
+            owner.deadline_expired(id);
+            return 0;
+        }
+    };
+
+    tcp_connection::ptr                          connection_;
+    boost::asio::io_service&                     ioservice_;
+    timing_wheel::ptr                            wheel_;
+    rpc_config                                   config_;
+    std::weak_ptr<rpc_channel>                   self_;
+    frame_writer<char>                           frame_writer_;
+    frame_reader<char>                           frame_reader_;
+    buffer_type                                  incoming_;
+    buffer_type                                  outgoing_[2];
+    unsigned                                     filling_;       // outgoing_ collecting messages, the other one is being written
+    bool                                         writing_;
+    bool                                         flush_posted_;
+    bool                                         closed_;
+    uint64_t                                     next_id_;
+    std::unordered_map<uint64_t, pending_call>   pending_;       // nodes do not move, timers stay put
+    std::unordered_map<uint32_t, Request_Handler> handlers_;
+    statistics                                   stats_;
+
+    rpc_channel(tcp_connection::ptr connection,
+                const rpc_config& config,
+                timing_wheel::ptr wheel)
+     : connection_(std::move(connection))
+     , ioservice_(connection_->get_io_service())
+     , wheel_(std::move(wheel))
+     , config_(config)
+     , frame_writer_(config.framing)
+     , frame_reader_(config.framing)
+     , filling_(0)
+     , writing_(false)
+     , flush_posted_(false)
+     , closed_(false)
+     , next_id_(1)
+    {
+        std::memset(&stats_, 0, sizeof(stats_));
+    }
+
+    bool callable(size_t size) const
+    {
+        return !closed_
+            && pending_.size() < config_.max_pending
+            && size <= config_.framing.max_frame - MAX_HEADER;
+    }
+
+    void add_pending(uint64_t id, Response_Handler&& callback, clock::duration timeout)
+    {
+        ++stats_.calls;
+        pending_call& call = pending_.emplace(std::piecewise_construct,
+                                              std::forward_as_tuple(id),
+                                              std::forward_as_tuple(*this, id, std::move(callback))).first->second;
+        if (wheel_ && timeout > clock::duration::zero()) {
+            wheel_->arm(call, wheel_->now() + wheel_->ticks(timeout));
+        }
+    }
+
+    /**
+     * Encodes the header of a message into \p out
+     *
+     * \return Its length
+     */
+    static size_t encode_header(uint8_t *out, message_kind kind, uint64_t id, uint32_t method)
+    {
+        size_t n = 0;
+        out[n++] = uint8_t(kind);
+        n += byte_codec::store_varint(out + n, id);
+        if (kind == request) {
+            n += byte_codec::store_varint(out + n, method);
+        }
+        return n;
+    }
+
+    template <
+        typename Body>
+    bool send(message_kind kind, uint64_t id, uint32_t method, const Body& body)
+    {
+        if (closed_ || body.size() > config_.framing.max_frame - MAX_HEADER) {
+            return false;
+        }
+        uint8_t header[MAX_HEADER];
+        size_t length = encode_header(header, kind, id, method);
+        {
+            buffer_writer<char> writer(outgoing_[filling_]);
+            frame_writer_.write(writer, header, length, body);
+        }
+        queued();
+        return true;
+    }
+
+    bool send(message_kind kind, uint64_t id, uint32_t method, const void *data, size_t size)
+    {
+        if (closed_ || size > config_.framing.max_frame - MAX_HEADER) {
+            return false;
+        }
+        uint8_t header[MAX_HEADER];
+        size_t length = encode_header(header, kind, id, method);
+        {
+            buffer_writer<char> writer(outgoing_[filling_]);
+            frame_writer_.write(writer, header, length, data, size);
+        }
+        queued();
+        return true;
+    }
+
+    /**
+     * Makes sure what was just queued gets written: by the write in
+     * progress when it is done, or by a flush after the current handler,
+     * which lets the messages queued by it go out together
+     */
+    void queued()
+    {
+        ++stats_.messages;
+        if (writing_ || flush_posted_) {
+            return;
+        }
+        flush_posted_ = true;
+        ptr self = shared_from_this();
+        ioservice_.post([self] {
+            self->flush_posted_ = false;
+            self->flush();
+        });
+    }
+
+    void flush()
+    {
+        buffer_type& batch = outgoing_[filling_];
+        if (writing_ || closed_ || batch.empty()) {
+            return;
+        }
+        filling_ ^= 1;
+        writing_ = true;
+        ++stats_.writes;
+        ptr self = shared_from_this();
+        connection_->write(batch, [self](const error_code& error) {
+            self->writing_ = false;
+            if (error) {
+                self->fail(error);
+            } else {
+                self->flush();
+            }
+        });
+    }
+
+    void read()
+    {
+        ptr self = shared_from_this();
+        connection_->read_some(config_.read_size, incoming_, [self](const error_code& error, size_t) {
+            self->received(error);
+        });
+    }
+
+    void received(const error_code& error)
+    {
+        if (closed_) {
+            return;
+        }
+        bool malformed = false;
+        error_code bad = frame_reader_.parse(incoming_, [this, &malformed](const slice_type& frame) {
+            if (!closed_ && !malformed && !dispatch(frame)) {
+                malformed = true;
+            }
+        });
+        if (!bad && malformed) {
+            bad = boost::system::errc::make_error_code(boost::system::errc::bad_message);
+        }
+        if (bad || error) {
+            fail(bad ? bad : error);
+        } else if (!closed_) {
+            read();
+        }
+    }
+
+    /**
+     * Hands \p frame to whoever is waiting for it
+     *
+     * \return \c false if it is not a valid message
+     */
+    bool dispatch(const slice_type& frame)
+    {
+        uint8_t header[MAX_HEADER];
+        size_t length = frame.copy_to(reinterpret_cast<char*>(header), MAX_HEADER);
+        if (length == 0) {
+            return false;
+        }
+
+        uint64_t id;
+        size_t used = 1;
+        size_t n = byte_codec::load_varint(header + used, length - used, id);
+        if (n == 0) {
+            return false;
+        }
+        used += n;
+
+        switch (header[0]) {
+            case request: {
+                uint64_t method;
+                n = byte_codec::load_varint(header + used, length - used, method);
+                if (n == 0 || method > 0xFFFFFFFF) {
+                    return false;
+                }
+                serve(id, uint32_t(method), frame.sub(used + n));
+                return true;
+            }
+            case response:
+                complete(id, error_code(), frame.sub(used));
+                return true;
+            case unknown_method:
+                complete(id, boost::asio::error::operation_not_supported, slice_type());
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void serve(uint64_t id, uint32_t method, const slice_type& body)
+    {
+        auto it = handlers_.find(method);
+        if (it == handlers_.end()) {
+            send(unknown_method, id, 0, nullptr, 0);
+            return;
+        }
+        ++stats_.served;
+        it->second(body, responder(self_, id));
+    }
+
+    void complete(uint64_t id, const error_code& error, const slice_type& body)
+    {
+        auto it = pending_.find(id);
+        if (it == pending_.end()) {
+            ++stats_.late;
+            return;
+        }
+        if (wheel_) {
+            wheel_->cancel(it->second);
+        }
+        Response_Handler callback = std::move(it->second.callback);
+        pending_.erase(it);
+        ++stats_.responses;
+        callback(error, body);
+    }
+
+    /**
+     * Called by the wheel, from whatever thread drives it and with its lock
+     * held, so the call is timed out later on the channel's thread
+     */
+    void deadline_expired(uint64_t id)
+    {
+        std::weak_ptr<rpc_channel> self = self_;
+        ioservice_.post([self, id] {
+            ptr channel = self.lock();
+            if (channel) {
+                channel->timed_out(id);
+            }
+        });
+    }
+
+    void timed_out(uint64_t id)
+    {
+        auto it = pending_.find(id);
+        if (it == pending_.end()) {
+            return;
+        }
+        // the timer fired, it is not in the wheel any longer
+        Response_Handler callback = std::move(it->second.callback);
+        pending_.erase(it);
+        ++stats_.timeouts;
+        callback(boost::asio::error::timed_out, slice_type());
+    }
+
+    /**
+     * Closes the channel and fails every pending call with \p error
+     */
+    void fail(const error_code& error)
+    {
+        if (closed_) {
+            return;
+        }
+        __TRACE(debug::masks::tcp_trace, "RPC channel closed: %s", error.message().c_str());
+        closed_ = true;
+        connection_->abort();
+
+        std::unordered_map<uint64_t, pending_call> failed;
+        failed.swap(pending_);
+        if (wheel_) {
+            for (auto& entry : failed) {
+                wheel_->cancel(entry.second);
+            }
+        }
+        for (auto& entry : failed) {
+            entry.second.callback(error, slice_type());
+        }
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_rpc_channel_hpp__
@@ -0,0 +1,378 @@
+/**
+ * \file slab_allocator.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_slab_allocator_hpp__
+#define transport_slab_allocator_hpp__
+
+#include <boost/system/system_error.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+ #include <sys/mman.h>
+#endif
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Parameters of a \c slab_allocator, see \c slab_allocator::configure()
+ */
+struct slab_config
+{
+    size_t slab_size;   ///< Bytes mapped at once, rounded up to 2 MB with huge pages
+    size_t cache_size;  ///< Free objects a thread keeps before handing some to the depot
+    size_t batch;       ///< Objects moved between a thread and the depot at once
+    bool   huge_pages;  ///< Map slabs with explicit huge pages, or ask for transparent ones
+    bool   lock;        ///< Lock slabs in memory, so they never fault again nor swap
+
+    slab_config()
+     : slab_size(1 << 20)
+     , cache_size(256)
+     , batch(64)
+     , huge_pages(false)
+     , lock(false)
+    { }
+};
+
+/**
+ * \brief Allocator of fixed size objects carved out of large slabs
+ *
+ * Each thread allocates from and frees to a free list of its own, without
+ * locks nor atomic operations. Lists are refilled from, and trimmed to, a
+ * global depot \c batch objects at a time, so that memory freed by a
+ * consumer thread flows back to the producer allocating it. The depot maps
+ * new slabs when it runs dry and never gives them back.
+ *
+ * There is one allocator per object size and alignment, \c instance(). It
+ * is never destroyed, objects may be freed during exit.
+ *
+ * Thread safe.
+ */
+template <
+    size_t Object_Size,
+    size_t Alignment = 64>
+class slab_allocator
+{
+public:
+    static_assert(Alignment != 0 && (Alignment & (Alignment - 1)) == 0, "Alignment must be a power of two");
+
+    struct statistics {
+        uint64_t slabs;         ///< Slabs mapped
+        uint64_t huge_slabs;    ///< Slabs backed by explicit huge pages
+        uint64_t locked_slabs;  ///< Slabs locked in memory
+        uint64_t bytes;         ///< Bytes mapped
+        uint64_t objects;       ///< Objects carved out of slabs so far
+        uint64_t in_use;        ///< Objects allocated and not freed
+        uint64_t cached;        ///< Free objects in thread lists
+        uint64_t depot;         ///< Free objects in the depot
+        uint64_t threads;       ///< Threads with a list of their own
+        uint64_t refills;       ///< Batches taken from the depot
+        uint64_t flushes;       ///< Batches given back to it
+    };
+
+    /**
+     * Distance between consecutive objects in a slab
+     */
+    static const size_t STRIDE = ((Object_Size > sizeof(void*) ? Object_Size : sizeof(void*)) + Alignment - 1)
+                               & ~(Alignment - 1);
+
+    static slab_allocator& instance()
+    {
+        // leaked on purpose, see above
+        static slab_allocator *allocator = new slab_allocator;
+        return *allocator;
+    }
+
+    /**
+     * \brief Sets the parameters for slabs mapped from now on, and for
+     * thread lists
+     *
+     * Best called once, before the first allocation.
+     */
+    void configure(const slab_config& config)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        config_ = config;
+        config_.batch = std::max(config_.batch, size_t(1));
+        config_.cache_size = std::max(config_.cache_size, config_.batch);
+    }
+
+    slab_config config() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return config_;
+    }
+
+    /**
+     * \return \c Object_Size bytes aligned to \c Alignment
+     *
+     * \throws boost::system::system_error if a new slab cannot be mapped
+     */
+    void *allocate()
+    {
+        thread_cache *cache = local_cache();
+        if (cache == nullptr) {
+            // the thread is exiting, its list is gone
+            free_list batch = take(1);
+            void *p = batch.pop();
+            give(batch);
+            return p;
+        }
+        if (cache->list.count == 0) {
+            cache->list = take(cache->batch);
+            cache->publish();
+        }
+        void *p = cache->list.pop();
+        cache->publish();
+        return p;
+    }
+
+    void deallocate(void *p)
+    {
+        thread_cache *cache = local_cache();
+        if (cache == nullptr) {
+            free_list single;
+            single.push(p);
+            give(single);
+            return;
+        }
+        cache->list.push(p);
+        if (cache->list.count > cache->cache_size) {
+            give(cache->list.split(cache->batch));
+        }
+        cache->publish();
+    }
+
+    /**
+     * \return A snapshot of the counters, thread lists are read without
+     * stopping their threads
+     */
+    statistics stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        statistics result = stats_;
+        result.depot   = 0;
+        result.cached  = 0;
+        result.threads = caches_.size();
+        for (const free_list& batch : depot_) {
+            result.depot += batch.count;
+        }
+        for (const thread_cache *cache : caches_) {
+            result.cached += cache->published.load(std::memory_order_relaxed);
+        }
+        uint64_t unused = result.depot + result.cached;
+        result.in_use = result.objects > unused ? result.objects - unused : 0;
+        return result;
+    }
+
+private:
+
+    /**
+     * Objects linked through their first word
+     */
+    struct free_list {
+        void   *head;
+        size_t  count;
+
+        free_list()
+         : head(nullptr)
+         , count(0)
+        { }
+
+        void push(void *p)
+        {
+            *static_cast<void**>(p) = head;
+            head = p;
+            ++count;
+        }
+
+        void *pop()
+        {
+            void *p = head;
+            head = *static_cast<void**>(p);
+            --count;
+            return p;
+        }
+
+        /**
+         * Detaches the first \p n objects
+         */
+        free_list split(size_t n)
+        {
+            free_list result;
+            while (result.count < n && count > 0) {
+                result.push(pop());
+            }
+            return result;
+        }
+    };
+
+    struct thread_cache {
+        slab_allocator&     owner;
+        bool&               destroyed;
+        free_list           list;
+        size_t              batch;
+        size_t              cache_size;
+        std::atomic<size_t> published;  // list.count, for stats()
+
+        thread_cache(slab_allocator& owner, bool& destroyed)
+         : owner(owner)
+         , destroyed(destroyed)
+         , published(0)
+        {
+            std::lock_guard<std::mutex> lock(owner.mutex_);
+            batch      = owner.config_.batch;
+            cache_size = owner.config_.cache_size;
+            owner.caches_.push_back(this);
+        }
+
+        ~thread_cache()
+        {
+            owner.give(list);
+            std::lock_guard<std::mutex> lock(owner.mutex_);
+            owner.caches_.erase(std::find(owner.caches_.begin(), owner.caches_.end(), this));
+            destroyed = true;
+        }
+
+        void publish()
+        {
+            published.store(list.count, std::memory_order_relaxed);
+        }
+    };
+
+    mutable std::mutex         mutex_;
+    slab_config                config_;
+    std::vector<free_list>     depot_;
+    std::vector<thread_cache*> caches_;
+    char                      *bump_;      // not yet carved part of the last slab
+    char                      *bump_end_;
+    statistics                 stats_;
+
+    slab_allocator()
+     : bump_(nullptr)
+     , bump_end_(nullptr)
+    {
+        stats_ = statistics{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    }
+
+    /**
+     * The list of the calling thread, \c nullptr once it has been destroyed
+     */
+    thread_cache *local_cache()
+    {
+        // trivially destructible, so still readable after the list is gone
+        static thread_local bool destroyed = false;
+        if (destroyed) {
+            return nullptr;
+        }
+        static thread_local thread_cache cache(*this, destroyed);
+        return &cache;
+    }
+
+    /**
+     * A batch of up to \p n objects from the depot, or fresh ones
+     */
+    free_list take(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.refills;
+        if (!depot_.empty()) {
+            free_list batch = depot_.back();
+            depot_.pop_back();
+            return batch;
+        }
+
+        free_list batch;
+        while (batch.count < n) {
+            if (bump_ + STRIDE > bump_end_) {
+                if (batch.count > 0) {
+                    break;
+                }
+                map_slab();
+            }
+            batch.push(bump_);
+            bump_ += STRIDE;
+            ++stats_.objects;
+        }
+        return batch;
+    }
+
+    void give(free_list list)
+    {
+        if (list.count == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.flushes;
+        depot_.push_back(list);
+    }
+
+    /**
+     * Maps a new slab and makes it the one carved from, under \c mutex_
+     */
+    void map_slab()
+    {
+        const size_t HUGE_PAGE = 2 << 20;
+        size_t size = std::max(config_.slab_size, size_t(STRIDE));
+        if (config_.huge_pages) {
+            size = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+        }
+
+        void *slab = nullptr;
+        bool  huge = false;
+#if defined(__linux__)
+ #if defined(MAP_HUGETLB)
+        if (config_.huge_pages) {
+            slab = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            huge = slab != MAP_FAILED;
+        }
+ #endif
+        if (!huge) {
+            slab = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (slab == MAP_FAILED) {
+                throw boost::system::system_error(errno, boost::system::system_category(), "mmap");
+            }
+ #if defined(MADV_HUGEPAGE)
+            if (config_.huge_pages) {
+                // no huge pages reserved, transparent ones are the next best thing
+                ::madvise(slab, size, MADV_HUGEPAGE);
+            }
+ #endif
+        }
+        if (config_.lock && ::mlock(slab, size) == 0) {
+            ++stats_.locked_slabs;
+        }
+#else
+        slab = std::malloc(size + Alignment);
+        if (slab == nullptr) {
+            throw boost::system::system_error(ENOMEM, boost::system::system_category(), "malloc");
+        }
+        slab = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(slab) + Alignment - 1) & ~(Alignment - 1));
+#endif
+
+        ++stats_.slabs;
+        stats_.huge_slabs += huge ? 1 : 0;
+        stats_.bytes += size;
+        bump_     = static_cast<char*>(slab);
+        bump_end_ = bump_ + size;
+    }
+};
+
+template <size_t Object_Size, size_t Alignment>
+const size_t slab_allocator<Object_Size, Alignment>::STRIDE;
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_slab_allocator_hpp__
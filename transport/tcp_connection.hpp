@@ -8,11 +8,21 @@
 #define transport_tcp_connection_hpp__
 
 #include "debug/log.hpp"
+#include "transport/__buffer.hpp"
+#include "transport/busy_poll.hpp"
+#include "transport/kernel_timestamps.hpp"
+#include "transport/magic_ring.hpp"
+#include "transport/timing_wheel.hpp"
 
 #include <boost/asio.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
 
 namespace et {
 namespace transport {
@@ -21,12 +31,25 @@ namespace asio {
     using boost::asio::async_read;
 }
 
+class tcp_connection_pool;
+
 class tcp_connection
     : public std::enable_shared_from_this<tcp_connection>
 {
 public:
     typedef std::shared_ptr<tcp_connection> ptr;
 
+    /**
+     * Where the connection is in a graceful shutdown, see \c drain()
+     */
+    enum drain_state {
+        active,      ///< Not draining
+        draining,    ///< Waiting for in-flight operations to finish
+        closed_idle, ///< Closed right away, nothing was in flight
+        drained,     ///< Closed after in-flight operations finished
+        aborted      ///< Closed with operations still in flight
+    };
+
     typedef boost::system::error_code      error_code;
     typedef std::vector<char>              buffer_type;
     typedef boost::asio::ip::tcp::socket   socket_type;
@@ -34,15 +57,301 @@ public:
     typedef boost::asio::ip::tcp::endpoint endpoint_type;
 
     tcp_connection(boost::asio::io_service& ioservice)
-     : socket_(ioservice)
-     , resolver_(ioservice)
+     : ioservice_(ioservice)
+     , socket_(ioservice)
+     , strand_(ioservice)
+     , reading_(false)
+     , read_progress_(false)
+     , writing_(false)
+     , holds_(0)
+     , drain_state_(active)
+     , idle_ticks_(0)
+     , read_ticks_(0)
+     , last_activity_(0)
+     , read_deadline_(0)
+     , timed_out_(false)
+     , timeout_timer_(*this)
+     , pool_prev_(nullptr)
+     , pool_next_(nullptr)
     { }
 
+    ~tcp_connection()
+    {
+        if (wheel_) {
+            wheel_->cancel(timeout_timer_);
+        }
+    }
+
     boost::asio::ip::tcp::socket& socket()
     {
         return socket_;
     }
 
+    boost::asio::io_service& get_io_service()
+    {
+        return ioservice_;
+    }
+
+    /**
+     * \brief The strand every completion handler of the connection runs on
+     *
+     * Handlers calling back into the connection are serialized by it, post
+     * to it whatever touches the connection from other threads.
+     */
+    boost::asio::io_service::strand& strand()
+    {
+        return strand_;
+    }
+
+    /**
+     * \brief Prepares the connection for reuse
+     *
+     * Closes the socket and clears pending data, buffers keep their capacity.
+     *
+     * \remarks There must be no outstanding operations on the connection
+     */
+    void reset()
+    {
+        error_code ignored;
+        socket_.close(ignored);
+        incoming_data_.clear();
+        outgoing_data_.clear();
+        reading_ = false;
+        read_progress_ = false;
+        writing_ = false;
+        holds_ = 0;
+        drain_state_ = active;
+
+        if (wheel_) {
+            wheel_->cancel(timeout_timer_);
+            wheel_.reset();
+        }
+        idle_ticks_ = 0;
+        read_ticks_ = 0;
+        read_deadline_ = 0;
+        timed_out_ = false;
+    }
+
+    /**
+     * \brief Enables idle and read timeouts driven by \p wheel
+     *
+     * Activity is tracked by stamping the current wheel tick on every I/O
+     * completion, the connection's timer is only re-armed when it fires, so
+     * timeouts cost next to nothing per operation.
+     *
+     * Operations interrupted by a timeout complete with
+     * \c boost::asio::error::timed_out.
+     *
+     * \param wheel Wheel driving the timeouts
+     * \param idle Close the connection after this long without I/O, zero disables it
+     * \param read Fail reads not completed after this long, zero disables it
+     */
+    void set_timeouts(timing_wheel::ptr wheel,
+                      timing_wheel::clock::duration idle,
+                      timing_wheel::clock::duration read)
+    {
+        if (wheel_) {
+            wheel_->cancel(timeout_timer_);
+        }
+
+        wheel_ = std::move(wheel);
+        idle_ticks_ = wheel_->ticks(idle);
+        read_ticks_ = wheel_->ticks(read);
+        last_activity_ = wheel_->now();
+        read_deadline_ = 0;
+
+        uint64_t next = next_timeout(wheel_->now());
+        if (next != 0) {
+            wheel_->arm(timeout_timer_, next);
+        }
+    }
+
+    /**
+     * \return \c true if there is no write pending, no read has received any
+     * byte yet and nothing is held, i.e. the peer is not in the middle of a
+     * request
+     */
+    bool idle() const
+    {
+        return holds_ == 0 && !writing_ && (!reading_ || !read_progress_);
+    }
+
+    /**
+     * \brief Marks the connection busy while the application works on
+     * something not on the socket, such as the response to a request read
+     *
+     * \c drain() only sees operations posted to the socket; between reading
+     * a request and writing its response the connection would look idle and
+     * be closed. Every \c hold() must be matched by a \c release().
+     */
+    void hold()
+    {
+        ++holds_;
+    }
+
+    /**
+     * \brief Undoes a \c hold(), closing the connection if it is draining
+     * and now idle
+     *
+     * \remarks Must be called from the connection's \c strand()
+     */
+    void release()
+    {
+        --holds_;
+        operation_done();
+    }
+
+    drain_state state() const
+    {
+        return drain_state_;
+    }
+
+    /**
+     * \brief Starts a graceful close
+     *
+     * Idle connections are closed immediately, otherwise the connection is
+     * closed as soon as in-flight operations complete and \c hold()s are
+     * released. Work of the application between operations is only waited
+     * for if it holds the connection.
+     *
+     * \remarks Must be called from the connection's \c strand()
+     */
+    void drain()
+    {
+        drain_state expected = active;
+        if (drain_state_.compare_exchange_strong(expected, draining) && idle()) {
+            close(closed_idle);
+        }
+    }
+
+    /**
+     * \brief Closes the connection regardless of in-flight operations
+     */
+    void abort()
+    {
+        close(aborted);
+    }
+
+    /**
+     * \brief Enables kernel transmit timestamps, see \c kernel_timestamps
+     *
+     * Reads go through asio and never see ancillary data, so only transmit
+     * timestamps are available on TCP.
+     *
+     * \return \c false if the platform does not support them
+     */
+    bool enable_tx_timestamps()
+    {
+        return kernel_timestamps::enable(socket_.native_handle(), kernel_timestamps::tx) != 0;
+    }
+
+    /**
+     * \brief Starts a loop reading transmit timestamps
+     *
+     * The id of each timestamp is the offset of the last byte of the write
+     * it belongs to, counting from zero when timestamps were enabled. The
+     * loop ends with the first error, passed to \p handler with zero id and
+     * timestamp.
+     *
+     * \param handler Function to call for every timestamp:
+     * \code handler(error_code: boost::system::error_code, id: uint32_t, timestamp: uint64_t) \endcode
+     */
+    template<typename Timestamp_Handler>
+    void receive_tx_timestamps(Timestamp_Handler handler)
+    {
+        socket_.async_wait(socket_type::wait_error,
+                           boost::asio::bind_executor(strand_, [this, handler](const error_code& error) {
+                               if (error) {
+                                   handler(error, 0, 0);
+                                   return;
+                               }
+                               error_code result;
+                               kernel_timestamps::receive_tx(socket_.native_handle(),
+                                                             [&handler](uint32_t id, uint64_t timestamp) {
+                                                                 handler(error_code(), id, timestamp);
+                                                             },
+                                                             result);
+                               if (result && result != boost::asio::error::would_block) {
+                                   handler(result, 0, 0);
+                                   return;
+                               }
+                               receive_tx_timestamps(handler);
+                           }));
+    }
+
+    /**
+     * \brief Sets \c SO_BUSY_POLL on the socket, see \c busy_poll::enable
+     */
+    bool enable_busy_poll(unsigned usec = 50)
+    {
+        return busy_poll::enable(socket_.native_handle(), usec);
+    }
+
+    /**
+     * \brief Reads whatever is in the socket without blocking, \p callback
+     * is called inline if there was anything
+     *
+     * Puts the socket in non-blocking mode. Must not be mixed with \c read().
+     *
+     * \param callback Function to call with the data, valid until it returns:
+     * \code callback(error_code: boost::system::error_code, data: boost::asio::const_buffer) \endcode
+     *
+     * \return Bytes read; \p error is set on failure, \c eof included, but
+     * not when the socket was merely empty
+     */
+    template<typename Read_Handler>
+    size_t poll_receive(Read_Handler&& callback, error_code& error)
+    {
+        if (poll_buffer_.empty()) {
+            poll_buffer_.resize(POLL_BUFFER_LENGTH);
+        }
+        if (!socket_.non_blocking()) {
+            socket_.non_blocking(true, error);
+            if (error) {
+                return 0;
+            }
+        }
+
+        size_t len = socket_.read_some(boost::asio::buffer(poll_buffer_), error);
+        if (error == boost::asio::error::would_block) {
+            error = error_code();
+            return 0;
+        }
+        if (error) {
+            return 0;
+        }
+        touch();
+        callback(error, boost::asio::const_buffer(poll_buffer_.data(), len));
+        return len;
+    }
+
+    /**
+     * \brief Reads in a tight loop on the calling thread, which it takes
+     * over until \p running is cleared or an error occurs
+     *
+     * The io_service is not involved, \p callback is called inline as soon
+     * as data arrives and an empty socket means a spin, never a sleep. The
+     * loop ends with the first error, \c eof included, passed to \p callback
+     * along with an empty buffer.
+     *
+     * \param callback Function to call with the data, valid until it returns:
+     * \code callback(error_code: boost::system::error_code, data: boost::asio::const_buffer) \endcode
+     * \param running Cleared by another thread to stop the loop
+     */
+    template<typename Read_Handler>
+    void busy_receive(Read_Handler callback, const std::atomic<bool>& running)
+    {
+        busy_poll::run(running, [&](size_t& progress) {
+            error_code error;
+            progress = poll_receive(callback, error);
+            if (error) {
+                callback(error, boost::asio::const_buffer());
+                return false;
+            }
+            return true;
+        });
+    }
+
     template<typename Connect_Handler>
     void connect(const std::string& host,
                  uint16_t port,
@@ -50,15 +359,20 @@ public:
     {
         __TRACE(debug::masks::tcp_trace, "Connecting to %s:%u ..", host.c_str(), port);
 
+        if (!resolver_) {
+            // only client connections need one
+            resolver_.reset(new resolver_type(ioservice_));
+        }
+
         resolver_type::query query(host, boost::lexical_cast<std::string>(port));
-        resolver_.async_resolve(query,
-                                [this, callback](const error_code& error, resolver_type::iterator it) {
-                                    if (error != 0) {
+        resolver_->async_resolve(query,
+                                boost::asio::bind_executor(strand_, [this, callback](const error_code& error, resolver_type::iterator it) {
+                                    if (error) {
                                         callback(error);
                                     } else {
-                                        socket_.async_connect(*it, callback);
+                                        socket_.async_connect(*it, boost::asio::bind_executor(strand_, callback));
                                     }
-                                });
+                                }));
     }
 
     /**
@@ -95,7 +409,149 @@ public:
               BOOST_ASIO_MOVE_ARG(Read_Handler) callback)
     {
         __TRACE(debug::masks::tcp_trace, "Asked to read %zu bytes", bytes);
-        read(bytes, data, callback, 0);
+        reading_ = true;
+        read_progress_ = false;
+        if (wheel_ && read_ticks_ != 0) {
+            read_deadline_ = wheel_->now() + read_ticks_;
+        }
+        read(bytes, data, [this, callback](const error_code& error) {
+            reading_ = false;
+            read_deadline_ = 0;
+            callback(timeout_error(error));
+            operation_done();
+        }, 0);
+    }
+
+    /**
+     * \brief Reads exactly \p bytes bytes from the socket, appending them to \p data
+     *
+     * Bytes are read straight into the buckets of \p data, a read larger
+     * than a bucket fills several of them with a single system call.
+     * Whatever arrived before an error is kept in \p data.
+     *
+     * \param bytes Number of bytes to read
+     * \param data Buffer to append to, it must not be modified until
+     * \p callback is called
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code) \endcode
+     */
+    template<typename T, size_t Size, typename Read_Handler>
+    void read(size_t bytes,
+              buffer<T, Size>& data,
+              BOOST_ASIO_MOVE_ARG(Read_Handler) callback)
+    {
+        static_assert(sizeof(T) == 1, "Sockets read bytes");
+        __TRACE(debug::masks::tcp_trace, "Asked to read %zu bytes into a chain", bytes);
+        read_dynamic(bytes, data, std::move(callback));
+    }
+
+    /**
+     * \brief Reads exactly \p bytes bytes from the socket into \p ring
+     *
+     * \see read
+     *
+     * \throws std::length_error if \p ring has no room for \p bytes bytes
+     */
+    template<typename Read_Handler>
+    void read(size_t bytes,
+              magic_ring& ring,
+              BOOST_ASIO_MOVE_ARG(Read_Handler) callback)
+    {
+        __TRACE(debug::masks::tcp_trace, "Asked to read %zu bytes into a ring", bytes);
+        read_dynamic(bytes, ring, std::move(callback));
+    }
+
+    /**
+     * \brief Reads whatever is available, up to \p max_bytes bytes, appending
+     * it to \p data
+     *
+     * \param max_bytes Largest number of bytes to read
+     * \param data Buffer to append to, it must not be modified until
+     * \p callback is called
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code, len: size_t) \endcode
+     */
+    template<typename T, size_t Size, typename Read_Handler>
+    void read_some(size_t max_bytes,
+                   buffer<T, Size>& data,
+                   BOOST_ASIO_MOVE_ARG(Read_Handler) callback)
+    {
+        static_assert(sizeof(T) == 1, "Sockets read bytes");
+        read_some_dynamic(max_bytes, data, std::move(callback));
+    }
+
+    /**
+     * \brief Reads whatever is available into \p ring, up to \p max_bytes
+     * bytes or as many as fit
+     *
+     * The usual streaming loop: read some, parse the frames complete in
+     * \c ring.data(), all contiguous, \c consume() them and read again.
+     * \p ring should never be left full, the read would complete at once
+     * with nothing.
+     *
+     * \see read_some
+     */
+    template<typename Read_Handler>
+    void read_some(size_t max_bytes,
+                   magic_ring& ring,
+                   BOOST_ASIO_MOVE_ARG(Read_Handler) callback)
+    {
+        read_some_dynamic(std::min(max_bytes, ring.available()), ring, std::move(callback));
+    }
+
+    /**
+     * \brief Writes the content of \p data to the socket and consumes it
+     *
+     * Buckets are handed to the kernel as they are, in a single gathered
+     * write when there are few enough of them, nothing is copied.
+     *
+     * \param data Data to send, it must not be modified until \p callback
+     * is called. Bytes written before an error are consumed.
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code) \endcode
+     */
+    template<typename T, size_t Size, typename Write_Handler>
+    void write(buffer<T, Size>& data,
+               BOOST_ASIO_MOVE_ARG(Write_Handler) callback)
+    {
+        static_assert(sizeof(T) == 1, "Sockets write bytes");
+        __TRACE(debug::masks::tcp_trace, "Asked to write chain of %zu bytes", data.size());
+        writing_ = true;
+        write_chain(data, std::move(callback));
+    }
+
+    /**
+     * \brief Writes \p data to the socket
+     *
+     * Nothing is copied, the write holds a reference to the buckets until
+     * it is done. Use \c buffer_slice::share() first if this connection is
+     * served by another thread.
+     *
+     * \param data Data to send
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code) \endcode
+     */
+    template<typename T, size_t Size, typename Write_Handler>
+    void write(const buffer_slice<T, Size>& data,
+               BOOST_ASIO_MOVE_ARG(Write_Handler) callback)
+    {
+        static_assert(sizeof(T) == 1, "Sockets write bytes");
+        __TRACE(debug::masks::tcp_trace, "Asked to write slice of %zu bytes", data.size());
+        writing_ = true;
+        boost::asio::async_write(socket_,
+                                 data,
+                                 [this](const error_code& error, size_t len) {
+                                    if (len > 0) {
+                                        touch();
+                                    }
+                                    return boost::asio::transfer_all()(error, len);
+                                 },
+                                 boost::asio::bind_executor(strand_, [this, callback](const error_code& error, size_t) {
+            touch();
+            writing_ = false;
+            callback(timeout_error(error));
+            operation_done();
+        }));
     }
 
     /**
@@ -110,25 +566,235 @@ public:
     {
         __TRACE(debug::masks::tcp_trace, "Asked to write buffer of %zu bytes", data.size());
         if (data.size() < BUFFER_LENGTH) {
-            __DUMP_BUFFER(stderr, "Write:", data, data.size());
+            __TRACE_BUFFER(debug::masks::tcp_trace, stderr, "Write:", data, data.size());
         }
         outgoing_data_ = std::move(data);
-        write(callback, 0);
+        writing_ = true;
+        write([this, callback](const error_code& error) {
+            writing_ = false;
+            callback(timeout_error(error));
+            operation_done();
+        }, 0);
     }
 
 private:
+    friend class tcp_connection_pool;
 
     static const size_t BUFFER_LENGTH = 1024;
+    static const size_t POLL_BUFFER_LENGTH = 65536;
 
+    boost::asio::io_service& ioservice_;
     boost::asio::ip::tcp::socket socket_;
-    resolver_type resolver_;
+    boost::asio::io_service::strand strand_;
+    std::unique_ptr<resolver_type> resolver_;
 
     std::array<char, BUFFER_LENGTH> read_buffer_;
     std::array<char, BUFFER_LENGTH> write_buffer_;
 
     std::vector<char> incoming_data_;
     std::vector<char> outgoing_data_;
+    std::vector<char> poll_buffer_;
 
+    std::atomic<bool>        reading_;
+    std::atomic<bool>        read_progress_;
+    std::atomic<bool>        writing_;
+    std::atomic<unsigned>    holds_;  // see hold()
+    std::atomic<drain_state> drain_state_;
+
+    struct timeout_timer
+        : public timing_wheel::timer
+    {
+        tcp_connection& owner;
+
+        timeout_timer(tcp_connection& owner)
+         : owner(owner)
+        { }
+
+        uint64_t expired(uint64_t now)
+        {
+            return owner.timeout_expired(now);
+        }
+    };
+
+    timing_wheel::ptr     wheel_;
+    uint64_t              idle_ticks_;
+    uint64_t              read_ticks_;
+    std::atomic<uint64_t> last_activity_;
+    std::atomic<uint64_t> read_deadline_;
+    std::atomic<bool>     timed_out_;
+    timeout_timer         timeout_timer_;
+
+    // intrusive list of connections in use, owned by tcp_connection_pool
+    tcp_connection *pool_prev_;
+    tcp_connection *pool_next_;
+
+    void touch()
+    {
+        if (wheel_) {
+            last_activity_.store(wheel_->now(), std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Earliest tick at which a timeout may trigger, zero if none is set
+     *
+     * Without a read in progress the timer is still checked every read
+     * timeout, so a read started in between is never noticed late.
+     */
+    uint64_t next_timeout(uint64_t now) const
+    {
+        uint64_t next = std::numeric_limits<uint64_t>::max();
+        if (idle_ticks_ != 0) {
+            next = last_activity_ + idle_ticks_;
+        }
+        uint64_t read_deadline = read_deadline_;
+        if (read_deadline != 0) {
+            next = std::min(next, read_deadline);
+        } else if (read_ticks_ != 0) {
+            next = std::min(next, now + read_ticks_);
+        }
+        return next == std::numeric_limits<uint64_t>::max() ? 0 : next;
+    }
+
+    uint64_t timeout_expired(uint64_t now)
+    {
+        uint64_t next = next_timeout(now);
+        if (next == 0 || next > now) {
+            return next;
+        }
+
+        // called by the wheel, with its lock held and from whatever thread
+        // drives it, so the socket is closed later on the strand; the handler
+        // takes the reference, it is never released under the lock
+        ptr self;
+        try {
+            self = shared_from_this();
+        } catch (const std::bad_weak_ptr&) {
+            return 0; // being destroyed, the timer is cancelled next
+        }
+
+        __TRACE(debug::masks::tcp_trace, "%s", "Connection timed out");
+        timed_out_ = true;
+        strand_.post(std::bind([](const ptr& connection) {
+            error_code ignored;
+            connection->socket_.close(ignored);
+        }, std::move(self)));
+        return 0;
+    }
+
+    error_code timeout_error(const error_code& error) const
+    {
+        if (error == boost::asio::error::operation_aborted && timed_out_) {
+            return boost::asio::error::timed_out;
+        }
+        return error;
+    }
+
+    void operation_done()
+    {
+        if (drain_state_ == draining && idle()) {
+            close(drained);
+        }
+    }
+
+    void close(drain_state final_state)
+    {
+        drain_state current = drain_state_;
+        while (current == active || current == draining) {
+            if (drain_state_.compare_exchange_weak(current, final_state)) {
+                __TRACE(debug::masks::tcp_trace, "Closing connection, state %d", int(final_state));
+                error_code ignored;
+                socket_.close(ignored);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Reads \p bytes bytes into \p data, a buffer with asio's dynamic
+     * buffer interface
+     */
+    template<typename Dynamic_Buffer,
+             typename Read_Handler>
+    void read_dynamic(size_t bytes,
+                      Dynamic_Buffer& data,
+                      BOOST_ASIO_MOVE_ARG(Read_Handler) callback)
+    {
+        // first, it may throw, and then the connection must not look busy
+        typename Dynamic_Buffer::mutable_buffers_type buffers = data.prepare(bytes);
+        reading_ = true;
+        read_progress_ = false;
+        if (wheel_ && read_ticks_ != 0) {
+            read_deadline_ = wheel_->now() + read_ticks_;
+        }
+        asio::async_read(socket_,
+                         buffers,
+                         [this](const error_code& error, size_t len) {
+                            if (len > 0) {
+                                read_progress_ = true;
+                                touch();
+                            }
+                            return boost::asio::transfer_all()(error, len);
+                         },
+                         boost::asio::bind_executor(strand_, [this, &data, callback](const error_code& error, size_t len) {
+                            data.commit(len);
+                            reading_ = false;
+                            read_deadline_ = 0;
+                            callback(timeout_error(error));
+                            operation_done();
+                         }));
+    }
+
+    template<typename Dynamic_Buffer,
+             typename Read_Handler>
+    void read_some_dynamic(size_t max_bytes,
+                           Dynamic_Buffer& data,
+                           BOOST_ASIO_MOVE_ARG(Read_Handler) callback)
+    {
+        typename Dynamic_Buffer::mutable_buffers_type buffers = data.prepare(max_bytes);
+        reading_ = true;
+        read_progress_ = false;
+        if (wheel_ && read_ticks_ != 0) {
+            read_deadline_ = wheel_->now() + read_ticks_;
+        }
+        socket_.async_read_some(buffers,
+                                boost::asio::bind_executor(strand_, [this, &data, callback](const error_code& error, size_t len) {
+            if (len > 0) {
+                read_progress_ = true;
+                touch();
+            }
+            data.commit(len);
+            reading_ = false;
+            read_deadline_ = 0;
+            callback(timeout_error(error), len);
+            operation_done();
+        }));
+    }
+
+    /**
+     * Writes what the kernel takes of \p data and consumes it, until it is
+     * all gone
+     *
+     * Every write starts from a fresh \c data(), asio's composed write
+     * would walk the chain from its start after each partial write, which
+     * is quadratic on long chains.
+     */
+    template<typename T, size_t Size, typename Write_Handler>
+    void write_chain(buffer<T, Size>& data,
+                     BOOST_ASIO_MOVE_ARG(Write_Handler) callback)
+    {
+        socket_.async_write_some(data.data(), boost::asio::bind_executor(strand_, [this, &data, callback](const error_code& error, size_t len) {
+            touch();
+            data.consume(len);
+            if (!error && !data.empty()) {
+                write_chain(data, std::move(callback));
+                return;
+            }
+            writing_ = false;
+            callback(timeout_error(error));
+            operation_done();
+        }));
+    }
 
     template<typename Buffer_Type,
              typename Read_Handler>
@@ -140,11 +806,15 @@ private:
         asio::async_read(socket_,
                          boost::asio::buffer(read_buffer_,
                                              size_t(bytes < BUFFER_LENGTH ? bytes : BUFFER_LENGTH)),
-                         [bytes](const error_code& error, size_t len) {
-                            return error != 0 || len >= bytes;
+                         [this, bytes](const error_code& error, size_t len) {
+                            if (len > 0) {
+                                read_progress_ = true;
+                                touch();
+                            }
+                            return error || len >= bytes;
                          },
-                         [=, &buffer](const error_code& error, size_t len) {
-                            if (error != 0) {
+                         boost::asio::bind_executor(strand_, [=, &buffer](const error_code& error, size_t len) {
+                            if (error) {
                                 callback(error);
                             } else {
                                 std::memcpy(&buffer[read_bytes], &read_buffer_[0], len);
@@ -152,12 +822,12 @@ private:
                                     read(bytes-len, buffer, std::move(callback), read_bytes+len);
                                 } else {
                                     if (buffer.size() < BUFFER_LENGTH) {
-                                        __DUMP_BUFFER(stderr, "Read:", buffer, buffer.size());
+                                        __TRACE_BUFFER(debug::masks::tcp_trace, stderr, "Read:", buffer, buffer.size());
                                     }
                                     callback(boost::system::error_code());
                                 }
                             }
-                         });
+                         }));
     }
 
     template<typename Write_Handler>
@@ -169,14 +839,15 @@ private:
 
         boost::asio::async_write(socket_,
                                  boost::asio::buffer(write_buffer_, increment),
-                                 [=](const error_code& error,
-                                     size_t bytes_transferred) {
-            if (error != 0 || sent+bytes_transferred == outgoing_data_.size()) {
+                                 boost::asio::bind_executor(strand_, [=](const error_code& error,
+                                                                         size_t bytes_transferred) {
+            touch();
+            if (error || sent+bytes_transferred == outgoing_data_.size()) {
                 callback(error);
             } else {
                 write(callback, sent + bytes_transferred);
             }
-        });
+        }));
     }
 };
 
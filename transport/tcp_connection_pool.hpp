@@ -0,0 +1,296 @@
+/**
+ * \file tcp_connection_pool.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_tcp_connection_pool_hpp__
+#define transport_tcp_connection_pool_hpp__
+
+#include "transport/tcp_connection.hpp"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Recycles \c tcp_connection objects across accepts
+ *
+ * Connections handed out by \c acquire() go back to the pool when the last
+ * \c tcp_connection::ptr referencing them is released. The \c shared_ptr
+ * control blocks are recycled too, so once the pool has warmed up acquiring
+ * a connection does not touch the heap.
+ *
+ * The pool must be created with \c create(); connections keep it alive
+ * until they are all gone, and the pool keeps their io_service alive, so a
+ * connection may outlive whoever created the pool.
+ */
+class tcp_connection_pool
+    : public std::enable_shared_from_this<tcp_connection_pool>
+{
+public:
+    typedef std::shared_ptr<tcp_connection_pool> ptr;
+
+    static const size_t DEFAULT_CAPACITY = 1024;
+
+    /**
+     * \brief Creates a pool of connections bound to \p ioservice, which is
+     * kept alive as long as the pool
+     *
+     * \param capacity Maximum number of idle connections kept for reuse
+     */
+    static ptr create(std::shared_ptr<boost::asio::io_service> ioservice,
+                      size_t capacity = DEFAULT_CAPACITY)
+    {
+        return ptr(new tcp_connection_pool(std::move(ioservice), capacity));
+    }
+
+    /**
+     * \brief Creates a pool of connections bound to \p ioservice, which
+     * must outlive every connection handed out
+     */
+    static ptr create(boost::asio::io_service& ioservice,
+                      size_t capacity = DEFAULT_CAPACITY)
+    {
+        return create(std::shared_ptr<boost::asio::io_service>(&ioservice, [](boost::asio::io_service*) { }),
+                      capacity);
+    }
+
+    ~tcp_connection_pool()
+    {
+        for (tcp_connection *connection : connections_) {
+            delete connection;
+        }
+        for (void *block : blocks_) {
+            ::operator delete(block);
+        }
+    }
+
+    /**
+     * \brief Returns a closed connection ready to be used in an accept
+     */
+    tcp_connection::ptr acquire()
+    {
+        tcp_connection *connection = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!connections_.empty()) {
+                connection = connections_.back();
+                connections_.pop_back();
+            }
+        }
+
+        if (connection == nullptr) {
+            connection = new tcp_connection(*ioservice_);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            connection->pool_prev_ = nullptr;
+            connection->pool_next_ = active_;
+            if (active_ != nullptr) {
+                active_->pool_prev_ = connection;
+            }
+            active_ = connection;
+        }
+
+        ptr self = shared_from_this();
+        return tcp_connection::ptr(connection, recycler(self), block_allocator<tcp_connection>(self));
+    }
+
+    /**
+     * \brief Sets the maximum number of idle connections kept for reuse
+     */
+    void set_capacity(size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = capacity;
+        while (connections_.size() > capacity_) {
+            delete connections_.back();
+            connections_.pop_back();
+        }
+        connections_.reserve(capacity_);
+        blocks_.reserve(2*capacity_);
+    }
+
+    /**
+     * \brief Returns the connections currently handed out by the pool
+     */
+    std::vector<tcp_connection::ptr> active() const
+    {
+        std::vector<tcp_connection::ptr> result;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (tcp_connection *connection = active_; connection != nullptr; connection = connection->pool_next_) {
+            try {
+                result.push_back(connection->shared_from_this());
+            } catch (const std::bad_weak_ptr&) {
+                // last reference is gone, release() is waiting for the lock
+            }
+        }
+        return result;
+    }
+
+    /**
+     * \return Number of idle connections waiting to be reused
+     */
+    size_t idle() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return connections_.size();
+    }
+
+private:
+
+    tcp_connection_pool(std::shared_ptr<boost::asio::io_service> ioservice, size_t capacity)
+     : ioservice_(std::move(ioservice))
+     , capacity_(capacity)
+     , block_size_(0)
+     , active_(nullptr)
+    {
+        connections_.reserve(capacity);
+        blocks_.reserve(2*capacity);
+    }
+
+    /**
+     * Invoked by the \c shared_ptr when the last reference goes away
+     *
+     * The control block, deleter included, outlives the connection's last
+     * reference for as long as the weak_ptr in enable_shared_from_this,
+     * which lives in the recycled connection. The pool is let go once the
+     * connection is back, or the two would keep each other alive.
+     */
+    struct recycler {
+        mutable ptr pool;
+
+        recycler(ptr pool)
+         : pool(std::move(pool))
+        { }
+
+        void operator()(tcp_connection *connection) const
+        {
+            ptr owner;
+            owner.swap(pool);
+            owner->release(connection);
+        }
+    };
+
+    /**
+     * Allocates \c shared_ptr control blocks from the pool, or from the
+     * heap once it is gone
+     */
+    template <typename T>
+    struct block_allocator {
+        typedef T value_type;
+
+        std::weak_ptr<tcp_connection_pool> pool;
+
+        block_allocator(ptr pool)
+         : pool(std::move(pool))
+        { }
+
+        template <typename U>
+        block_allocator(const block_allocator<U>& other)
+         : pool(other.pool)
+        { }
+
+        T* allocate(size_t n)
+        {
+            ptr owner = pool.lock();
+            return static_cast<T*>(owner ? owner->allocate_block(n * sizeof(T))
+                                         : ::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(T *p, size_t n)
+        {
+            ptr owner = pool.lock();
+            if (owner) {
+                owner->deallocate_block(p, n * sizeof(T));
+            } else {
+                ::operator delete(p);
+            }
+        }
+
+        template <typename U>
+        bool operator==(const block_allocator<U>& other) const
+        {
+            return !pool.owner_before(other.pool) && !other.pool.owner_before(pool);
+        }
+
+        template <typename U>
+        bool operator!=(const block_allocator<U>& other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    // first, so the connections are gone before it
+    std::shared_ptr<boost::asio::io_service> ioservice_;
+    mutable std::mutex                       mutex_;
+    size_t                                   capacity_;
+    size_t                                   block_size_;
+    std::vector<tcp_connection*>             connections_;
+    std::vector<void*>                       blocks_;
+    tcp_connection                          *active_;
+
+    void release(tcp_connection *connection)
+    {
+        connection->reset();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (connection->pool_prev_ != nullptr) {
+                connection->pool_prev_->pool_next_ = connection->pool_next_;
+            } else {
+                active_ = connection->pool_next_;
+            }
+            if (connection->pool_next_ != nullptr) {
+                connection->pool_next_->pool_prev_ = connection->pool_prev_;
+            }
+
+            if (connections_.size() < capacity_) {
+                connections_.push_back(connection);
+                return;
+            }
+        }
+
+        delete connection;
+    }
+
+    void* allocate_block(size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (block_size_ == 0) {
+                block_size_ = bytes;
+            }
+            if (bytes == block_size_ && !blocks_.empty()) {
+                void *block = blocks_.back();
+                blocks_.pop_back();
+                return block;
+            }
+        }
+        return ::operator new(bytes);
+    }
+
+    void deallocate_block(void *block, size_t bytes)
+    {
+        {
+            // a connection holds up to two blocks: its own and the one still
+            // referenced by the expired weak_ptr in enable_shared_from_this
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (bytes == block_size_ && blocks_.size() < 2*capacity_) {
+                blocks_.push_back(block);
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_tcp_connection_pool_hpp__
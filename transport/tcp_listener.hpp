@@ -8,6 +8,12 @@
 #define transport_tcp_listener_hpp__
 
 #include "transport/tcp_connection.hpp"
+#include "transport/tcp_connection_pool.hpp"
+#include "transport/timing_wheel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <stdexcept>
 #include <thread>
 
 namespace et {
@@ -24,6 +30,15 @@ public:
     typedef std::function<void(boost::system::error_code,
                                tcp_connection::ptr)> Handler_Type;
 
+    /**
+     * @brief What \c shutdown() did with the open connections
+     */
+    struct shutdown_report {
+        size_t idle_closed; ///< Closed right away, nothing was in flight
+        size_t drained;     ///< Closed once in-flight operations completed
+        size_t aborted;     ///< Still busy when the deadline expired
+    };
+
     /**
      * @brief Constructor
      *
@@ -34,13 +49,27 @@ public:
                  std::string ip = "")
      : ip_(ip)
      , port_(port)
-     , work_(ioservice_)
-     , acceptor_(ioservice_)
+     , ioservice_(std::make_shared<boost::asio::io_service>())
+     , work_(*ioservice_)
+     , acceptor_(*ioservice_)
+     , strand_(*ioservice_)
      , threads_(THREADS)
+     , running_(false)
+     , pool_(tcp_connection_pool::create(ioservice_))
+     , idle_timeout_(0)
+     , read_timeout_(0)
+     , tick_(std::chrono::milliseconds(100))
+     , next_wheel_(0)
     { }
 
     ~tcp_listener() {
         stop();
+
+        // handlers of operations that completed after the threads were gone
+        // hold their connections, which hold the pool and the io_service;
+        // run them here instead of leaking the lot
+        ioservice_->reset();
+        ioservice_->poll();
     }
 
     void set_threads(int32_t threads)
@@ -48,18 +77,57 @@ public:
         threads_.resize(threads);
     }
 
+    /**
+     * @brief Sets how many closed connections are kept around for reuse
+     */
+    void set_pool_capacity(size_t capacity)
+    {
+        pool_->set_capacity(capacity);
+    }
+
+    /**
+     * @brief Sets timeouts applied to every accepted connection
+     *
+     * One timing wheel is created per thread and connections are spread
+     * among them, so arming timers does not contend on a single lock.
+     *
+     * @param idle Close connections without I/O for this long, zero disables it
+     * @param read Fail reads taking longer than this, zero disables it
+     * @param tick Timeout granularity
+     *
+     * @remarks Must be called before \c start()
+     */
+    void set_timeouts(timing_wheel::clock::duration idle,
+                      timing_wheel::clock::duration read,
+                      timing_wheel::clock::duration tick = std::chrono::milliseconds(100))
+    {
+        idle_timeout_ = idle;
+        read_timeout_ = read;
+        tick_ = tick;
+    }
+
     template <typename Handler>
     void start(Handler handler)
     {
         connection_handler_ = Handler_Type{std::move(handler)};
 
-        ioservice_.reset(); // allows to start() -> stop() -> start()
+        ioservice_->reset(); // allows to start() -> stop() -> start()
+
+        wheels_.clear();
+        if (idle_timeout_ != timing_wheel::clock::duration(0) ||
+            read_timeout_ != timing_wheel::clock::duration(0)) {
+            for (size_t i = 0; i < threads_.size(); ++i) {
+                wheels_.push_back(timing_wheel::create(*ioservice_, tick_));
+                wheels_.back()->start();
+            }
+        }
 
         for (auto& thread: threads_) {
             thread = std::thread([this] {
-                ioservice_.run();
+                ioservice_->run();
             });
         }
+        running_ = true;
 
         boost::asio::ip::tcp::endpoint endpoint;
         if (ip_.empty()) {
@@ -78,36 +146,159 @@ public:
 
     void stop()
     {
-        acceptor_.close();
-        ioservice_.stop();
+        // the wheels' timers are cancelled by the io threads, which must
+        // still be running for that
+        std::vector<std::future<void>> stopped;
+        for (const timing_wheel::ptr& wheel : wheels_) {
+            std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+            stopped.push_back(done->get_future());
+            wheel->stop([done] {
+                done->set_value();
+            });
+        }
+        if (running_) {
+            for (std::future<void>& f : stopped) {
+                f.wait();
+            }
+        }
+
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+        ioservice_->stop();
         for (auto& thread : threads_) {
-            thread.join();
+            if (thread.joinable()) {
+                thread.join();
+            }
         }
+        running_ = false;
 
         connection_handler_ = Handler_Type();
     }
 
+    /**
+     * @brief Stops accepting and closes open connections gracefully
+     *
+     * Idle connections are closed immediately, the others are given until
+     * \p deadline to finish their in-flight reads and writes, and to release
+     * what the application \c hold()s. Whatever is still busy by then is
+     * aborted and the listener is stopped.
+     *
+     * When the listener is not running, the io_service is run by the calling
+     * thread until the connections are done or the deadline expires.
+     *
+     * @remarks Blocks, so it must not be called from the listener's threads
+     */
+    shutdown_report shutdown(std::chrono::steady_clock::time_point deadline)
+    {
+        if (ioservice_->get_executor().running_in_this_thread()) {
+            throw std::logic_error("tcp_listener::shutdown: called from an io thread");
+        }
+
+        bool running = running_;
+        tcp_connection::ptr accepting;
+        if (running) {
+            std::promise<tcp_connection::ptr> closed;
+            strand_.post([this, &closed] {
+                boost::system::error_code ignored;
+                acceptor_.close(ignored);
+                closed.set_value(accepting_);
+            });
+            accepting = closed.get_future().get();
+        } else {
+            boost::system::error_code ignored;
+            acceptor_.close(ignored);
+            accepting = accepting_;
+            ioservice_->reset();
+        }
+
+        // the one waiting in async_accept() was never handed out
+        std::vector<tcp_connection::ptr> connections = pool_->active();
+        connections.erase(std::remove(connections.begin(), connections.end(), accepting),
+                          connections.end());
+
+        for (const tcp_connection::ptr& connection : connections) {
+            if (running) {
+                connection->strand().post([connection] {
+                    connection->drain();
+                });
+            } else {
+                connection->drain();
+            }
+        }
+
+        auto busy = [&connections] {
+            for (const tcp_connection::ptr& connection : connections) {
+                tcp_connection::drain_state state = connection->state();
+                if (state == tcp_connection::active || state == tcp_connection::draining) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        while (busy() && std::chrono::steady_clock::now() < deadline) {
+            if (running) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            } else {
+                ioservice_->run_one_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        stop();
+
+        shutdown_report report = { 0, 0, 0 };
+        for (const tcp_connection::ptr& connection : connections) {
+            connection->abort(); // no-op unless still busy
+            switch (connection->state()) {
+                case tcp_connection::closed_idle: ++report.idle_closed; break;
+                case tcp_connection::drained:     ++report.drained;     break;
+                default:                          ++report.aborted;     break;
+            }
+        }
+
+        return report;
+    }
+
     void async_accept()
     {
-        tcp_connection::ptr connection = std::make_shared<tcp_connection>(ioservice_);
-        acceptor_.async_accept(connection->socket(), [=](const boost::system::error_code& error) {
-            if (error != 0) {
-                connection_handler_(error, tcp_connection::ptr());
+        accepting_ = pool_->acquire();
+        acceptor_.async_accept(accepting_->socket(),
+                               boost::asio::bind_executor(strand_, [this](const boost::system::error_code& error) {
+            // the handler holds no connection, one left queued when the
+            // io_service is destroyed would keep it, and the pool, alive
+            tcp_connection::ptr connection = std::move(accepting_);
+            if (error) {
+                if (connection_handler_) {
+                    connection_handler_(error, tcp_connection::ptr());
+                }
             } else {
+                if (!wheels_.empty()) {
+                    connection->set_timeouts(wheels_[next_wheel_++ % wheels_.size()],
+                                             idle_timeout_, read_timeout_);
+                }
                 connection_handler_(std::move(error), std::move(connection));
                 async_accept();
             }
-        });
+        }));
     }
 
 protected:
-    std::string                    ip_;
-    uint16_t                       port_;
-    boost::asio::io_service        ioservice_;
-    boost::asio::io_service::work  work_;
-    boost::asio::ip::tcp::acceptor acceptor_;
-    std::vector<std::thread>       threads_;
-    Handler_Type                   connection_handler_;
+    std::string                              ip_;
+    uint16_t                                 port_;
+    std::shared_ptr<boost::asio::io_service> ioservice_;  // shared with the pool, connections may outlive the listener
+    boost::asio::io_service::work            work_;
+    boost::asio::ip::tcp::acceptor           acceptor_;
+    boost::asio::io_service::strand          strand_;     // accept handlers and shutdown()
+    std::vector<std::thread>                 threads_;
+    std::atomic<bool>                        running_;    // threads_ are running the io_service
+    Handler_Type                             connection_handler_;
+    tcp_connection_pool::ptr                 pool_;
+    tcp_connection::ptr                      accepting_;  // waiting in async_accept()
+    timing_wheel::clock::duration            idle_timeout_;
+    timing_wheel::clock::duration            read_timeout_;
+    timing_wheel::clock::duration            tick_;
+    std::vector<timing_wheel::ptr>           wheels_;
+    std::atomic<size_t>                      next_wheel_;
 };
 
 } // namespace transport
@@ -0,0 +1,359 @@
+/**
+ * \file timing_wheel.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_timing_wheel_hpp__
+#define transport_timing_wheel_hpp__
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Hierarchical timing wheel with coarse ticks
+ *
+ * Timers live in intrusive lists hanging from the wheel slots, so arming,
+ * cancelling and re-arming a timer are O(1) and never allocate. There are
+ * \c LEVELS wheels of \c SLOTS slots each, every level being \c SLOTS times
+ * coarser than the one below; timers in upper levels are cascaded down as
+ * the lower wheel wraps around.
+ *
+ * The wheel advances by itself once \c start() is called, using a single
+ * \c steady_timer on the given io_service that fires once per tick. The
+ * timer is only touched from a strand, \c start() and \c stop() included.
+ *
+ * Expiry callbacks run with the wheel lock held, which lets owners cancel
+ * their timer from any thread without racing against an expiration in
+ * progress. They must be quick and must not call back into the wheel.
+ */
+class timing_wheel
+    : public std::enable_shared_from_this<timing_wheel>
+{
+public:
+    typedef std::shared_ptr<timing_wheel>     ptr;
+    typedef std::chrono::steady_clock         clock;
+
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned SLOTS     = 1 << SLOT_BITS;
+    static const unsigned LEVELS    = 4;
+
+    /**
+     * \brief Intrusive timer hook, derive from it and embed it in the owner
+     */
+    class timer
+    {
+    public:
+        timer()
+         : prev_(nullptr)
+         , next_(nullptr)
+         , head_(nullptr)
+         , expiry_(0)
+         , armed_(false)
+        { }
+
+        virtual ~timer()
+        { }
+
+        /**
+         * \return \c true if the timer is waiting in a wheel
+         *
+         * \remarks Only stable while holding the wheel lock
+         */
+        bool armed() const
+        {
+            return armed_;
+        }
+
+    protected:
+        /**
+         * \brief Called when the timer expires
+         *
+         * \param now Current tick
+         *
+         * \return The tick at which the timer must fire again, or zero to
+         * leave it disarmed
+         */
+        virtual uint64_t expired(uint64_t now) = 0;
+
+    private:
+        friend class timing_wheel;
+
+        timer   *prev_;
+        timer   *next_;
+        timer  **head_; // slot the timer is linked into
+        uint64_t expiry_;
+        bool     armed_;
+    };
+
+    /**
+     * \brief Creates a wheel advancing every \p tick
+     */
+    static ptr create(boost::asio::io_service& ioservice,
+                      clock::duration tick = std::chrono::milliseconds(100))
+    {
+        return ptr(new timing_wheel(ioservice, tick));
+    }
+
+    ~timing_wheel()
+    {
+        // no tick handler runs, they hold the wheel while they do
+        running_ = false;
+        boost::system::error_code ignored;
+        timer_.cancel(ignored);
+    }
+
+    /**
+     * \brief Starts driving the wheel from the io_service
+     */
+    void start()
+    {
+        running_ = true;
+        ptr self = shared_from_this();
+        strand_.post([self] {
+            self->schedule_tick();
+        });
+    }
+
+    /**
+     * \brief Stops driving the wheel, armed timers stay armed
+     *
+     * The timer is cancelled later, from the io_service.
+     */
+    void stop()
+    {
+        stop([] { });
+    }
+
+    /**
+     * \brief Stops driving the wheel and calls \p handler once the timer
+     * is cancelled, from a thread running the io_service
+     */
+    template <typename Handler>
+    void stop(Handler handler)
+    {
+        running_ = false;
+        ptr self = shared_from_this();
+        strand_.post([self, handler] {
+            boost::system::error_code ignored;
+            self->timer_.cancel(ignored);
+            handler();
+        });
+    }
+
+    /**
+     * \return The current tick, cheap enough to be called on every I/O
+     */
+    uint64_t now() const
+    {
+        return now_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * \return Number of whole ticks in \p duration, rounded up
+     */
+    uint64_t ticks(clock::duration duration) const
+    {
+        return uint64_t((duration + tick_ - clock::duration(1)) / tick_);
+    }
+
+    /**
+     * \brief Arms \p t to expire at tick \p expiry, re-arming it if needed
+     *
+     * Expiries in the past fire on the next tick.
+     */
+    void arm(timer& t, uint64_t expiry)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (t.armed_) {
+            unlink(t);
+        }
+        t.expiry_ = expiry;
+        link(t, now_.load(std::memory_order_relaxed) + 1);
+    }
+
+    /**
+     * \brief Disarms \p t, it is fine if it is not armed
+     */
+    void cancel(timer& t)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (t.armed_) {
+            unlink(t);
+        }
+    }
+
+    /**
+     * \brief Expires everything due up to and including tick \p until
+     *
+     * Normally called by the wheel itself, exposed to drive it by hand.
+     */
+    void advance(uint64_t until)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t current = now_.load(std::memory_order_relaxed);
+        while (current < until) {
+            ++current;
+            now_.store(current, std::memory_order_relaxed);
+
+            // cascade upper levels whenever the level below wraps
+            for (unsigned level = 1; level < LEVELS; ++level) {
+                if ((current & mask(level - 1)) != 0) {
+                    break;
+                }
+                timer *head = take(level, slot(current, level));
+                while (head != nullptr) {
+                    timer *next = head->next_;
+                    link(*head, current);
+                    head = next;
+                }
+            }
+
+            timer *head = take(0, slot(current, 0));
+            while (head != nullptr) {
+                timer *next = head->next_;
+                uint64_t expiry = head->expired(current);
+                if (expiry != 0) {
+                    head->expiry_ = expiry;
+                    link(*head, current + 1);
+                }
+                head = next;
+            }
+        }
+    }
+
+    /**
+     * \return Number of armed timers
+     */
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+private:
+
+    timing_wheel(boost::asio::io_service& ioservice, clock::duration tick)
+     : tick_(tick)
+     , strand_(ioservice)
+     , timer_(ioservice)
+     , now_(0)
+     , size_(0)
+     , running_(false)
+    {
+        for (auto& level : wheel_) {
+            level.fill(nullptr);
+        }
+    }
+
+    clock::duration                 tick_;
+    boost::asio::io_service::strand strand_;
+    boost::asio::steady_timer       timer_;  // only touched from strand_
+    std::atomic<uint64_t>           now_;
+    size_t                          size_;
+    std::atomic<bool>               running_;
+    mutable std::mutex              mutex_;
+
+    std::array<std::array<timer*, SLOTS>, LEVELS> wheel_;
+
+    static uint64_t mask(unsigned level)
+    {
+        return (uint64_t(1) << (SLOT_BITS * (level + 1))) - 1;
+    }
+
+    static unsigned slot(uint64_t tick, unsigned level)
+    {
+        return unsigned(tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+    }
+
+    /**
+     * Links \p t into its slot, expiries before \p earliest are moved there
+     */
+    void link(timer& t, uint64_t earliest)
+    {
+        uint64_t current = now_.load(std::memory_order_relaxed);
+        uint64_t expiry  = t.expiry_ > earliest ? t.expiry_ : earliest;
+
+        unsigned level = 0;
+        while (level < LEVELS - 1 && ((expiry ^ current) & ~mask(level)) != 0) {
+            ++level;
+        }
+        if (((expiry ^ current) & ~mask(LEVELS - 1)) != 0) {
+            // beyond the wheel range, park it in the slot cascaded when the
+            // top level wraps around, it is linked again from there
+            expiry = 0;
+            level  = LEVELS - 1;
+        }
+
+        timer*& head = wheel_[level][slot(expiry, level)];
+        t.prev_ = nullptr;
+        t.next_ = head;
+        t.head_ = &head;
+        if (head != nullptr) {
+            head->prev_ = &t;
+        }
+        head = &t;
+        t.armed_ = true;
+        ++size_;
+    }
+
+    void unlink(timer& t)
+    {
+        if (t.prev_ != nullptr) {
+            t.prev_->next_ = t.next_;
+        } else {
+            *t.head_ = t.next_;
+        }
+        if (t.next_ != nullptr) {
+            t.next_->prev_ = t.prev_;
+        }
+        t.prev_  = nullptr;
+        t.next_  = nullptr;
+        t.head_  = nullptr;
+        t.armed_ = false;
+        --size_;
+    }
+
+    timer* take(unsigned level, unsigned index)
+    {
+        timer *head = wheel_[level][index];
+        wheel_[level][index] = nullptr;
+        for (timer *t = head; t != nullptr; t = t->next_) {
+            t->armed_ = false;
+            --size_;
+        }
+        return head;
+    }
+
+    void schedule_tick()
+    {
+        if (!running_) {
+            return;
+        }
+
+        std::weak_ptr<timing_wheel> self = shared_from_this();
+        timer_.expires_from_now(tick_);
+        timer_.async_wait(boost::asio::bind_executor(strand_, [self](const boost::system::error_code& error) {
+            ptr wheel = self.lock();
+            if (!error && wheel) {
+                wheel->advance(wheel->now() + 1);
+                wheel->schedule_tick();
+            }
+        }));
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_timing_wheel_hpp__
@@ -7,13 +7,35 @@
 #ifndef transport_udp_connection_hpp__
 #define transport_udp_connection_hpp__
 
+#include "transport/__buffer.hpp"
+#include "transport/busy_poll.hpp"
+#include "transport/kernel_timestamps.hpp"
+
 #include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/enable_shared_from_this.hpp>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstring>
 #include <memory>
+#include <vector>
+
+#if defined(__linux__)
+ #include <sys/socket.h>
+ #include <netinet/in.h>
+ #include <netinet/udp.h>
+ #include <errno.h>
+
+ #ifndef UDP_SEGMENT
+  #define UDP_SEGMENT 103
+ #endif
+ #ifndef UDP_GRO
+  #define UDP_GRO 104
+ #endif
+#endif
 
 namespace et {
 namespace transport {
@@ -30,12 +52,62 @@ public:
     typedef boost::asio::ip::udp::resolver resolver_type;
     typedef boost::asio::ip::udp::endpoint endpoint_type;
 
+    /**
+     * A datagram to send with \c send_batch_to, the referenced memory must
+     * remain valid until the completion handler is called
+     */
+    struct datagram {
+        boost::asio::const_buffer data;
+        endpoint_type             endpoint;
+
+        datagram(boost::asio::const_buffer data, endpoint_type endpoint)
+         : data(data)
+         , endpoint(endpoint)
+        { }
+    };
+
+    /**
+     * A datagram delivered by \c receive(), \c data points into the
+     * connection's receive buffers and is only valid inside the handler
+     */
+    struct received_datagram {
+        endpoint_type             endpoint;
+        boost::asio::const_buffer data;
+        bool                      truncated;   ///< Did not fit in a receive buffer
+        boost::asio::ip::address  destination; ///< Only with \c enable_destination_info()
+        uint64_t                  timestamp;   ///< Kernel receive time, only with \c enable_timestamps()
+    };
+
+    typedef std::vector<received_datagram> received_batch;
+
+    /**
+     * Maximum number of datagrams handed to the kernel in one call
+     */
+    static const size_t MAX_BATCH = 1024;
+
+    /**
+     * Largest possible UDP payload
+     */
+    static const size_t MAX_DATAGRAM = 65536;
+
+    /**
+     * Most segments the kernel accepts in a single GSO send
+     */
+    static const size_t MAX_GSO_SEGMENTS = 64;
 
 public:
 
     udp_connection(boost::asio::io_service& ioservice)
-     : socket_(ioservice)
+     : ioservice_(ioservice)
+     , socket_(ioservice)
      , resolver_(ioservice)
+     , receive_count_(64)
+     , receive_size_(2048)
+     , gro_(false)
+     , gso_(gso_unknown)
+     , gso_sent_(0)
+     , gso_segment_(0)
+     , gso_addressed_(false)
     { }
 
     socket_type& socket()
@@ -43,6 +115,11 @@ public:
         return socket_;
     }
 
+    boost::asio::io_service& get_io_service()
+    {
+        return ioservice_;
+    }
+
     template <
         typename Connect_Handler>
     void connect(const std::string& host,
@@ -52,7 +129,7 @@ public:
         resolver_type::query query(host, boost::lexical_cast<std::string>(port));
         resolver_.async_resolve(query,
                                 [this, callback](const error_code& error, resolver_type::iterator it) {
-                                    if (error != 0) {
+                                    if (error) {
                                         callback(error);
                                     } else {
                                         /* From connect's man page: http://linux.die.net/man/3/connect
@@ -76,76 +153,941 @@ public:
         typename Read_Handler>
     void read(Read_Handler callback)
     {
-        socket_.async_receive(boost::asio::null_buffers(), [=](const error_code& error) {
-            if (error != 0) {
-                callback(error, endpoint_type(), buffer_type());
-            } else {
-                std::shared_ptr<udp_read_cb_data> read_data = std::make_shared<udp_read_cb_data>(socket_.available());
-                socket_.async_receive_from(boost::asio::buffer(read_data->buffer, read_data->buffer.size()),
-                                           read_data->endpoint,
-                                           [=](const error_code& error, size_t bytes_transferred) {
-                                               if (!error) {
-                                                   read_data->buffer.resize(bytes_transferred);
-                                               }
-                                               callback(error, read_data->endpoint, read_data->buffer);
-                                           });
+        read_buffer_.resize(MAX_DATAGRAM);
+        socket_.async_receive_from(boost::asio::buffer(read_buffer_),
+                                   read_endpoint_,
+                                   [this, callback](const error_code& error, size_t bytes_transferred) {
+                                       if (error) {
+                                           callback(error, endpoint_type(), buffer_type());
+                                       } else {
+                                           callback(error,
+                                                    read_endpoint_,
+                                                    buffer_type(read_buffer_.begin(),
+                                                                read_buffer_.begin() + bytes_transferred));
+                                       }
+                                   });
+    }
+
+    /**
+     * \brief Sets the buffers used by \c receive()
+     *
+     * \param count Maximum number of datagrams delivered per batch
+     * \param size Size of each buffer, longer datagrams are truncated
+     *
+     * \remarks Must not be called while a receive loop is running
+     */
+    void set_receive_buffers(size_t count, size_t size)
+    {
+        receive_count_ = std::min(count, size_t(MAX_BATCH));
+        receive_size_ = size;
+        ring_.reset();
+    }
+
+    /**
+     * \brief Reports the destination address of each datagram received by \c receive()
+     *
+     * Needed to tell apart datagrams sent to different multicast groups on
+     * the same port.
+     *
+     * \return \c false if the platform does not support it
+     */
+    bool enable_destination_info()
+    {
+#if defined(__linux__)
+        int on = 1;
+        int fd = socket_.native_handle();
+        if (socket_.local_endpoint().protocol() == boost::asio::ip::udp::v6()) {
+            return ::setsockopt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on)) == 0;
+        }
+        return ::setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) == 0;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * \brief Enables kernel timestamps, see \c kernel_timestamps
+     *
+     * Receive timestamps show up in \c received_datagram::timestamp,
+     * transmit timestamps are read with \c receive_tx_timestamps().
+     *
+     * \return The flags actually enabled
+     */
+    unsigned enable_timestamps(unsigned flags = kernel_timestamps::rx | kernel_timestamps::tx)
+    {
+        return kernel_timestamps::enable(socket_.native_handle(), flags);
+    }
+
+    /**
+     * \brief Starts a loop reading transmit timestamps
+     *
+     * Every datagram sent gets the next id, starting from zero when
+     * timestamps were enabled; a GSO send gets a single one.
+     *
+     * The loop keeps going until an error occurs, which is passed to
+     * \p handler with zero id and timestamp. Close the socket to stop it.
+     *
+     * \param handler Function to call for every timestamp:
+     * \code handler(error_code: boost::system::error_code, id: uint32_t, timestamp: uint64_t) \endcode
+     */
+    template <
+        typename Timestamp_Handler>
+    void receive_tx_timestamps(Timestamp_Handler handler)
+    {
+        socket_.async_wait(socket_type::wait_error,
+                           [this, handler](const error_code& error) {
+                               if (error) {
+                                   handler(error, 0, 0);
+                                   return;
+                               }
+                               error_code result;
+                               kernel_timestamps::receive_tx(socket_.native_handle(),
+                                                             [&handler](uint32_t id, uint64_t timestamp) {
+                                                                 handler(error_code(), id, timestamp);
+                                                             },
+                                                             result);
+                               if (result && result != boost::asio::error::would_block) {
+                                   handler(result, 0, 0);
+                                   return;
+                               }
+                               receive_tx_timestamps(handler);
+                           });
+    }
+
+    /**
+     * \brief Asks the kernel to coalesce incoming datagrams (UDP_GRO)
+     *
+     * Coalesced datagrams are split back by \c receive() using the segment
+     * size reported by the kernel, handlers see no difference. Receive
+     * buffers are enlarged to hold a whole coalesced chunk.
+     *
+     * \return \c false if the platform does not support it, nothing changes
+     */
+    bool enable_gro()
+    {
+#if defined(__linux__)
+        int on = 1;
+        if (::setsockopt(socket_.native_handle(), SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0) {
+            gro_ = true;
+            set_receive_buffers(receive_count_, std::max(receive_size_, size_t(MAX_DATAGRAM)));
+            return true;
+        }
+#endif
+        return false;
+    }
+
+    /**
+     * \return \c true if sends can be segmented by the kernel (UDP_SEGMENT)
+     *
+     * \remarks The socket must be open
+     */
+    bool gso_supported()
+    {
+        if (gso_ == gso_unknown) {
+            gso_ = gso_unsupported;
+#if defined(__linux__)
+            int segment = 0;
+            socklen_t length = sizeof(segment);
+            if (::getsockopt(socket_.native_handle(), SOL_UDP, UDP_SEGMENT, &segment, &length) == 0) {
+                gso_ = gso_available;
             }
+#endif
+        }
+        return gso_ == gso_available;
+    }
+
+    /**
+     * \brief Starts a receive loop delivering datagrams in batches
+     *
+     * Datagrams are received straight into a preallocated set of buffers,
+     * on Linux with a single \c recvmmsg call per batch. The buffers are
+     * reused as soon as \p handler returns, so it must copy whatever it
+     * wants to keep.
+     *
+     * The loop keeps going until an error occurs, which is passed to
+     * \p handler along with an empty batch. Close the socket to stop it.
+     *
+     * \param handler Function to call for every batch:
+     * \code handler(error_code: boost::system::error_code, batch: const received_batch&) \endcode
+     */
+    template <
+        typename Batch_Handler>
+    void receive(Batch_Handler handler)
+    {
+        if (!ring_) {
+            ring_.reset(new receive_ring(receive_count_, receive_size_, gro_ ? size_t(MAX_GSO_SEGMENTS) : size_t(1)));
+        }
+
+        socket_.async_receive(boost::asio::null_buffers(),
+                              [this, handler](const error_code& error, size_t) {
+                                  if (error) {
+                                      ring_->batch.clear();
+                                      handler(error, ring_->batch);
+                                  } else {
+                                      receive_available(handler);
+                                  }
+                              });
+    }
+
+    /**
+     * \brief Sets \c SO_BUSY_POLL on the socket, see \c busy_poll::enable
+     */
+    bool enable_busy_poll(unsigned usec = 50)
+    {
+        return busy_poll::enable(socket_.native_handle(), usec);
+    }
+
+    /**
+     * \brief Receives one batch without blocking, \p handler is called
+     * inline if there was anything to receive
+     *
+     * Uses the same buffers as \c receive(), the two must not be mixed.
+     *
+     * \return Datagrams received; \p error is set on failure, but not when
+     * the socket was merely empty
+     */
+    template <
+        typename Batch_Handler>
+    size_t poll_receive(Batch_Handler&& handler, error_code& error)
+    {
+        if (!ring_) {
+            ring_.reset(new receive_ring(receive_count_, receive_size_, gro_ ? size_t(MAX_GSO_SEGMENTS) : size_t(1)));
+        }
+        receive_some(*ring_, error);
+        if (error == boost::asio::error::would_block) {
+            error = error_code();
+            return 0;
+        }
+        if (!error && !ring_->batch.empty()) {
+            handler(error, ring_->batch);
+        }
+        return error ? 0 : ring_->batch.size();
+    }
+
+    /**
+     * \brief Receives in a tight loop on the calling thread, which it takes
+     * over until \p running is cleared or an error occurs
+     *
+     * Nothing goes through the io_service: \p handler is called inline as
+     * soon as datagrams are in the socket, and an empty socket means a spin,
+     * never a sleep. Meant for a dedicated thread, ideally \c busy_poll::pin()ned,
+     * combined with \c enable_busy_poll().
+     *
+     * \param handler Same as for \c receive(), which must not be running
+     * \param running Cleared by another thread to stop the loop
+     */
+    template <
+        typename Batch_Handler>
+    void busy_receive(Batch_Handler handler, const std::atomic<bool>& running)
+    {
+        busy_poll::run(running, [&](size_t& progress) {
+            error_code error;
+            progress = poll_receive(handler, error);
+            if (error) {
+                ring_->batch.clear();
+                handler(error, ring_->batch);
+                return false;
+            }
+            return true;
         });
     }
 
+    /**
+     * \brief Sends \p data as a single datagram to the connected peer
+     *
+     * The send owns \p data, any number of them may be in flight.
+     *
+     * \param data Datagram payload
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code) \endcode
+     */
+    template <
+        typename Write_Handler>
+    void send(std::vector<char> data,
+              Write_Handler callback)
+    {
+        std::shared_ptr<std::vector<char>> payload = std::make_shared<std::vector<char>>(std::move(data));
+        socket_.async_send(boost::asio::buffer(*payload),
+                           [payload, callback](const error_code& error, size_t) {
+                               callback(error);
+                           });
+    }
+
+    /**
+     * \brief Sends \p data as a single datagram to \p endpoint
+     *
+     * \see send
+     *
+     * \param data Datagram payload
+     * \param endpoint Destination
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code) \endcode
+     */
+    template <
+        typename Write_Handler>
+    void send_to(std::vector<char> data,
+                 const endpoint_type& endpoint,
+                 Write_Handler callback)
+    {
+        std::shared_ptr<std::vector<char>> payload = std::make_shared<std::vector<char>>(std::move(data));
+        socket_.async_send_to(boost::asio::buffer(*payload),
+                              endpoint,
+                              [payload, callback](const error_code& error, size_t) {
+                                  callback(error);
+                              });
+    }
+
+    /**
+     * \brief Sends the content of \p data as a single datagram to the connected peer
+     *
+     * The buckets are gathered by the kernel, nothing is copied. A datagram
+     * can span at most \c MAX_GATHER buckets, \p callback gets
+     * \c message_size for longer chains.
+     *
+     * \param data Datagram payload, it must not be modified until \p callback is called
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code) \endcode
+     */
+    template <
+        typename T,
+        size_t   Size,
+        typename Write_Handler>
+    void send(const buffer<T, Size>& data,
+              Write_Handler callback)
+    {
+        if (data.buckets() > MAX_GATHER) {
+            ioservice_.post([callback] {
+                callback(error_code(boost::asio::error::message_size));
+            });
+            return;
+        }
+        socket_.async_send(data.data(),
+                           [callback](const error_code& error, size_t) {
+                               callback(error);
+                           });
+    }
+
+    /**
+     * \brief Sends the content of \p data as a single datagram to \p endpoint
+     *
+     * \see send
+     */
+    template <
+        typename T,
+        size_t   Size,
+        typename Write_Handler>
+    void send_to(const buffer<T, Size>& data,
+                 const endpoint_type& endpoint,
+                 Write_Handler callback)
+    {
+        if (data.buckets() > MAX_GATHER) {
+            ioservice_.post([callback] {
+                callback(error_code(boost::asio::error::message_size));
+            });
+            return;
+        }
+        socket_.async_send_to(data.data(),
+                              endpoint,
+                              [callback](const error_code& error, size_t) {
+                                  callback(error);
+                              });
+    }
+
+    /**
+     * \brief Sends \p data as a single datagram to the connected peer
+     *
+     * Nothing is copied, the send holds a reference to the buckets until it
+     * is done. Use \c buffer_slice::share() first if this connection is
+     * served by another thread. At most \c MAX_GATHER buckets, as for
+     * \c buffer.
+     *
+     * \param data Datagram payload
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code) \endcode
+     */
+    template <
+        typename T,
+        size_t   Size,
+        typename Write_Handler>
+    void send(const buffer_slice<T, Size>& data,
+              Write_Handler callback)
+    {
+        if (data.buffers() > MAX_GATHER) {
+            ioservice_.post([callback] {
+                callback(error_code(boost::asio::error::message_size));
+            });
+            return;
+        }
+        socket_.async_send(data,
+                           [callback](const error_code& error, size_t) {
+                               callback(error);
+                           });
+    }
+
+    /**
+     * \brief Sends \p data as a single datagram to \p endpoint
+     *
+     * \see send
+     */
+    template <
+        typename T,
+        size_t   Size,
+        typename Write_Handler>
+    void send_to(const buffer_slice<T, Size>& data,
+                 const endpoint_type& endpoint,
+                 Write_Handler callback)
+    {
+        if (data.buffers() > MAX_GATHER) {
+            ioservice_.post([callback] {
+                callback(error_code(boost::asio::error::message_size));
+            });
+            return;
+        }
+        socket_.async_send_to(data,
+                              endpoint,
+                              [callback](const error_code& error, size_t) {
+                                  callback(error);
+                              });
+    }
+
+    /**
+     * \brief Sends each buffer in \p datagrams as one datagram to the connected peer
+     *
+     * On Linux datagrams are submitted \c MAX_BATCH at a time with \c sendmmsg.
+     *
+     * Only one \c send_batch(), \c send_batch_to(), \c send_segmented() or
+     * \c send_segmented_to() may be in flight at a time, they share the
+     * connection's message headers; issue the next one from \p callback.
+     *
+     * \param datagrams Payloads, they must remain valid until \p callback is called
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code, sent: size_t) \endcode
+     */
+    template <
+        typename Write_Handler>
+    void send_batch(const std::vector<boost::asio::const_buffer>& datagrams,
+                    Write_Handler callback)
+    {
+        batch_.clear();
+        for (const boost::asio::const_buffer& data : datagrams) {
+            batch_.push_back(datagram(data, endpoint_type()));
+        }
+        send_batch(callback, false);
+    }
+
+    /**
+     * \brief Sends each element in \p datagrams to its own destination
+     *
+     * Only one \c send_batch(), \c send_batch_to(), \c send_segmented() or
+     * \c send_segmented_to() may be in flight at a time, they share the
+     * connection's message headers; issue the next one from \p callback.
+     *
+     * \param datagrams Payloads and destinations, they must remain valid
+     * until \p callback is called
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code, sent: size_t) \endcode
+     */
+    template <
+        typename Write_Handler>
+    void send_batch_to(const std::vector<datagram>& datagrams,
+                       Write_Handler callback)
+    {
+        batch_ = datagrams;
+        send_batch(callback, true);
+    }
+
+    /**
+     * \brief Sends \p data to the connected peer as datagrams of \p segment_size bytes
+     *
+     * The last datagram may be shorter. Where UDP_SEGMENT is available up
+     * to \c MAX_GSO_SEGMENTS datagrams are handed to the kernel in a single
+     * call, otherwise they are sent with \c send_batch().
+     *
+     * Only one \c send_batch(), \c send_batch_to(), \c send_segmented() or
+     * \c send_segmented_to() may be in flight at a time, they share the
+     * connection's message headers; issue the next one from \p callback.
+     *
+     * \param data Payload, it must remain valid until \p callback is called
+     * \param segment_size Payload bytes per datagram, zero sends a single one
+     * \param callback Function to call when done:
+     * \code callback(error_code: boost::system::error_code, sent: size_t) \endcode
+     */
+    template <
+        typename Write_Handler>
+    void send_segmented(boost::asio::const_buffer data,
+                        size_t segment_size,
+                        Write_Handler callback)
+    {
+        send_segmented(data, segment_size, endpoint_type(), false, callback);
+    }
+
+    /**
+     * \brief Sends \p data to \p endpoint as datagrams of \p segment_size bytes
+     *
+     * One at a time, see \c send_segmented
+     */
+    template <
+        typename Write_Handler>
+    void send_segmented_to(boost::asio::const_buffer data,
+                           size_t segment_size,
+                           const endpoint_type& endpoint,
+                           Write_Handler callback)
+    {
+        send_segmented(data, segment_size, endpoint, true, callback);
+    }
+
     /**
      * \brief Writes data to the socket
      *
-     * \param data Data to send
-     * \param callback Function to call when done
+     * \deprecated Same as \c send(), \p data goes out as a single datagram.
+     * Use a \c fragmenter for messages that do not fit in one.
      */
     template <
         typename Write_Handler>
     void write(std::vector<char> data,
                Write_Handler callback)
     {
-        outgoing_data_ = std::move(data);
-        write(callback, 0);
+        send(std::move(data), callback);
     }
 
 private:
 
-    struct udp_read_cb_data {
-        buffer_type   buffer;
-        endpoint_type endpoint;
+    /**
+     * Preallocated receive buffers, with their message headers pointing to
+     * them once and for all
+     */
+    struct receive_ring {
+        size_t                     size;
+        std::vector<char>          storage;
+        std::vector<endpoint_type> endpoints;
+        received_batch             batch;
+#if defined(__linux__)
+        std::vector<mmsghdr>       messages;
+        std::vector<iovec>         iovecs;
+        std::vector<char>          control;
+#endif
 
-        udp_read_cb_data(uint64_t bytes_to_read)
-         : buffer(bytes_to_read)
-        { }
+        /**
+         * \p segments is the most datagrams a message can be split into
+         */
+        receive_ring(size_t count, size_t size, size_t segments)
+         : size(size)
+         , storage(count * size)
+         , endpoints(count)
+#if defined(__linux__)
+         , messages(count)
+         , iovecs(count)
+         , control(count * CONTROL_LENGTH)
+#endif
+        {
+            batch.reserve(count * segments);
+#if defined(__linux__)
+            for (size_t i = 0; i < count; ++i) {
+                iovecs[i].iov_base = &storage[i * size];
+                iovecs[i].iov_len  = size;
+
+                msghdr& header = messages[i].msg_hdr;
+                std::memset(&header, 0, sizeof(header));
+                header.msg_iov    = &iovecs[i];
+                header.msg_iovlen = 1;
+                header.msg_name   = endpoints[i].data();
+                header.msg_control = &control[i * CONTROL_LENGTH];
+            }
+#endif
+        }
+
+        size_t count() const
+        {
+            return endpoints.size();
+        }
     };
 
-    static const uint64_t BUFFER_LENGTH = 1024;
+    /**
+     * Batches delivered per readiness notification before yielding to
+     * other handlers
+     */
+    static const size_t MAX_BATCHES_PER_WAKEUP = 16;
 
+    /**
+     * Buffers asio hands to a single send call, any more would be dropped
+     */
+    static const size_t MAX_GATHER = 64;
+
+    /**
+     * Ancillary data space reserved per received datagram
+     */
+    static const size_t CONTROL_LENGTH = 256;
+
+    enum gso_state {
+        gso_unknown,
+        gso_available,
+        gso_unsupported
+    };
+
+    boost::asio::io_service& ioservice_;
     socket_type   socket_;
     resolver_type resolver_;
 
-    std::array<char, BUFFER_LENGTH> write_buffer_;
-    std::vector<char> outgoing_data_;
+    std::vector<char>     read_buffer_;
+    endpoint_type         read_endpoint_;
+
+    size_t                        receive_count_;
+    size_t                        receive_size_;
+    bool                          gro_;  // a received message may be many datagrams
+    std::unique_ptr<receive_ring> ring_;
+
+    gso_state                 gso_;
+    boost::asio::const_buffer gso_data_;
+    size_t                    gso_sent_;
+    size_t                    gso_segment_;
+    endpoint_type             gso_endpoint_;
+    bool                      gso_addressed_;
+
+    std::vector<datagram> batch_;
+#if defined(__linux__)
+    std::vector<mmsghdr>  messages_;
+    std::vector<iovec>    iovecs_;
+#endif
+
+
+    template <
+        typename Write_Handler>
+    void send_batch(Write_Handler callback, bool addressed)
+    {
+#if defined(__linux__)
+        messages_.resize(batch_.size());
+        iovecs_.resize(batch_.size());
+        for (size_t i = 0; i < batch_.size(); ++i) {
+            const datagram& d = batch_[i];
+            iovecs_[i].iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(d.data));
+            iovecs_[i].iov_len  = boost::asio::buffer_size(d.data);
+
+            msghdr& header = messages_[i].msg_hdr;
+            std::memset(&header, 0, sizeof(header));
+            header.msg_iov    = &iovecs_[i];
+            header.msg_iovlen = 1;
+            if (addressed) {
+                header.msg_name    = const_cast<void*>(static_cast<const void*>(d.endpoint.data()));
+                header.msg_namelen = socklen_t(d.endpoint.size());
+            }
+        }
+        send_pending(callback, 0);
+#else
+        error_code error;
+        size_t sent = 0;
+        for ( ; sent < batch_.size() && !error; ++sent) {
+            if (addressed) {
+                socket_.send_to(boost::asio::buffer(batch_[sent].data), batch_[sent].endpoint, 0, error);
+            } else {
+                socket_.send(boost::asio::buffer(batch_[sent].data), 0, error);
+            }
+        }
+        if (error) {
+            --sent;
+        }
+        ioservice_.post([callback, error, sent] {
+            callback(error, sent);
+        });
+#endif
+    }
 
+    template <
+        typename Write_Handler>
+    void send_segmented(boost::asio::const_buffer data,
+                        size_t segment_size,
+                        const endpoint_type& endpoint,
+                        bool addressed,
+                        Write_Handler callback)
+    {
+        size_t size = boost::asio::buffer_size(data);
+        if (size == 0) {
+            // nothing to send, segments() would divide by zero
+            ioservice_.post([callback] {
+                callback(error_code(), size_t(0));
+            });
+            return;
+        }
+        if (segment_size == 0) {
+            segment_size = size;
+        }
+
+        if (!gso_supported()) {
+            batch_.clear();
+            for (size_t offset = 0; offset < size; offset += segment_size) {
+                batch_.push_back(datagram(boost::asio::buffer(data + offset, segment_size), endpoint));
+            }
+            send_batch(callback, addressed);
+            return;
+        }
 
+#if defined(__linux__)
+        gso_data_      = data;
+        gso_sent_      = 0;
+        gso_segment_   = segment_size;
+        gso_endpoint_  = endpoint;
+        gso_addressed_ = addressed;
+        send_segments(callback);
+#endif
+    }
+
+#if defined(__linux__)
+    /**
+     * Sends the rest of \c gso_data_, at most \c MAX_GSO_SEGMENTS at a time
+     */
     template <
         typename Write_Handler>
-    void write(Write_Handler callback, uint64_t sent)
+    void send_segments(Write_Handler callback)
+    {
+        size_t size = boost::asio::buffer_size(gso_data_);
+        size_t per_call = std::min(size_t(MAX_GSO_SEGMENTS), std::max(size_t(1), size_t(0xFFFF - 8 - 40) / gso_segment_));
+
+        while (gso_sent_ < size) {
+            size_t length = std::min(size - gso_sent_, per_call * gso_segment_);
+
+            iovec vector;
+            vector.iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(gso_data_ + gso_sent_));
+            vector.iov_len  = length;
+
+            union {
+                char    buffer[CMSG_SPACE(sizeof(uint16_t))];
+                cmsghdr align;
+            } control;
+
+            msghdr header;
+            std::memset(&header, 0, sizeof(header));
+            header.msg_iov    = &vector;
+            header.msg_iovlen = 1;
+            if (gso_addressed_) {
+                header.msg_name    = gso_endpoint_.data();
+                header.msg_namelen = socklen_t(gso_endpoint_.size());
+            }
+            if (length > gso_segment_) {
+                header.msg_control    = control.buffer;
+                header.msg_controllen = sizeof(control.buffer);
+
+                cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type  = UDP_SEGMENT;
+                cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment = uint16_t(gso_segment_);
+                std::memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+            }
+
+            ssize_t result = ::sendmsg(socket_.native_handle(), &header, MSG_DONTWAIT);
+            if (result >= 0) {
+                gso_sent_ += length;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                socket_.async_send(boost::asio::null_buffers(),
+                                   [this, callback](const error_code& error, size_t) {
+                                       if (error) {
+                                           callback(error, segments(gso_sent_));
+                                       } else {
+                                           send_segments(callback);
+                                       }
+                                   });
+                return;
+            } else if (errno == EIO && gso_sent_ == 0) {
+                // no segmentation offload on the egress device, do it ourselves
+                gso_ = gso_unsupported;
+                send_segmented(gso_data_, gso_segment_, gso_endpoint_, gso_addressed_, callback);
+                return;
+            } else if (errno != EINTR) {
+                error_code error(errno, boost::system::system_category());
+                size_t sent = segments(gso_sent_);
+                ioservice_.post([callback, error, sent] {
+                    callback(error, sent);
+                });
+                return;
+            }
+        }
+
+        size_t sent = segments(gso_sent_);
+        ioservice_.post([callback, sent] {
+            callback(error_code(), sent);
+        });
+    }
+
+    size_t segments(size_t bytes) const
+    {
+        return (bytes + gso_segment_ - 1) / gso_segment_;
+    }
+#endif
+
+    /**
+     * Drains the socket after a readiness notification, then waits again
+     */
+    template <
+        typename Batch_Handler>
+    void receive_available(Batch_Handler handler)
     {
-        size_t increment = outgoing_data_.size() - sent;
-        increment = increment < BUFFER_LENGTH ? increment : BUFFER_LENGTH;
-        memcpy(&write_buffer_[0], &outgoing_data_[sent], increment);
+        receive_ring& ring = *ring_;
+
+        for (size_t round = 0; round < MAX_BATCHES_PER_WAKEUP; ++round) {
+            error_code error;
+            size_t received = receive_some(ring, error);
+
+            if (error == boost::asio::error::would_block) {
+                receive(handler);
+                return;
+            }
+
+            if (error) {
+                ring.batch.clear();
+                handler(error, ring.batch);
+                return;
+            }
+
+            handler(error, ring.batch);
 
-        boost::asio::async_write(socket_,
-                                 boost::asio::buffer(write_buffer_, increment),
-                                 [=](const error_code& error, size_t bytes_transferred) {
-            if (error != 0 || sent+bytes_transferred == outgoing_data_.size()) {
-                callback(error);
+            if (received < ring.count()) {
+                // short batch, the queue is most likely empty; counted in
+                // messages, GRO splits them into more datagrams
+                receive(handler);
+                return;
+            }
+        }
+
+        ioservice_.post([this, handler] {
+            receive_available(handler);
+        });
+    }
+
+    /**
+     * Receives as many messages as fit in \p ring without blocking, and
+     * puts the datagrams they carry in \c ring.batch
+     *
+     * \return Messages received, coalesced ones (GRO) count once
+     */
+    size_t receive_some(receive_ring& ring, error_code& error)
+    {
+        ring.batch.clear();
+
+#if defined(__linux__)
+        int result;
+        do {
+            for (size_t i = 0; i < ring.count(); ++i) {
+                ring.messages[i].msg_hdr.msg_namelen    = socklen_t(ring.endpoints[i].capacity());
+                ring.messages[i].msg_hdr.msg_controllen = CONTROL_LENGTH;
+                ring.messages[i].msg_hdr.msg_flags      = 0;
+            }
+            result = ::recvmmsg(socket_.native_handle(), &ring.messages[0], unsigned(ring.count()), MSG_DONTWAIT, nullptr);
+        } while (result < 0 && errno == EINTR);
+
+        if (result < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                error = boost::asio::error::would_block;
             } else {
-                write(callback, sent + bytes_transferred);
+                error = error_code(errno, boost::system::system_category());
             }
+            return 0;
+        }
+
+        for (int i = 0; i < result; ++i) {
+            msghdr& header = ring.messages[i].msg_hdr;
+            ring.endpoints[i].resize(header.msg_namelen);
+
+            size_t segment = 0;
+            uint64_t timestamp = 0;
+            boost::asio::ip::address destination;
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+                if (kernel_timestamps::parse(cmsg, timestamp)) {
+                    continue;
+                }
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    int gso_size;
+                    std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                    segment = size_t(gso_size);
+                } else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+                    in_pktinfo info;
+                    std::memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+                    destination = boost::asio::ip::address_v4(ntohl(info.ipi_addr.s_addr));
+                } else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+                    in6_pktinfo info;
+                    std::memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+                    boost::asio::ip::address_v6::bytes_type bytes;
+                    std::memcpy(&bytes[0], &info.ipi6_addr, bytes.size());
+                    destination = boost::asio::ip::address_v6(bytes);
+                }
+            }
+
+            const char *data  = &ring.storage[i * ring.size];
+            size_t      total = std::min(size_t(ring.messages[i].msg_len), ring.size);
+            if (segment == 0) {
+                segment = total;
+            }
+
+            // coalesced datagrams (GRO) are split back, one otherwise
+            size_t offset = 0;
+            do {
+                received_datagram datagram;
+                datagram.endpoint  = ring.endpoints[i];
+                datagram.data      = boost::asio::const_buffer(data + offset, std::min(segment, total - offset));
+                datagram.truncated   = (header.msg_flags & MSG_TRUNC) != 0;
+                datagram.destination = destination;
+                datagram.timestamp   = timestamp;
+                ring.batch.push_back(datagram);
+                offset += segment;
+            } while (offset < total);
+        }
+        return size_t(result);
+#else
+        bool non_blocking = socket_.non_blocking();
+        socket_.non_blocking(true, error);
+        while (!error && ring.batch.size() < ring.count()) {
+            size_t i = ring.batch.size();
+            size_t length = socket_.receive_from(boost::asio::buffer(&ring.storage[i * ring.size], ring.size),
+                                                 ring.endpoints[i], 0, error);
+            if (!error) {
+                received_datagram datagram;
+                datagram.endpoint  = ring.endpoints[i];
+                datagram.data      = boost::asio::const_buffer(&ring.storage[i * ring.size], length);
+                datagram.truncated = false;
+                datagram.timestamp = 0;
+                ring.batch.push_back(datagram);
+            }
+        }
+        socket_.non_blocking(non_blocking);
+        if (!ring.batch.empty() && error == boost::asio::error::would_block) {
+            error = error_code();
+        }
+        return ring.batch.size();
+#endif
+    }
+
+#if defined(__linux__)
+    template <
+        typename Write_Handler>
+    void send_pending(Write_Handler callback, size_t sent)
+    {
+        while (sent < messages_.size()) {
+            size_t count = std::min(messages_.size() - sent, size_t(MAX_BATCH));
+            int result = ::sendmmsg(socket_.native_handle(), &messages_[sent], unsigned(count), MSG_DONTWAIT);
+            if (result >= 0) {
+                sent += size_t(result);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                socket_.async_send(boost::asio::null_buffers(),
+                                   [this, callback, sent](const error_code& error, size_t) {
+                                       if (error) {
+                                           callback(error, sent);
+                                       } else {
+                                           send_pending(callback, sent);
+                                       }
+                                   });
+                return;
+            } else if (errno != EINTR) {
+                error_code error(errno, boost::system::system_category());
+                ioservice_.post([callback, error, sent] {
+                    callback(error, sent);
+                });
+                return;
+            }
+        }
+
+        ioservice_.post([callback, sent] {
+            callback(error_code(), sent);
         });
     }
+#endif
 };
 
 } // namespace transport
@@ -0,0 +1,321 @@
+/**
+ * \file udp_multicast.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_udp_multicast_hpp__
+#define transport_udp_multicast_hpp__
+
+#include "transport/udp_connection.hpp"
+
+#include <functional>
+#include <memory>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Receives several multicast groups on one socket and receive loop
+ *
+ * Every joined group gets its own handler and counters, datagrams are
+ * dispatched by their destination address. Groups may be any-source or
+ * source-specific (SSM), the latter IPv4 only.
+ *
+ * Each receiver runs on the thread(s) of its io_service, spreading feeds over
+ * a few receivers is how many of them are handled by a few cores. \c join()
+ * and \c leave() must be called before \c start() or from that thread,
+ * group handlers included.
+ */
+class udp_multicast_receiver
+{
+public:
+    typedef udp_connection::error_code        error_code;
+    typedef udp_connection::received_datagram received_datagram;
+    typedef boost::asio::ip::address          address_type;
+
+    typedef std::function<void(const received_datagram&)> Handler_Type;
+
+    /**
+     * Extracts the sequence number of a datagram, returns \c false if it has none
+     */
+    typedef std::function<bool(boost::asio::const_buffer, uint64_t&)> Sequence_Type;
+
+    /**
+     * \brief Per group counters
+     */
+    struct group_stats {
+        uint64_t received;  ///< Datagrams delivered to the handler
+        uint64_t gaps;      ///< Times the sequence jumped forward
+        uint64_t missing;   ///< Sequence numbers skipped over by those jumps
+        uint64_t reordered; ///< Datagrams older than the last one, duplicates included
+    };
+
+    /**
+     * \brief Constructor
+     *
+     * \param port Port the groups are sent to
+     * \param interface Local interface used for joining, e.g. 127.0.0.1
+     * for loopback. The unspecified address lets the kernel choose.
+     *
+     * \throws boost::system::system_error if the socket cannot be set up,
+     * or cannot report the destination of datagrams, which is how they are
+     * told apart
+     */
+    udp_multicast_receiver(boost::asio::io_service& ioservice,
+                           uint16_t port,
+                           address_type interface = boost::asio::ip::address_v4::any())
+     : connection_(ioservice)
+     , interface_(interface)
+     , unmatched_(0)
+    {
+        udp_connection::socket_type& socket = connection_.socket();
+        udp_connection::endpoint_type endpoint(interface.is_v6() ? boost::asio::ip::udp::v6()
+                                                                 : boost::asio::ip::udp::v4(),
+                                               port);
+        socket.open(endpoint.protocol());
+        socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+        socket.bind(endpoint);
+        if (!connection_.enable_destination_info()) {
+            throw boost::system::system_error(boost::asio::error::operation_not_supported,
+                                              "multicast destination info");
+        }
+    }
+
+    udp_connection& connection()
+    {
+        return connection_;
+    }
+
+    /**
+     * \brief Big endian sequence number of \p width bytes at \p offset
+     */
+    static Sequence_Type big_endian_sequence(size_t offset, size_t width)
+    {
+        return [offset, width](boost::asio::const_buffer data, uint64_t& sequence) {
+            if (boost::asio::buffer_size(data) < offset + width) {
+                return false;
+            }
+            const uint8_t *bytes = boost::asio::buffer_cast<const uint8_t*>(data) + offset;
+            sequence = 0;
+            for (size_t i = 0; i < width; ++i) {
+                sequence = (sequence << 8) | bytes[i];
+            }
+            return true;
+        };
+    }
+
+    /**
+     * \brief Joins \p group, datagrams sent by anyone are delivered
+     *
+     * \param handler Called for every datagram of the group:
+     * \code handler(datagram: const received_datagram&) \endcode
+     * \param sequence Enables gap detection when set
+     */
+    void join(const address_type& group,
+              Handler_Type handler,
+              Sequence_Type sequence = Sequence_Type())
+    {
+        if (interface_.is_v4() && !interface_.is_unspecified()) {
+            connection_.socket().set_option(boost::asio::ip::multicast::join_group(group.to_v4(), interface_.to_v4()));
+        } else {
+            connection_.socket().set_option(boost::asio::ip::multicast::join_group(group));
+        }
+        add(group, address_type(), std::move(handler), std::move(sequence));
+    }
+
+    /**
+     * \brief Joins \p group accepting only datagrams sent by \p source (SSM)
+     */
+    void join(const address_type& group,
+              const address_type& source,
+              Handler_Type handler,
+              Sequence_Type sequence = Sequence_Type())
+    {
+        source_membership(IP_ADD_SOURCE_MEMBERSHIP, group, source);
+        add(group, source, std::move(handler), std::move(sequence));
+    }
+
+    /**
+     * \brief Leaves an any-source group
+     */
+    void leave(const address_type& group)
+    {
+        if (interface_.is_v4() && !interface_.is_unspecified()) {
+            connection_.socket().set_option(boost::asio::ip::multicast::leave_group(group.to_v4(), interface_.to_v4()));
+        } else {
+            connection_.socket().set_option(boost::asio::ip::multicast::leave_group(group));
+        }
+        remove(group, address_type());
+    }
+
+    /**
+     * \brief Leaves a source-specific group
+     */
+    void leave(const address_type& group, const address_type& source)
+    {
+        source_membership(IP_DROP_SOURCE_MEMBERSHIP, group, source);
+        remove(group, source);
+    }
+
+    /**
+     * \brief Starts the receive loop
+     */
+    void start()
+    {
+        connection_.receive([this](const error_code& error, const udp_connection::received_batch& batch) {
+            if (!error) {
+                for (const received_datagram& datagram : batch) {
+                    dispatch(datagram);
+                }
+            }
+        });
+    }
+
+    /**
+     * \brief Stops the receive loop, memberships are dropped with the socket
+     */
+    void stop()
+    {
+        error_code ignored;
+        connection_.socket().close(ignored);
+    }
+
+    /**
+     * \return Counters of \p group, all zero if it was not joined
+     */
+    group_stats stats(const address_type& group) const
+    {
+        group_stats total = { 0, 0, 0, 0 };
+        for (const subscription& s : groups_) {
+            if (s.group == group) {
+                total.received  += s.stats.received;
+                total.gaps      += s.stats.gaps;
+                total.missing   += s.stats.missing;
+                total.reordered += s.stats.reordered;
+            }
+        }
+        return total;
+    }
+
+    /**
+     * \return Datagrams received for groups not joined (anymore)
+     */
+    uint64_t unmatched() const
+    {
+        return unmatched_;
+    }
+
+private:
+
+    struct subscription {
+        address_type                  group;
+        address_type                  source;  // unspecified for any-source
+        std::shared_ptr<Handler_Type> handler; // kept alive by dispatch() while it runs
+        Sequence_Type                 sequence;
+        uint64_t                      expected;
+        bool                          sequenced;
+        group_stats                   stats;
+    };
+
+    udp_connection            connection_;
+    address_type              interface_;
+    std::vector<subscription> groups_; // a handful, a linear scan beats hashing
+    uint64_t                  unmatched_;
+
+    void add(const address_type& group,
+             const address_type& source,
+             Handler_Type handler,
+             Sequence_Type sequence)
+    {
+        subscription s;
+        s.group     = group;
+        s.source    = source;
+        s.handler   = std::make_shared<Handler_Type>(std::move(handler));
+        s.sequence  = std::move(sequence);
+        s.expected  = 0;
+        s.sequenced = false;
+        s.stats     = group_stats{ 0, 0, 0, 0 };
+        groups_.push_back(std::move(s));
+    }
+
+    void remove(const address_type& group, const address_type& source)
+    {
+        for (auto it = groups_.begin(); it != groups_.end(); ++it) {
+            if (it->group == group && it->source == source) {
+                groups_.erase(it);
+                return;
+            }
+        }
+    }
+
+    void source_membership(int option,
+                           const address_type& group,
+                           const address_type& source)
+    {
+#if defined(IP_ADD_SOURCE_MEMBERSHIP)
+        if (!group.is_v4() || !source.is_v4()) {
+            throw boost::system::system_error(boost::asio::error::address_family_not_supported,
+                                              "source-specific multicast is IPv4 only");
+        }
+
+        ip_mreq_source request;
+        std::memset(&request, 0, sizeof(request));
+        request.imr_multiaddr.s_addr  = htonl(group.to_v4().to_ulong());
+        request.imr_sourceaddr.s_addr = htonl(source.to_v4().to_ulong());
+        request.imr_interface.s_addr  = interface_.is_v4() ? htonl(interface_.to_v4().to_ulong()) : INADDR_ANY;
+
+        if (::setsockopt(connection_.socket().native_handle(), IPPROTO_IP, option, &request, sizeof(request)) != 0) {
+            throw boost::system::system_error(errno, boost::system::system_category(), "source membership");
+        }
+#else
+        (void)option;
+        (void)group;
+        (void)source;
+        throw boost::system::system_error(boost::asio::error::operation_not_supported,
+                                          "source-specific multicast");
+#endif
+    }
+
+    void dispatch(const received_datagram& datagram)
+    {
+        for (subscription& s : groups_) {
+            if (s.group != datagram.destination) {
+                continue;
+            }
+            if (!s.source.is_unspecified() && s.source != datagram.endpoint.address()) {
+                continue;
+            }
+
+            uint64_t sequence;
+            if (s.sequence && s.sequence(datagram.data, sequence)) {
+                track(s, sequence);
+            }
+            ++s.stats.received;
+            // the handler may join or leave, which moves or destroys s
+            std::shared_ptr<Handler_Type> handler = s.handler;
+            (*handler)(datagram);
+            return;
+        }
+        ++unmatched_;
+    }
+
+    static void track(subscription& s, uint64_t sequence)
+    {
+        if (!s.sequenced) {
+            s.sequenced = true;
+        } else if (sequence > s.expected) {
+            ++s.stats.gaps;
+            s.stats.missing += sequence - s.expected;
+        } else if (sequence < s.expected) {
+            ++s.stats.reordered;
+            return;
+        }
+        s.expected = sequence + 1;
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_udp_multicast_hpp__
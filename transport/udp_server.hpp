@@ -0,0 +1,273 @@
+/**
+ * \file udp_server.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_udp_server_hpp__
+#define transport_udp_server_hpp__
+
+#include "transport/udp_connection.hpp"
+
+#include <functional>
+#include <thread>
+
+#if defined(__linux__)
+ #include <linux/filter.h>
+ #include <pthread.h>
+ #include <sched.h>
+#endif
+
+namespace et {
+namespace transport {
+
+/**
+ * @brief Receives datagrams on a given port with one socket per thread
+ *
+ * Every thread owns an io_service and a \c udp_connection bound to the same
+ * port with SO_REUSEPORT, so the kernel spreads incoming datagrams over
+ * several receive queues and each one is drained by its own thread without
+ * any locking.
+ *
+ * Where SO_REUSEPORT is not available a single socket is used.
+ */
+class udp_server
+{
+    static const size_t THREADS = 2;
+public:
+
+    typedef std::function<void(size_t,
+                               udp_connection&,
+                               const udp_connection::error_code&,
+                               const udp_connection::received_batch&)> Handler_Type;
+
+    /**
+     * @brief How datagrams are distributed among the sockets
+     */
+    enum steering {
+        /**
+         * The kernel hashes source and destination address and port, so
+         * every peer sticks to the same thread as long as the number of
+         * sockets does not change
+         */
+        flow_hash,
+
+        /**
+         * Datagrams are delivered to the socket of the thread pinned to the
+         * CPU that received them, keeping the whole path on one core. There
+         * is one thread per CPU, whatever \c set_threads() said.
+         */
+        cpu
+    };
+
+    /**
+     * @brief Constructor
+     *
+     * @param port Bind port, zero picks one (see \c local_endpoint())
+     * @param ip Local address on which to bind to, empty means all interfaces
+     */
+    udp_server(unsigned short port,
+               std::string ip = "")
+     : ip_(ip)
+     , port_(port)
+     , threads_(THREADS)
+     , steering_(flow_hash)
+    { }
+
+    ~udp_server() {
+        stop();
+    }
+
+    /**
+     * @brief Sets the number of threads, and sockets, with \c flow_hash steering
+     */
+    void set_threads(size_t threads)
+    {
+        threads_ = threads;
+    }
+
+    void set_steering(steering mode)
+    {
+        steering_ = mode;
+    }
+
+    /**
+     * @brief Opens the sockets and starts receiving
+     *
+     * @param handler Called for every batch, on the thread owning the socket:
+     * \code handler(thread: size_t, socket: udp_connection&, error: error_code, batch: const received_batch&) \endcode
+     */
+    template <typename Handler>
+    void start(Handler handler)
+    {
+        open_sockets();
+        start_workers(std::move(handler));
+    }
+
+    void stop()
+    {
+        join_workers();
+        workers_.clear();
+
+        handler_ = Handler_Type();
+    }
+
+    /**
+     * @return The address the sockets are bound to
+     */
+    udp_connection::endpoint_type local_endpoint() const
+    {
+        return workers_.empty() ? udp_connection::endpoint_type()
+                                : workers_.front()->connection.socket().local_endpoint();
+    }
+
+    /**
+     * @return Number of sockets in use
+     */
+    size_t sockets() const
+    {
+        return workers_.size();
+    }
+
+protected:
+
+    /**
+     * Opens and binds one socket per worker, \c workers_ holds them all
+     * once it returns and no thread runs yet
+     */
+    void open_sockets()
+    {
+        udp_connection::endpoint_type endpoint;
+        if (ip_.empty()) {
+            endpoint = udp_connection::endpoint_type(boost::asio::ip::udp::v4(), port_);
+        } else {
+            endpoint = udp_connection::endpoint_type(boost::asio::ip::address::from_string(ip_), port_);
+        }
+
+        size_t sockets = threads_ == 0 ? 1 : threads_;
+        if (steering_ == cpu && std::thread::hardware_concurrency() != 0) {
+            // CPU c goes to socket c % sockets, the thread of which runs on CPU c only if they match
+            sockets = std::thread::hardware_concurrency();
+        }
+#if !defined(SO_REUSEPORT)
+        sockets = 1;
+#endif
+
+        for (size_t i = 0; i < sockets; ++i) {
+            workers_.emplace_back(new worker);
+            udp_connection::socket_type& socket = workers_.back()->connection.socket();
+            socket.open(endpoint.protocol());
+#if defined(SO_REUSEPORT)
+            int on = 1;
+            if (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+                throw boost::system::system_error(errno, boost::system::system_category(), "SO_REUSEPORT");
+            }
+#endif
+            socket.bind(endpoint);
+            if (endpoint.port() == 0) {
+                // the rest must join the group on the same port
+                endpoint.port(socket.local_endpoint().port());
+            }
+        }
+
+        if (steering_ == cpu) {
+            attach_cpu_steering();
+        }
+    }
+
+    /**
+     * Starts receiving on every socket, each from a thread of its own
+     */
+    template <typename Handler>
+    void start_workers(Handler handler)
+    {
+        handler_ = Handler_Type{std::move(handler)};
+
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            worker& w = *workers_[i];
+            w.connection.receive([this, i](const udp_connection::error_code& error,
+                                           const udp_connection::received_batch& batch) {
+                handler_(i, workers_[i]->connection, error, batch);
+            });
+            w.thread = std::thread([this, i] {
+                if (steering_ == cpu) {
+                    pin_to_cpu(i);
+                }
+                workers_[i]->ioservice.run();
+            });
+        }
+    }
+
+    struct worker {
+        boost::asio::io_service ioservice;
+        udp_connection          connection;
+        std::thread             thread;
+
+        worker()
+         : connection(ioservice)
+        { }
+    };
+
+    std::string                          ip_;
+    uint16_t                             port_;
+    size_t                               threads_;
+    steering                             steering_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    Handler_Type                         handler_;
+
+    /**
+     * Stops the threads, sockets stay open until the workers are destroyed
+     */
+    void join_workers()
+    {
+        for (auto& w : workers_) {
+            w->ioservice.stop();
+        }
+        for (auto& w : workers_) {
+            if (w->thread.joinable()) {
+                w->thread.join();
+            }
+        }
+    }
+
+    /**
+     * Makes the kernel pick socket number (cpu % sockets) in the group
+     */
+    void attach_cpu_steering()
+    {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+        sock_filter code[] = {
+            { BPF_LD  | BPF_W   | BPF_ABS, 0, 0, uint32_t(SKF_AD_OFF + SKF_AD_CPU) },
+            { BPF_ALU | BPF_MOD | BPF_K,   0, 0, uint32_t(workers_.size()) },
+            { BPF_RET | BPF_A,             0, 0, 0 }
+        };
+        sock_fprog program = { sizeof(code) / sizeof(code[0]), code };
+
+        int fd = workers_.front()->connection.socket().native_handle();
+        if (::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) != 0) {
+            throw boost::system::system_error(errno, boost::system::system_category(), "SO_ATTACH_REUSEPORT_CBPF");
+        }
+#endif
+    }
+
+    static void pin_to_cpu(size_t index)
+    {
+#if defined(__linux__)
+        unsigned cpus = std::thread::hardware_concurrency();
+        if (cpus == 0) {
+            return;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % cpus, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)index;
+#endif
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_udp_server_hpp__
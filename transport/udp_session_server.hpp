@@ -0,0 +1,163 @@
+/**
+ * \file udp_session_server.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_udp_session_server_hpp__
+#define transport_udp_session_server_hpp__
+
+#include "transport/udp_server.hpp"
+#include "transport/udp_session_table.hpp"
+
+#include <boost/asio/steady_timer.hpp>
+
+#include <chrono>
+
+namespace et {
+namespace transport {
+
+/**
+ * @brief Unconnected UDP server demultiplexing datagrams to per-peer sessions
+ *
+ * Every thread of the underlying \c udp_server owns a \c udp_session_table,
+ * since the kernel keeps each peer on the same socket (see
+ * \c udp_server::flow_hash) lookups need no locking at all.
+ *
+ * \c Session must provide:
+ * \code
+ *  Session(udp_connection& socket, const udp_connection::endpoint_type& peer);
+ *  void receive(boost::asio::const_buffer data);
+ * \endcode
+ * The socket may be used to reply to the peer. Sessions not receiving
+ * anything for the idle timeout are destroyed, as are all of them on stop().
+ *
+ * @remarks With \c udp_server::cpu steering a peer may show up on more than
+ * one thread and get one session in each.
+ */
+template <typename Session>
+class udp_session_server
+    : public udp_server
+{
+public:
+    typedef udp_session_table<Session>  table_type;
+    typedef std::chrono::steady_clock   clock;
+
+    udp_session_server(unsigned short port,
+                       std::string ip = "")
+     : udp_server(port, ip)
+     , idle_timeout_(std::chrono::seconds(60))
+    { }
+
+    ~udp_session_server() {
+        stop();
+    }
+
+    /**
+     * @brief Sessions without datagrams for this long are destroyed
+     */
+    void set_idle_timeout(clock::duration timeout)
+    {
+        idle_timeout_ = timeout;
+    }
+
+    void start()
+    {
+        epoch_ = clock::now();
+
+        // one shard per socket, whatever the steering made of threads_,
+        // all in place before a worker may look one up
+        open_sockets();
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            shards_.emplace_back(new shard);
+            shards_[i]->timer.reset(new boost::asio::steady_timer(workers_[i]->ioservice));
+            workers_[i]->ioservice.post([this, i] {
+                schedule_expiry(i);
+            });
+        }
+
+        start_workers([this](size_t index,
+                             udp_connection& socket,
+                             const udp_connection::error_code& error,
+                             const udp_connection::received_batch& batch) {
+            if (error) {
+                return;
+            }
+            table_type& table = shards_[index]->table;
+            uint64_t now = elapsed();
+            for (const udp_connection::received_datagram& datagram : batch) {
+                Session& session = table.find_or_create(datagram.endpoint, now,
+                                                        [&socket](const udp_connection::endpoint_type& peer) {
+                                                            return new Session(socket, peer);
+                                                        });
+                session.receive(datagram.data);
+            }
+        });
+    }
+
+    void stop()
+    {
+        join_workers();
+        shards_.clear();
+        udp_server::stop();
+    }
+
+    /**
+     * @return Number of live sessions
+     *
+     * @remarks Only accurate while the server is stopped
+     */
+    size_t sessions() const
+    {
+        size_t count = 0;
+        for (const auto& s : shards_) {
+            count += s->table.size();
+        }
+        return count;
+    }
+
+private:
+
+    struct shard {
+        table_type                                 table;
+        std::unique_ptr<boost::asio::steady_timer> timer;
+    };
+
+    clock::duration                     idle_timeout_;
+    clock::time_point                   epoch_;
+    std::vector<std::unique_ptr<shard>> shards_;
+
+    /**
+     * Milliseconds since start, sessions are stamped with it
+     */
+    uint64_t elapsed() const
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - epoch_).count());
+    }
+
+    /**
+     * Sweeps a quarter of the table every eighth of the idle timeout, so
+     * sessions live at most 1.5 times the timeout
+     */
+    void schedule_expiry(size_t index)
+    {
+        clock::duration interval = std::max<clock::duration>(idle_timeout_ / 8, std::chrono::milliseconds(10));
+        shard& s = *shards_[index];
+        s.timer->expires_from_now(interval);
+        s.timer->async_wait([this, index](const boost::system::error_code& error) {
+            if (error) {
+                return;
+            }
+            table_type& table = shards_[index]->table;
+            uint64_t idle = uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(idle_timeout_).count());
+            table.expire(elapsed(), idle, table.capacity() / 4 + 1,
+                         [](const udp_connection::endpoint_type&, Session&) { });
+            schedule_expiry(index);
+        });
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_udp_session_server_hpp__
@@ -0,0 +1,299 @@
+/**
+ * \file udp_session_table.hpp
+ * \author ichramm
+ *
+ * Created on
+ */
+#ifndef transport_udp_session_table_hpp__
+#define transport_udp_session_table_hpp__
+
+#include "transport/udp_connection.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace et {
+namespace transport {
+
+/**
+ * \brief Maps peer endpoints to sessions
+ *
+ * Open addressing with linear probing and backward shift deletion, so there
+ * are no tombstones and probes only walk a compact array of keys. Sessions
+ * themselves are heap allocated and never move, references to them remain
+ * valid until they are erased or expired.
+ *
+ * Not thread safe, meant to be owned by the thread draining a socket.
+ */
+template <typename Session>
+class udp_session_table
+{
+public:
+    typedef udp_connection::endpoint_type endpoint_type;
+    typedef Session                       session_type;
+
+    explicit udp_session_table(size_t capacity = 64)
+     : size_(0)
+     , cursor_(0)
+    {
+        size_t slots = 16;
+        while (slots < capacity) {
+            slots <<= 1;
+        }
+        slots_.resize(slots);
+    }
+
+    /**
+     * \brief Looks up the session of \p peer, marking it as seen at \p now
+     *
+     * \return \c nullptr if there is none
+     */
+    Session* find(const endpoint_type& peer, uint64_t now)
+    {
+        key k = make_key(peer);
+        size_t index;
+        if (!lookup(k, hash(k), index)) {
+            return nullptr;
+        }
+        slots_[index].last_seen = now;
+        return slots_[index].session.get();
+    }
+
+    /**
+     * \brief Looks up the session of \p peer, creating it with \p make if there is none
+     *
+     * \param make Called as \code make(peer) \endcode it must return a \c Session*
+     */
+    template <typename Factory>
+    Session& find_or_create(const endpoint_type& peer, uint64_t now, Factory make)
+    {
+        key k = make_key(peer);
+        uint64_t h = hash(k);
+        size_t index;
+        if (!lookup(k, h, index)) {
+            if ((size_ + 1) * 10 > slots_.size() * 7) {
+                grow();
+                lookup(k, h, index);
+            }
+            slot& s = slots_[index];
+            s.hash = h;
+            s.k = k;
+            s.session.reset(make(peer));
+            ++size_;
+        }
+        slots_[index].last_seen = now;
+        return *slots_[index].session;
+    }
+
+    /**
+     * \brief Destroys the session of \p peer
+     *
+     * \return \c false if there was none
+     */
+    bool erase(const endpoint_type& peer)
+    {
+        key k = make_key(peer);
+        size_t index;
+        if (!lookup(k, hash(k), index)) {
+            return false;
+        }
+        remove(index);
+        return true;
+    }
+
+    /**
+     * \brief Destroys sessions not seen in the last \p idle ticks
+     *
+     * The table is swept incrementally, each call examines up to \p budget
+     * slots starting where the previous one stopped.
+     *
+     * \param on_expired Called before destroying each session:
+     * \code on_expired(peer: const endpoint_type&, session: Session&) \endcode
+     * it must not modify the table
+     *
+     * \return Number of expired sessions
+     */
+    template <typename Expired_Handler>
+    size_t expire(uint64_t now, uint64_t idle, size_t budget, Expired_Handler on_expired)
+    {
+        size_t expired = 0;
+        size_t mask = slots_.size() - 1;
+        for ( ; budget > 0 && size_ > 0; --budget) {
+            slot& s = slots_[cursor_];
+            if (s.hash != 0 && now >= s.last_seen && now - s.last_seen >= idle) {
+                on_expired(make_endpoint(s.k), *s.session);
+                remove(cursor_); // another entry may shift into the cursor
+                ++expired;
+            } else {
+                cursor_ = (cursor_ + 1) & mask;
+            }
+        }
+        return expired;
+    }
+
+    /**
+     * \brief Calls \code f(peer: const endpoint_type&, session: Session&) \endcode for every session
+     */
+    template <typename Function>
+    void for_each(Function f)
+    {
+        for (slot& s : slots_) {
+            if (s.hash != 0) {
+                f(make_endpoint(s.k), *s.session);
+            }
+        }
+    }
+
+    void clear()
+    {
+        for (slot& s : slots_) {
+            s.clear();
+        }
+        size_ = 0;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t capacity() const
+    {
+        return slots_.size();
+    }
+
+private:
+
+    /**
+     * Address and port in a form cheap to hash and compare
+     */
+    struct key {
+        uint64_t high;
+        uint64_t low;
+        uint16_t port;
+        uint16_t family;
+
+        bool operator==(const key& other) const
+        {
+            return low == other.low && high == other.high &&
+                   port == other.port && family == other.family;
+        }
+    };
+
+    struct slot {
+        uint64_t                 hash; // zero means empty
+        key                      k;
+        uint64_t                 last_seen;
+        std::unique_ptr<Session> session;
+
+        slot()
+         : hash(0)
+         , last_seen(0)
+        { }
+
+        void clear()
+        {
+            hash = 0;
+            session.reset();
+        }
+    };
+
+    std::vector<slot> slots_;
+    size_t            size_;
+    size_t            cursor_;
+
+    static key make_key(const endpoint_type& endpoint)
+    {
+        key k;
+        k.port = endpoint.port();
+        if (endpoint.address().is_v4()) {
+            k.family = 4;
+            k.high   = 0;
+            k.low    = endpoint.address().to_v4().to_ulong();
+        } else {
+            boost::asio::ip::address_v6::bytes_type bytes = endpoint.address().to_v6().to_bytes();
+            k.family = 6;
+            std::memcpy(&k.high, &bytes[0], 8);
+            std::memcpy(&k.low,  &bytes[8], 8);
+        }
+        return k;
+    }
+
+    static endpoint_type make_endpoint(const key& k)
+    {
+        if (k.family == 4) {
+            return endpoint_type(boost::asio::ip::address_v4(uint32_t(k.low)), k.port);
+        }
+        boost::asio::ip::address_v6::bytes_type bytes;
+        std::memcpy(&bytes[0], &k.high, 8);
+        std::memcpy(&bytes[8], &k.low,  8);
+        return endpoint_type(boost::asio::ip::address_v6(bytes), k.port);
+    }
+
+    static uint64_t hash(const key& k)
+    {
+        // splitmix64 finalizer over the folded key
+        uint64_t h = k.high * 0x9E3779B97F4A7C15ull ^ k.low ^ (uint64_t(k.port) << 48) ^ k.family;
+        h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 27; h *= 0x94D049BB133111EBull;
+        h ^= h >> 31;
+        return h == 0 ? 1 : h;
+    }
+
+    /**
+     * Finds \p k, or the empty slot where it would go
+     */
+    bool lookup(const key& k, uint64_t h, size_t& index) const
+    {
+        size_t mask = slots_.size() - 1;
+        for (index = h & mask; slots_[index].hash != 0; index = (index + 1) & mask) {
+            if (slots_[index].hash == h && slots_[index].k == k) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void remove(size_t hole)
+    {
+        size_t mask = slots_.size() - 1;
+        slots_[hole].clear();
+        --size_;
+
+        // shift back entries that would become unreachable
+        for (size_t next = (hole + 1) & mask; slots_[next].hash != 0; next = (next + 1) & mask) {
+            size_t home = slots_[next].hash & mask;
+            bool stays = hole <= next ? (hole < home && home <= next)
+                                      : (hole < home || home <= next);
+            if (!stays) {
+                slots_[hole] = std::move(slots_[next]);
+                slots_[next].hash = 0;
+                hole = next;
+            }
+        }
+    }
+
+    void grow()
+    {
+        std::vector<slot> old(slots_.size() * 2);
+        old.swap(slots_);
+        cursor_ = 0;
+
+        size_t mask = slots_.size() - 1;
+        for (slot& s : old) {
+            if (s.hash != 0) {
+                size_t index = s.hash & mask;
+                while (slots_[index].hash != 0) {
+                    index = (index + 1) & mask;
+                }
+                slots_[index] = std::move(s);
+            }
+        }
+    }
+};
+
+} // namespace transport
+} // namespace et
+
+#endif // transport_udp_session_table_hpp__